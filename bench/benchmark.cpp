@@ -0,0 +1,180 @@
+#include "benchmark.hpp"
+#include <chrono>
+#include <algorithm>
+#include <cstdio>
+#include <ctime>
+#include <cmath>
+
+BenchmarkSuite::BenchmarkSuite(const bench_options_t& options): m_options(options) {
+    if (m_options.hardware_counters) {
+        m_counters_open = m_counters.Open();
+        if (!m_counters_open) printf("Running without hardware counters\n");
+    }
+}
+
+bool BenchmarkSuite::IsSelected(const std::string& name) const {
+    return m_options.filter.empty() || name.find(m_options.filter) != std::string::npos;
+}
+
+void BenchmarkSuite::Measure(const std::string& name, uint64_t operation_count, const std::function<void()>& loop) {
+    if (!IsSelected(name)) return;
+
+    loop();
+    for (unsigned int i = 0; i < m_options.repeat; ++i) {
+        StartCounters();
+        const auto start = std::chrono::steady_clock::now();
+        loop();
+        const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+        const perf_counter_values_t counters = StopCounters();
+
+        AddSample(name, "ns", false, elapsed.count() / operation_count);
+        AddCounterSamples(name, counters, static_cast<double>(operation_count), "op");
+    }
+}
+
+void BenchmarkSuite::AddSample(const std::string& name, const std::string& unit, bool higher_is_better, double value) {
+    result(name, unit, higher_is_better).samples.push_back(value);
+}
+
+void BenchmarkSuite::StartCounters() {
+    if (m_counters_open) m_counters.Start();
+}
+
+perf_counter_values_t BenchmarkSuite::StopCounters() {
+    if (!m_counters_open) return {};
+    return m_counters.Stop();
+}
+
+void BenchmarkSuite::AddCounterSamples(const std::string& name, const perf_counter_values_t& values, double operation_count,
+                                       const std::string& operation) {
+    if (operation_count <= 0.0) return;
+
+    const bool has_cycles = values.IsValid(perf_counter_t::Cycles) && values.Get(perf_counter_t::Cycles) != 0;
+    if (has_cycles && values.IsValid(perf_counter_t::Instructions)) {
+        const double ipc = static_cast<double>(values.Get(perf_counter_t::Instructions)) / values.Get(perf_counter_t::Cycles);
+        AddSample(name + ".ipc", "instructions/cycle", true, ipc);
+    }
+
+    for (const perf_counter_t counter : {perf_counter_t::Cycles, perf_counter_t::BranchMisses, perf_counter_t::L1dMisses}) {
+        if (!values.IsValid(counter)) continue;
+        const std::string counter_name = PerfCounters::GetName(counter);
+        AddSample(name + "." + counter_name + "_per_" + operation, counter_name + "/" + operation, false,
+                  values.Get(counter) / operation_count);
+    }
+}
+
+bench_result_t& BenchmarkSuite::result(const std::string& name, const std::string& unit, bool higher_is_better) {
+    for (bench_result_t& result : m_results) {
+        if (result.name == name) return result;
+    }
+    m_results.push_back({name, unit, higher_is_better, {}});
+    return m_results.back();
+}
+
+double BenchmarkSuite::Median(std::vector<double> samples) {
+    if (samples.empty()) return 0.0;
+    std::sort(samples.begin(), samples.end());
+    const size_t middle = samples.size() / 2;
+    if (samples.size() % 2 == 1) return samples[middle];
+    return (samples[middle - 1] + samples[middle]) / 2.0;
+}
+
+double BenchmarkSuite::MedianAbsoluteDeviation(const std::vector<double>& samples) {
+    const double median = Median(samples);
+    std::vector<double> deviations;
+    deviations.reserve(samples.size());
+    for (const double sample : samples) deviations.push_back(std::abs(sample - median));
+    return Median(deviations);
+}
+
+bench_build_t BenchmarkSuite::GetBuild() {
+    bench_build_t build = {"unknown", false, false};
+
+#if defined(__VERSION__)
+    build.compiler = __VERSION__;
+#endif
+
+#if defined(__OPTIMIZE__) || defined(NDEBUG)
+    build.optimized = true;
+#endif
+
+#if defined(__SANITIZE_ADDRESS__)
+    build.sanitized = true;
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+    build.sanitized = true;
+#endif
+#endif
+
+    return build;
+}
+
+static void writeJsonString(FILE* file, const std::string& str) {
+    fputc('"', file);
+    for (const char c : str) {
+        if (c == '"' || c == '\\') fputc('\\', file);
+        if (static_cast<unsigned char>(c) < 0x20) {
+            fprintf(file, "\\u%04x", c);
+        } else {
+            fputc(c, file);
+        }
+    }
+    fputc('"', file);
+}
+
+bool BenchmarkSuite::WriteJson(const std::string& path) const {
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) {
+        printf("Failed to open %s\n", path.c_str());
+        return false;
+    }
+
+    const bench_build_t build = GetBuild();
+
+    fprintf(file, "{\n");
+    fprintf(file, "  \"suite\": \"gb_bench\",\n");
+    fprintf(file, "  \"timestamp\": %lld,\n", static_cast<long long>(std::time(nullptr)));
+    fprintf(file, "  \"build\": {\"compiler\": ");
+    writeJsonString(file, build.compiler);
+    fprintf(file, ", \"optimized\": %s, \"sanitized\": %s},\n", build.optimized ? "true" : "false", build.sanitized ? "true" : "false");
+    fprintf(file, "  \"options\": {\"frames\": %u, \"repeat\": %u},\n", m_options.frames, m_options.repeat);
+
+    fprintf(file, "  \"counters\": [");
+    bool first_counter = true;
+    for (uint8_t i = 0; m_counters_open && i < static_cast<uint8_t>(perf_counter_t::COUNT); ++i) {
+        const perf_counter_t counter = static_cast<perf_counter_t>(i);
+        if (!m_counters.IsOpen(counter)) continue;
+        fprintf(file, "%s\"%s\"", first_counter ? "" : ", ", PerfCounters::GetName(counter));
+        first_counter = false;
+    }
+    fprintf(file, "],\n");
+    fprintf(file, "  \"results\": [");
+
+    for (size_t i = 0; i < m_results.size(); ++i) {
+        const bench_result_t& result = m_results[i];
+        const auto [min, max] = std::minmax_element(result.samples.begin(), result.samples.end());
+
+        fprintf(file, "%s\n    {\"name\": ", i == 0 ? "" : ",");
+        writeJsonString(file, result.name);
+        fprintf(file, ", \"unit\": ");
+        writeJsonString(file, result.unit);
+        fprintf(file, ", \"higher_is_better\": %s", result.higher_is_better ? "true" : "false");
+        fprintf(file, ", \"median\": %.10g, \"mad\": %.10g, \"min\": %.10g, \"max\": %.10g, \"samples\": [",
+                Median(result.samples), MedianAbsoluteDeviation(result.samples), *min, *max);
+        for (size_t j = 0; j < result.samples.size(); ++j) {
+            fprintf(file, "%s%.10g", j == 0 ? "" : ", ", result.samples[j]);
+        }
+        fprintf(file, "]}");
+    }
+
+    fprintf(file, "\n  ]\n}\n");
+    const bool ok = ferror(file) == 0;
+    fclose(file);
+    return ok;
+}
+
+void BenchmarkSuite::PrintSummary() const {
+    for (const bench_result_t& result : m_results) {
+        printf("%-48s %14.3f %s\n", result.name.c_str(), Median(result.samples), result.unit.c_str());
+    }
+}
@@ -0,0 +1,92 @@
+#pragma once
+#include "perf_counters.hpp"
+#include <stdint.h>
+#include <string>
+#include <vector>
+#include <functional>
+
+/*
+Collects benchmark results and writes them out as JSON.
+Every benchmark runs once to warm up and then once per repetition, each repetition is one sample.
+The median is the reported value, so a single run disturbed by the host doesn't move it.
+With hardware counters each sample also gets derived results next to its time (name.ipc,
+name.cycles_per_op, ...), which show why a change is faster rather than only that it is.
+*/
+
+struct bench_result_t {
+    std::string name;
+    std::string unit;
+    bool higher_is_better = false;
+    std::vector<double> samples;
+};
+
+struct bench_build_t {
+    const char* compiler;
+    bool optimized;
+    bool sanitized;
+};
+
+struct bench_options_t {
+    std::vector<std::string> rom_paths;
+    std::vector<std::string> movie_paths;
+    std::string output_path = "gb_bench.json";
+
+    // only benchmarks whose name contains this are run
+    std::string filter;
+    unsigned int frames = 600;
+    unsigned int repeat = 5;
+    bool run_micro = true;
+    bool run_macro = true;
+
+    // cycles, instructions, branch and l1d misses around every sample
+    bool hardware_counters = false;
+};
+
+class BenchmarkSuite {
+public:
+    BenchmarkSuite(const bench_options_t& options);
+
+    inline const bench_options_t& GetOptions() const { return m_options; }
+    inline const std::vector<bench_result_t>& GetResults() const { return m_results; }
+
+    bool IsSelected(const std::string& name) const;
+
+    // calls loop once per repetition, the sample is the host time per operation in nanoseconds
+    void Measure(const std::string& name, uint64_t operation_count, const std::function<void()>& loop);
+
+    // for benchmarks that take their samples themselves, call once per repetition
+    void AddSample(const std::string& name, const std::string& unit, bool higher_is_better, double value);
+
+    // hardware counters around one sample, they read as invalid unless requested and available
+    void StartCounters();
+    perf_counter_values_t StopCounters();
+
+    // ipc, plus cycles and misses per operation, operation names what was counted (op, instruction)
+    void AddCounterSamples(const std::string& name, const perf_counter_values_t& values, double operation_count,
+                           const std::string& operation);
+
+    bool WriteJson(const std::string& path) const;
+    void PrintSummary() const;
+
+    static double Median(std::vector<double> samples);
+
+    // median absolute deviation, a spread estimate that outliers don't inflate
+    static double MedianAbsoluteDeviation(const std::vector<double>& samples);
+
+    // the flags this binary was built with, results of different builds don't compare
+    static bench_build_t GetBuild();
+
+private:
+    bench_result_t& result(const std::string& name, const std::string& unit, bool higher_is_better);
+
+private:
+    bench_options_t m_options;
+    std::vector<bench_result_t> m_results;
+
+    PerfCounters m_counters;
+    bool m_counters_open = false;
+};
+
+// each layer skips the benchmarks the filter doesn't select
+void RunMicroBenchmarks(BenchmarkSuite& suite);
+void RunMacroBenchmarks(BenchmarkSuite& suite);
@@ -0,0 +1,153 @@
+#include "json_reader.hpp"
+#include <fstream>
+#include <sstream>
+#include <cstdlib>
+#include <cstdio>
+
+const json_value_t& json_value_t::operator[](const std::string& key) const {
+    static const json_value_t null_value;
+    for (const auto& [name, value] : members) {
+        if (name == key) return value;
+    }
+    return null_value;
+}
+
+class JsonParser {
+public:
+    JsonParser(const std::string& text): m_text(text) {}
+
+    bool Parse(json_value_t& value) {
+        if (!parseValue(value, 0)) return false;
+        skipWhitespace();
+        return m_pos == m_text.size();
+    }
+
+private:
+    void skipWhitespace() {
+        while (m_pos < m_text.size() && (m_text[m_pos] == ' ' || m_text[m_pos] == '\n' ||
+                                         m_text[m_pos] == '\r' || m_text[m_pos] == '\t')) {
+            m_pos++;
+        }
+    }
+
+    bool consume(char c) {
+        skipWhitespace();
+        if (m_pos >= m_text.size() || m_text[m_pos] != c) return false;
+        m_pos++;
+        return true;
+    }
+
+    bool consumeWord(const char* word) {
+        const std::string str(word);
+        if (m_text.compare(m_pos, str.size(), str) != 0) return false;
+        m_pos += str.size();
+        return true;
+    }
+
+    bool parseString(std::string& str) {
+        if (!consume('"')) return false;
+        while (m_pos < m_text.size() && m_text[m_pos] != '"') {
+            char c = m_text[m_pos++];
+            if (c == '\\') {
+                if (m_pos >= m_text.size()) return false;
+                c = m_text[m_pos++];
+                switch (c) {
+                    case 'n': c = '\n'; break;
+                    case 't': c = '\t'; break;
+                    case 'r': c = '\r'; break;
+                    case 'b': c = '\b'; break;
+                    case 'f': c = '\f'; break;
+                    case 'u': {
+                        // only ever written for control characters
+                        if (m_pos + 4 > m_text.size()) return false;
+                        c = static_cast<char>(std::strtol(m_text.substr(m_pos, 4).c_str(), nullptr, 16));
+                        m_pos += 4;
+                        break;
+                    }
+                    default: break;
+                }
+            }
+            str.push_back(c);
+        }
+        return consume('"');
+    }
+
+    bool parseValue(json_value_t& value, unsigned int depth) {
+        if (depth > MAX_DEPTH) return false;
+        skipWhitespace();
+        if (m_pos >= m_text.size()) return false;
+
+        const char c = m_text[m_pos];
+        if (c == '{') {
+            m_pos++;
+            value.type = json_type_t::Object;
+            if (consume('}')) return true;
+            do {
+                std::string key;
+                json_value_t member;
+                if (!parseString(key) || !consume(':') || !parseValue(member, depth + 1)) return false;
+                value.members.emplace_back(std::move(key), std::move(member));
+            } while (consume(','));
+            return consume('}');
+        }
+
+        if (c == '[') {
+            m_pos++;
+            value.type = json_type_t::Array;
+            if (consume(']')) return true;
+            do {
+                json_value_t item;
+                if (!parseValue(item, depth + 1)) return false;
+                value.items.push_back(std::move(item));
+            } while (consume(','));
+            return consume(']');
+        }
+
+        if (c == '"') {
+            value.type = json_type_t::String;
+            return parseString(value.string);
+        }
+
+        if (consumeWord("true") || consumeWord("false")) {
+            value.type = json_type_t::Bool;
+            value.boolean = c == 't';
+            return true;
+        }
+
+        if (consumeWord("null")) {
+            value.type = json_type_t::Null;
+            return true;
+        }
+
+        const char* start = m_text.c_str() + m_pos;
+        char* end = nullptr;
+        value.number = std::strtod(start, &end);
+        if (end == start) return false;
+        value.type = json_type_t::Number;
+        m_pos += end - start;
+        return true;
+    }
+
+    static constexpr unsigned int MAX_DEPTH = 64;
+
+    const std::string& m_text;
+    size_t m_pos = 0;
+};
+
+bool ParseJson(const std::string& text, json_value_t& value) {
+    value = json_value_t();
+    return JsonParser(text).Parse(value);
+}
+
+bool ReadJsonFile(const std::string& path, json_value_t& value) {
+    std::ifstream file(path, std::ios::binary);
+    if (!file) return false;
+
+    std::stringstream text;
+    text << file.rdbuf();
+    if (!ParseJson(text.str(), value)) {
+        printf("Failed to parse %s\n", path.c_str());
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,33 @@
+#pragma once
+#include <string>
+#include <vector>
+#include <utility>
+
+/*
+Just enough JSON to read back result files, no dependencies. Numbers are doubles and objects
+keep their members in file order.
+*/
+
+enum class json_type_t {
+    Null,
+    Bool,
+    Number,
+    String,
+    Array,
+    Object,
+};
+
+struct json_value_t {
+    json_type_t type = json_type_t::Null;
+    bool boolean = false;
+    double number = 0.0;
+    std::string string;
+    std::vector<json_value_t> items;
+    std::vector<std::pair<std::string, json_value_t>> members;
+
+    // null when the member doesn't exist or this isn't an object
+    const json_value_t& operator[](const std::string& key) const;
+};
+
+bool ParseJson(const std::string& text, json_value_t& value);
+bool ReadJsonFile(const std::string& path, json_value_t& value);
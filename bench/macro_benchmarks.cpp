@@ -0,0 +1,252 @@
+#include "benchmark.hpp"
+#include "emulator.hpp"
+#include "audio_sink.hpp"
+#include "rewind.hpp"
+#include "movie.hpp"
+#include "runtime_metrics.hpp"
+#include "pacer.hpp"
+#include "thread_pool.hpp"
+#include <chrono>
+#include <memory>
+#include <cstdio>
+
+/*
+Whole machines running headless as fast as they can, on real roms and recorded input.
+Every repetition starts from a freshly loaded rom, loading it isn't part of the measurement.
+*/
+
+static constexpr size_t REWIND_BUDGET_BYTES = 32 * 1024 * 1024;
+static constexpr unsigned int FORK_COUNT = 64;
+static constexpr unsigned int FORK_RUN_FRAMES = 10;
+
+struct run_stats_t {
+    double seconds = 0.0;
+    uint64_t frames = 0;
+    uint64_t instructions = 0;
+    perf_counter_values_t counters;
+};
+
+// the file name without directories and extension
+static std::string romName(const std::string& path) {
+    const size_t start = path.find_last_of("/\\") + 1;
+    const size_t end = path.find_last_of('.');
+    return path.substr(start, end == std::string::npos || end < start ? std::string::npos : end - start);
+}
+
+// runs until frame_limit frames are done or on_frame returns false
+static run_stats_t runFrames(BenchmarkSuite& suite, Emulator& emulator, unsigned int frame_limit,
+                             const std::function<bool()>& on_frame) {
+    run_stats_t stats;
+    emulator.SetFrameCallback([&] () {
+        stats.frames++;
+        if (!on_frame() || stats.frames >= frame_limit) emulator.Stop();
+    });
+
+    const uint64_t start_instructions = emulator.GetCpu().GetInstructionCount();
+    suite.StartCounters();
+    const auto start = std::chrono::steady_clock::now();
+    emulator.Run();
+    stats.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    stats.counters = suite.StopCounters();
+    stats.instructions = emulator.GetCpu().GetInstructionCount() - start_instructions;
+
+    emulator.SetFrameCallback(nullptr);
+    return stats;
+}
+
+static void addThroughput(BenchmarkSuite& suite, const std::string& name, const run_stats_t& stats) {
+    suite.AddSample(name + ".fps", "frames/s", true, stats.frames / stats.seconds);
+    suite.AddSample(name + ".mips", "MIPS", true, stats.instructions / stats.seconds / 1e6);
+
+    // per emulated instruction, so runs of different lengths and roms compare
+    suite.AddCounterSamples(name, stats.counters, static_cast<double>(stats.instructions), "instruction");
+}
+
+static std::unique_ptr<Emulator> loadRom(const std::string& rom_path, AudioSink* audio_sink) {
+    auto emulator = std::make_unique<Emulator>(rom_path, audio_sink);
+    emulator->GetCpu().SetLogVerbose(false);
+    return emulator;
+}
+
+static void runRomBenchmarks(BenchmarkSuite& suite, const std::string& rom_path) {
+    const bench_options_t& options = suite.GetOptions();
+    const std::string prefix = "rom." + romName(rom_path);
+    const auto keep_going = [] () { return true; };
+
+    for (unsigned int i = 0; i < options.repeat; ++i) {
+        if (suite.IsSelected(prefix + ".audio_off")) {
+            auto emulator = loadRom(rom_path, nullptr);
+            addThroughput(suite, prefix + ".audio_off", runFrames(suite, *emulator, options.frames, keep_going));
+        }
+
+        if (suite.IsSelected(prefix + ".audio_on")) {
+            HashAudioSink audio_sink;
+            auto emulator = loadRom(rom_path, &audio_sink);
+            addThroughput(suite, prefix + ".audio_on", runFrames(suite, *emulator, options.frames, keep_going));
+        }
+
+        if (suite.IsSelected(prefix + ".per_pixel_background")) {
+            auto emulator = loadRom(rom_path, nullptr);
+            emulator->GetPpu().SetBackgroundCacheEnabled(false);
+            addThroughput(suite, prefix + ".per_pixel_background", runFrames(suite, *emulator, options.frames, keep_going));
+        }
+
+        if (suite.IsSelected(prefix + ".rewind")) {
+            auto emulator = loadRom(rom_path, nullptr);
+            RewindBuffer rewind(emulator.get(), REWIND_BUDGET_BYTES, 1);
+            const run_stats_t stats = runFrames(suite, *emulator, options.frames, [&] () {
+                rewind.OnFrame();
+                return true;
+            });
+            addThroughput(suite, prefix + ".rewind", stats);
+            suite.AddSample(prefix + ".rewind.frame_cost", "us", false, rewind.GetAverageFrameCost().count() / 1e3);
+        }
+
+        // collected like a window would, without writing lines
+        if (suite.IsSelected(prefix + ".metrics")) {
+            auto emulator = loadRom(rom_path, nullptr);
+            Pacer pacer;
+            pacer.SetSpeed(0.0f);
+            RuntimeMetrics metrics(emulator.get(), &pacer, true);
+            std::chrono::steady_clock::duration metrics_time{0};
+            const run_stats_t stats = runFrames(suite, *emulator, options.frames, [&] () {
+                const auto start = std::chrono::steady_clock::now();
+                metrics.OnFrame(std::chrono::steady_clock::duration::zero());
+                metrics.OnPresent();
+                metrics_time += std::chrono::steady_clock::now() - start;
+                return true;
+            });
+            addThroughput(suite, prefix + ".metrics", stats);
+            suite.AddSample(prefix + ".metrics.frame_cost", "us", false,
+                            std::chrono::duration<double, std::micro>(metrics_time).count() / stats.frames);
+        }
+
+        if (suite.IsSelected(prefix + ".run_ahead")) {
+            auto emulator = loadRom(rom_path, nullptr);
+            emulator->SetRunAhead(1);
+            addThroughput(suite, prefix + ".run_ahead", runFrames(suite, *emulator, options.frames, keep_going));
+            suite.AddSample(prefix + ".run_ahead.frame_cost", "us", false, emulator->GetRunAheadCost().count() / 1e3);
+        }
+
+        // forks of a machine that ran for a while, each child runs a frame before it is reset
+        if (suite.IsSelected(prefix + ".fork")) {
+            auto emulator = loadRom(rom_path, nullptr);
+            runFrames(suite, *emulator, options.frames, keep_going);
+
+            std::vector<std::unique_ptr<Emulator>> children;
+            const auto fork_start = std::chrono::steady_clock::now();
+            for (unsigned int j = 0; j < FORK_COUNT; ++j) children.push_back(emulator->Fork());
+            const std::chrono::duration<double, std::micro> fork_time = std::chrono::steady_clock::now() - fork_start;
+
+            std::chrono::steady_clock::duration reset_time{0};
+            for (auto& child : children) {
+                child->RunUntil(child->GetCurrentCycle() + Emulator::CYCLES_PER_FRAME);
+                const auto reset_start = std::chrono::steady_clock::now();
+                child->Reset();
+                reset_time += std::chrono::steady_clock::now() - reset_start;
+            }
+
+            suite.AddSample(prefix + ".fork", "us", false, fork_time.count() / FORK_COUNT);
+            suite.AddSample(prefix + ".fork.reset", "us", false,
+                            std::chrono::duration<double, std::micro>(reset_time).count() / FORK_COUNT);
+        }
+
+        // the same forks run a few frames each, first one after the other and then all at once on the
+        // pool; every child holds a different button so they write to different pages
+        if (suite.IsSelected(prefix + ".fork.parallel")) {
+            auto emulator = loadRom(rom_path, nullptr);
+            runFrames(suite, *emulator, options.frames, keep_going);
+
+            std::vector<std::unique_ptr<Emulator>> children;
+            for (unsigned int j = 0; j < FORK_COUNT; ++j) children.push_back(emulator->Fork());
+            const uint64_t end_cycle = emulator->GetCurrentCycle() + FORK_RUN_FRAMES * Emulator::CYCLES_PER_FRAME;
+
+            std::vector<uint64_t> serial_hashes(FORK_COUNT);
+            std::vector<uint64_t> parallel_hashes(FORK_COUNT);
+            const auto run_child = [&] (unsigned int j, std::vector<uint64_t>& hashes) {
+                Emulator& child = *children[j];
+                child.ScheduleInput({child.GetCurrentCycle(), static_cast<uint8_t>(j % Joypad::BUTTON_COUNT), true});
+                child.RunUntil(end_cycle);
+                std::vector<uint8_t> state;
+                child.SaveState(state);
+                hashes[j] = Movie::HashState(state);
+                child.Reset();
+            };
+
+            const auto serial_start = std::chrono::steady_clock::now();
+            for (unsigned int j = 0; j < FORK_COUNT; ++j) run_child(j, serial_hashes);
+            const std::chrono::duration<double> serial_time = std::chrono::steady_clock::now() - serial_start;
+
+            ThreadPool pool;
+            const auto parallel_start = std::chrono::steady_clock::now();
+            for (unsigned int j = 0; j < FORK_COUNT; ++j) {
+                pool.Submit([&, j] () { run_child(j, parallel_hashes); });
+            }
+            pool.Wait();
+            const std::chrono::duration<double> parallel_time = std::chrono::steady_clock::now() - parallel_start;
+
+            unsigned int mismatches = 0;
+            for (unsigned int j = 0; j < FORK_COUNT; ++j) {
+                if (serial_hashes[j] != parallel_hashes[j]) mismatches++;
+            }
+            if (mismatches != 0) {
+                printf("%s: %u of %u children ended in a different state than their serial run\n",
+                       (prefix + ".fork.parallel").c_str(), mismatches, FORK_COUNT);
+            }
+
+            suite.AddSample(prefix + ".fork.parallel", "frames/s", true, FORK_COUNT * FORK_RUN_FRAMES / parallel_time.count());
+            suite.AddSample(prefix + ".fork.parallel.speedup", "x", true, serial_time.count() / parallel_time.count());
+        }
+    }
+}
+
+// false if the movie wasn't recorded on this rom
+static bool playMovie(BenchmarkSuite& suite, const std::string& name, const std::string& rom_path, const std::string& movie_path) {
+    auto emulator = loadRom(rom_path, nullptr);
+    Movie movie(emulator.get());
+    if (!movie.LoadFromFile(movie_path) || !movie.StartPlayback()) return false;
+
+    const run_stats_t stats = runFrames(suite, *emulator, UINT32_MAX, [&] () {
+        movie.OnFrame();
+        return movie.IsPlaying();
+    });
+    addThroughput(suite, name, stats);
+
+    if (movie.GetDesyncCount() != 0) {
+        printf("%s desynced on %u of %u checkpoints\n", movie_path.c_str(), movie.GetDesyncCount(), movie.GetCheckedCount());
+    }
+    return true;
+}
+
+// the movie is played on the first rom it was recorded with
+static void runMovieBenchmarks(BenchmarkSuite& suite, const std::string& movie_path) {
+    const bench_options_t& options = suite.GetOptions();
+    const std::string name = "movie." + romName(movie_path);
+    if (!suite.IsSelected(name)) return;
+
+    for (const std::string& rom_path : options.rom_paths) {
+        if (!playMovie(suite, name, rom_path, movie_path)) continue;
+        for (unsigned int i = 1; i < options.repeat; ++i) playMovie(suite, name, rom_path, movie_path);
+        return;
+    }
+
+    printf("None of the roms matches %s\n", movie_path.c_str());
+}
+
+void RunMacroBenchmarks(BenchmarkSuite& suite) {
+    for (const std::string& rom_path : suite.GetOptions().rom_paths) {
+        try {
+            runRomBenchmarks(suite, rom_path);
+        } catch (const std::exception& e) {
+            printf("%s failed: %s\n", rom_path.c_str(), e.what());
+        }
+    }
+
+    for (const std::string& movie_path : suite.GetOptions().movie_paths) {
+        try {
+            runMovieBenchmarks(suite, movie_path);
+        } catch (const std::exception& e) {
+            printf("%s failed: %s\n", movie_path.c_str(), e.what());
+        }
+    }
+}
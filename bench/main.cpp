@@ -0,0 +1,119 @@
+#include "benchmark.hpp"
+#include "regression_gate.hpp"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <string>
+
+static void printUsage() {
+    printf("Usage: gb_bench [options]\n");
+    printf("  --rom=<path>      rom for the throughput benchmarks, can be given several times\n");
+    printf("  --movie=<path>    input movie played on the first matching rom, can be given several times\n");
+    printf("  --frames=<n>      frames each rom runs for (default 600)\n");
+    printf("  --repeat=<n>      samples per benchmark (default 5)\n");
+    printf("  --filter=<text>   only runs the benchmarks whose name contains the text\n");
+    printf("  --out=<path>      json results (default gb_bench.json)\n");
+    printf("  --micro           only the component benchmarks\n");
+    printf("  --macro           only the rom and movie benchmarks\n");
+    printf("  --perf            adds ipc, cycles, branch and l1d misses per operation from the hardware counters\n");
+    printf("  --baseline=<path> compares against an earlier result file, exits with 2 if anything regressed\n");
+    printf("  --machine=<name>  uses bench/baselines/<name>.json as the baseline\n");
+    printf("  --threshold=<%%>   how much worse than the baseline a benchmark may get (default 5)\n");
+    printf("  --update-baseline writes the results to the baseline instead of comparing\n");
+}
+
+// exit code of a run that regressed, errors exit with 1
+static constexpr int REGRESSION_EXIT_CODE = 2;
+
+int main(int argc, char** argv) {
+
+    bench_options_t options;
+    std::string baseline_path;
+    double threshold_percent = 5.0;
+    bool update_baseline = false;
+
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const auto value_of = [&arg] (const std::string& option) {
+            return arg.rfind(option, 0) == 0 ? arg.substr(option.size()) : std::string();
+        };
+
+        if (arg == "--micro") {
+            options.run_macro = false;
+        } else if (arg == "--macro") {
+            options.run_micro = false;
+        } else if (arg == "--perf") {
+            options.hardware_counters = true;
+        } else if (arg == "--update-baseline") {
+            update_baseline = true;
+        } else if (!value_of("--baseline=").empty()) {
+            baseline_path = value_of("--baseline=");
+        } else if (!value_of("--machine=").empty()) {
+            baseline_path = PROJECT_DIR"/bench/baselines/" + value_of("--machine=") + ".json";
+        } else if (!value_of("--threshold=").empty()) {
+            threshold_percent = std::stod(value_of("--threshold="));
+        } else if (!value_of("--rom=").empty()) {
+            options.rom_paths.push_back(value_of("--rom="));
+        } else if (!value_of("--movie=").empty()) {
+            options.movie_paths.push_back(value_of("--movie="));
+        } else if (!value_of("--frames=").empty()) {
+            options.frames = std::stoul(value_of("--frames="));
+        } else if (!value_of("--repeat=").empty()) {
+            options.repeat = std::stoul(value_of("--repeat="));
+        } else if (!value_of("--filter=").empty()) {
+            options.filter = value_of("--filter=");
+        } else if (!value_of("--out=").empty()) {
+            options.output_path = value_of("--out=");
+        } else {
+            printUsage();
+            return 1;
+        }
+    }
+
+    if (options.repeat == 0 || options.frames == 0) {
+        printf("--repeat and --frames have to be at least 1\n");
+        return 1;
+    }
+
+    if (options.rom_paths.empty() && options.run_macro) {
+        const std::string default_rom = PROJECT_DIR"/roms/mario.gb";
+        if (std::ifstream(default_rom).good()) {
+            options.rom_paths.push_back(default_rom);
+        } else {
+            printf("No rom given, skipping the rom and movie benchmarks\n");
+        }
+    }
+
+    if (update_baseline && baseline_path.empty()) {
+        printf("--update-baseline needs --baseline or --machine\n");
+        return 1;
+    }
+
+    // loaded up front so a missing baseline fails before the long run
+    RegressionGate gate(threshold_percent);
+    const bool compare = !baseline_path.empty() && !update_baseline;
+    if (compare && !gate.LoadBaseline(baseline_path)) {
+        printf("Create it with --update-baseline\n");
+        return 1;
+    }
+
+    BenchmarkSuite suite(options);
+    if (options.run_micro) RunMicroBenchmarks(suite);
+    if (options.run_macro) RunMacroBenchmarks(suite);
+
+    if (!compare) suite.PrintSummary();
+    if (!suite.WriteJson(options.output_path)) return 1;
+    printf("Results written to %s\n", options.output_path.c_str());
+
+    if (update_baseline) {
+        // the first baseline of a machine class may be the first file in its directory
+        std::error_code error;
+        const std::filesystem::path baseline_dir = std::filesystem::path(baseline_path).parent_path();
+        if (!baseline_dir.empty()) std::filesystem::create_directories(baseline_dir, error);
+        if (!suite.WriteJson(baseline_path)) return 1;
+        printf("Baseline written to %s\n", baseline_path.c_str());
+    }
+
+    if (compare && !gate.Check(suite)) return REGRESSION_EXIT_CODE;
+    return 0;
+}
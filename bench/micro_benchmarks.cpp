@@ -0,0 +1,373 @@
+#include "benchmark.hpp"
+#include "memory.hpp"
+#include "scheduler.hpp"
+#include "cpu.hpp"
+#include "ppu.hpp"
+#include "timer.hpp"
+#include "apu.hpp"
+#include "audio_sink.hpp"
+#include "common.hpp"
+#include <cstring>
+#include <cstdio>
+
+/*
+Single components in isolation. They are wired together like in the emulator, on a generated
+rom so no files are needed, and driven directly instead of through the cpu.
+*/
+
+static constexpr unsigned int CYCLES_PER_FRAME = 17556;
+
+// M-cycles between two calls into the scheduler, roughly one instruction
+static constexpr unsigned int CYCLES_PER_STEP = 4;
+
+static constexpr uint64_t MEMORY_ITERATIONS = 1 << 20;
+static constexpr uint64_t OPCODE_ITERATIONS = 20000;
+static constexpr uint64_t LINE_ITERATIONS = 20000;
+static constexpr uint64_t FRAME_ITERATIONS = 200;
+
+// same sequence on every run so the results stay comparable
+static uint32_t nextRandom(uint32_t& state) {
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+// keeps the compiler from dropping the reads
+static volatile uint8_t s_sink = 0;
+
+class NullAudioSink : public AudioSink {
+public:
+    void PushSamples(void*, size_t len) override { m_sample_count += len / sizeof(float); }
+    inline unsigned int GetSampleRate() const override { return DEFAULT_SAMPLE_RATE; }
+
+private:
+    uint64_t m_sample_count = 0;
+};
+
+struct bench_machine_t {
+    bench_machine_t();
+
+    std::vector<uint8_t> framebuffer;
+    NullAudioSink audio_sink;
+    Memory memory;
+    Scheduler scheduler;
+    Cpu cpu;
+    Ppu ppu;
+    Timer timer;
+    Apu apu;
+};
+
+bench_machine_t::bench_machine_t():
+    framebuffer(160 * 144 * 3),
+    memory(0xFFFF + 1),
+    cpu(&memory, 1 << 20),
+    ppu(&memory, framebuffer, [] () {}),
+    timer(&memory, &scheduler),
+    apu(&memory, &audio_sink, &scheduler, &timer) {
+
+    // MBC1 with 4 rom banks and one bank of external ram
+    std::vector<uint8_t> rom(4 * 0x4000);
+    uint32_t random = 0x12345678;
+    for (uint8_t& byte : rom) byte = static_cast<uint8_t>(nextRandom(random));
+    rom[0x0147] = 0x03;
+    rom[0x0148] = 0x01;
+    rom[0x0149] = 0x02;
+    memory.LoadRom(rom.data(), rom.size());
+    memory.WriteByte(0x0000, 0x0A);
+
+    cpu.SetLogVerbose(false);
+}
+
+struct memory_region_t {
+    const char* name;
+    uint16_t base;
+    uint16_t mask;
+};
+
+static void runMemoryBenchmarks(BenchmarkSuite& suite) {
+    bench_machine_t machine;
+    Memory& memory = machine.memory;
+
+    // echo ram is left out, the emulator treats reading it as an error
+    static constexpr memory_region_t READ_REGIONS[] = {
+        {"rom0", 0x0000, 0x3FFF},
+        {"romx", 0x4000, 0x3FFF},
+        {"vram", 0x8000, 0x1FFF},
+        {"xram", 0xA000, 0x1FFF},
+        {"wram", 0xC000, 0x1FFF},
+        {"oam", 0xFE00, 0x007F},
+        {"io", 0xFF40, 0x0007},
+        {"timer", 0xFF04, 0x0003},
+        {"apu", 0xFF10, 0x000F},
+        {"hram", 0xFF80, 0x003F},
+    };
+
+    // rom writes are mbc register writes, the io registers are ones without side effects
+    static constexpr memory_region_t WRITE_REGIONS[] = {
+        {"mbc", 0x2000, 0x0001},
+        {"vram", 0x8000, 0x1FFF},
+        {"xram", 0xA000, 0x1FFF},
+        {"wram", 0xC000, 0x1FFF},
+        {"oam", 0xFE00, 0x007F},
+        {"io", 0xFF48, 0x0003},
+        {"apu", 0xFF24, 0x0001},
+        {"hram", 0xFF80, 0x003F},
+    };
+
+    for (const memory_region_t& region : READ_REGIONS) {
+        suite.Measure(std::string("memory.read.") + region.name, MEMORY_ITERATIONS, [&] {
+            uint8_t sum = 0;
+            for (uint64_t i = 0; i < MEMORY_ITERATIONS; ++i) {
+                sum += memory.ReadByte(region.base + (i & region.mask));
+            }
+            s_sink = sum;
+        });
+    }
+
+    for (const memory_region_t& region : WRITE_REGIONS) {
+        suite.Measure(std::string("memory.write.") + region.name, MEMORY_ITERATIONS, [&] {
+            for (uint64_t i = 0; i < MEMORY_ITERATIONS; ++i) {
+                // bank numbers 1 and 2 for the mbc, all values are fine everywhere else
+                memory.WriteByte(region.base + (i & region.mask), static_cast<uint8_t>(1 + (i & 1)));
+            }
+        });
+    }
+}
+
+// friend of Cpu
+class CpuBenchmark {
+public:
+    static void Run(BenchmarkSuite& suite);
+
+private:
+    // every pointer register lands in work ram, (C) and a8 in high ram and a16 away from the code
+    static constexpr uint16_t CODE_ADDR = 0xC000;
+    static constexpr uint16_t STACK_ADDR = 0xDFF0;
+    static constexpr uint8_t OPERAND_LOW = 0x80;
+    static constexpr uint8_t OPERAND_HIGH = 0xC1;
+
+    // B C D E H L F A
+    static constexpr uint8_t REGS[8] = {0xC1, 0x80, 0xC2, 0x00, 0xC3, 0x00, 0x00, 0x12};
+
+    static bool isUnusedOpcode(uint8_t opcode);
+};
+
+bool CpuBenchmark::isUnusedOpcode(uint8_t opcode) {
+    switch (opcode) {
+        case 0xD3: case 0xDB: case 0xDD: case 0xE3: case 0xE4: case 0xEB: case 0xEC: case 0xED: case 0xF4: case 0xFC: case 0xFD:
+            return true;
+        // the prefix is covered by the cb table, and the cpu stops on 0xFF (RST 38) as a crash guard
+        case 0xCB: case 0xFF:
+            return true;
+        default:
+            return false;
+    }
+}
+
+void CpuBenchmark::Run(BenchmarkSuite& suite) {
+    bench_machine_t machine;
+    Cpu& cpu = machine.cpu;
+
+    for (const bool cb_prefixed : {false, true}) {
+        for (unsigned int opcode = 0; opcode < 0x100; ++opcode) {
+            if (!cb_prefixed && isUnusedOpcode(opcode)) continue;
+
+            char name[32];
+            snprintf(name, sizeof(name), "cpu.%s.%02x", cb_prefixed ? "cb" : "op", opcode);
+            if (!suite.IsSelected(name)) continue;
+
+            const uint8_t code[3] = {
+                cb_prefixed ? static_cast<uint8_t>(0xCB) : static_cast<uint8_t>(opcode),
+                cb_prefixed ? static_cast<uint8_t>(opcode) : OPERAND_LOW,
+                OPERAND_HIGH,
+            };
+            for (uint16_t i = 0; i < sizeof(code); ++i) machine.memory.WriteByte(CODE_ADDR + i, code[i]);
+
+            // registers are reset before every step so jumps, halts and pointer increments can't run away
+            suite.Measure(name, OPCODE_ITERATIONS, [&] {
+                bool stop_signal = false;
+                for (uint64_t i = 0; i < OPCODE_ITERATIONS; ++i) {
+                    std::memcpy(cpu.m_regs, REGS, sizeof(REGS));
+                    cpu.PC = CODE_ADDR;
+                    cpu.SP = STACK_ADDR;
+                    cpu.m_halted = false;
+                    cpu.m_ime = false;
+                    cpu.m_enable_ime_next_cycle = false;
+
+                    unsigned int cycle_count = 0;
+                    cpu.CpuStep(stop_signal, cycle_count);
+                }
+            });
+        }
+    }
+}
+
+// friend of Ppu
+class PpuBenchmark {
+public:
+    static void Run(BenchmarkSuite& suite);
+
+private:
+    // fills vram and oam so every layer has something to draw, 10 objects on the lines of each band
+    static void setupScene(bench_machine_t& machine);
+
+    static constexpr uint8_t OBJECT_BAND_LINE = 40;
+};
+
+void PpuBenchmark::setupScene(bench_machine_t& machine) {
+    Memory& memory = machine.memory;
+    uint32_t random = 0x9E3779B9;
+
+    for (uint16_t addr = Ppu::VRAM_ADDR; addr < 0xA000; ++addr) {
+        memory.WriteByte(addr, static_cast<uint8_t>(nextRandom(random)));
+    }
+
+    // 4 bands of 10 objects
+    for (uint8_t i = 0; i < 40; ++i) {
+        const uint16_t addr = Ppu::OAM_ADDR + i * 4;
+        memory.WriteByte(addr, static_cast<uint8_t>(16 + OBJECT_BAND_LINE * (i / 10)));
+        memory.WriteByte(addr + 1, static_cast<uint8_t>(8 + 15 * (i % 10)));
+        memory.WriteByte(addr + 2, static_cast<uint8_t>(nextRandom(random)));
+        memory.WriteByte(addr + 3, static_cast<uint8_t>(nextRandom(random) & 0xF0));
+    }
+
+    // lcd, window, objects and background on, window over the lower right quarter
+    memory.WriteByteDirect(Ppu::LCDC_ADDR, 0xF3);
+    memory.WriteByteDirect(Ppu::SCY_ADDR, 5);
+    memory.WriteByteDirect(Ppu::SCX_ADDR, 3);
+    memory.WriteByteDirect(Ppu::WY_ADDR, 72);
+    memory.WriteByteDirect(Ppu::WX_ADDR, 87);
+    memory.WriteByteDirect(Ppu::BGP_ADDR, 0xE4);
+    memory.WriteByteDirect(Ppu::OBP0_ADDR, 0xD2);
+    memory.WriteByteDirect(Ppu::OBP1_ADDR, 0x1B);
+}
+
+void PpuBenchmark::Run(BenchmarkSuite& suite) {
+    bench_machine_t machine;
+    Ppu& ppu = machine.ppu;
+    setupScene(machine);
+
+    for (const bool cached : {false, true}) {
+        ppu.SetBackgroundCacheEnabled(cached);
+        suite.Measure(cached ? "ppu.background_line.cached" : "ppu.background_line.per_pixel", LINE_ITERATIONS, [&] {
+            for (uint64_t i = 0; i < LINE_ITERATIONS; ++i) {
+                ppu.renderBackgroundLine(static_cast<uint8_t>(i % Ppu::SCREEN_HEIGHT));
+            }
+        });
+    }
+
+    // what a frame that changed vram costs on top of its lines
+    suite.Measure("ppu.background_cache.rebuild", FRAME_ITERATIONS, [&] {
+        for (uint64_t i = 0; i < FRAME_ITERATIONS; ++i) {
+            machine.memory.MarkVramDirty();
+            ppu.updateBackgroundCache(true);
+        }
+    });
+
+    OAM_t oam_buffer[10];
+    uint8_t oam_buffer_size = 0;
+    const auto scan_line = [&] () {
+        oam_buffer_size = 0;
+        uint16_t oam_ptr = Ppu::OAM_ADDR;
+        while (oam_buffer_size < 10 && oam_ptr < Ppu::OAM_ADDR + Ppu::OAM_SIZE) {
+            ppu.oamScan(OBJECT_BAND_LINE, oam_buffer, oam_buffer_size, oam_ptr);
+        }
+    };
+
+    suite.Measure("ppu.oam_scan_line", LINE_ITERATIONS, [&] {
+        for (uint64_t i = 0; i < LINE_ITERATIONS; ++i) scan_line();
+    });
+
+    scan_line();
+    ASSERT(oam_buffer_size == 10);
+    ppu.renderBackgroundLine(OBJECT_BAND_LINE);
+    suite.Measure("ppu.object_line.10_objects", LINE_ITERATIONS, [&] {
+        for (uint64_t i = 0; i < LINE_ITERATIONS; ++i) {
+            ppu.renderObjectLine(OBJECT_BAND_LINE, oam_buffer, oam_buffer_size);
+        }
+    });
+}
+
+// advances the scheduler through one frame in instruction sized steps
+static void runSchedulerFrame(Scheduler& scheduler) {
+    for (unsigned int cycle = 0; cycle < CYCLES_PER_FRAME; cycle += CYCLES_PER_STEP) {
+        scheduler.Advance(CYCLES_PER_STEP);
+    }
+}
+
+static void runTimerBenchmarks(BenchmarkSuite& suite) {
+    bench_machine_t machine;
+    Memory& memory = machine.memory;
+
+    // the fastest clock select, every read has to catch TIMA up
+    memory.WriteByte(0xFF07, 0x05);
+    suite.Measure("timer.read_tima", MEMORY_ITERATIONS, [&] {
+        uint8_t sum = 0;
+        for (uint64_t i = 0; i < MEMORY_ITERATIONS; ++i) {
+            machine.scheduler.Advance(CYCLES_PER_STEP);
+            sum += memory.ReadByte(0xFF05);
+        }
+        s_sink = sum;
+    });
+
+    // the timer doesn't step, so this is the scheduler cost of a frame with an idle timer
+    memory.WriteByte(0xFF07, 0x00);
+    suite.Measure("timer.frame.idle", FRAME_ITERATIONS, [&] {
+        for (uint64_t i = 0; i < FRAME_ITERATIONS; ++i) runSchedulerFrame(machine.scheduler);
+    });
+
+    // TMA 0xFF at the fastest clock overflows on every increment, the worst case for the overflow event
+    memory.WriteByte(0xFF06, 0xFF);
+    memory.WriteByte(0xFF07, 0x05);
+    suite.Measure("timer.frame.overflow_every_increment", FRAME_ITERATIONS, [&] {
+        for (uint64_t i = 0; i < FRAME_ITERATIONS; ++i) runSchedulerFrame(machine.scheduler);
+    });
+}
+
+static void runApuBenchmarks(BenchmarkSuite& suite) {
+    bench_machine_t machine;
+    Memory& memory = machine.memory;
+
+    // powered with every channel off
+    suite.Measure("apu.frame.silent", FRAME_ITERATIONS, [&] {
+        for (uint64_t i = 0; i < FRAME_ITERATIONS; ++i) runSchedulerFrame(machine.scheduler);
+    });
+
+    uint32_t random = 0xC0FFEE;
+    for (uint16_t addr = 0xFF30; addr < 0xFF40; ++addr) {
+        memory.WriteByte(addr, static_cast<uint8_t>(nextRandom(random)));
+    }
+
+    // all four channels playing at full volume without length or envelope, so they never stop
+    static constexpr uint16_t CHANNEL_SETUP[][2] = {
+        {0xFF26, 0x80}, {0xFF24, 0x77}, {0xFF25, 0xFF},
+        {0xFF10, 0x00}, {0xFF11, 0x80}, {0xFF12, 0xF0}, {0xFF13, 0x00}, {0xFF14, 0x87},
+        {0xFF16, 0x40}, {0xFF17, 0xF0}, {0xFF18, 0x80}, {0xFF19, 0x86},
+        {0xFF1A, 0x80}, {0xFF1B, 0x00}, {0xFF1C, 0x20}, {0xFF1D, 0x00}, {0xFF1E, 0x87},
+        {0xFF20, 0x00}, {0xFF21, 0xF0}, {0xFF22, 0x00}, {0xFF23, 0x80},
+    };
+    for (const auto& [addr, byte] : CHANNEL_SETUP) {
+        memory.WriteByte(addr, static_cast<uint8_t>(byte));
+    }
+
+    suite.Measure("apu.frame.all_channels", FRAME_ITERATIONS, [&] {
+        for (uint64_t i = 0; i < FRAME_ITERATIONS; ++i) runSchedulerFrame(machine.scheduler);
+    });
+
+    // a write brings the channels up to date first, games do this many times per frame
+    suite.Measure("apu.write_register", MEMORY_ITERATIONS, [&] {
+        for (uint64_t i = 0; i < MEMORY_ITERATIONS; ++i) {
+            machine.scheduler.Advance(CYCLES_PER_STEP);
+            memory.WriteByte(0xFF24, (i & 1) ? 0x77 : 0x55);
+        }
+    });
+}
+
+void RunMicroBenchmarks(BenchmarkSuite& suite) {
+    runMemoryBenchmarks(suite);
+    CpuBenchmark::Run(suite);
+    PpuBenchmark::Run(suite);
+    runTimerBenchmarks(suite);
+    runApuBenchmarks(suite);
+}
@@ -0,0 +1,122 @@
+#include "perf_counters.hpp"
+#include <cstdio>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <cerrno>
+#include <cstring>
+
+static int openCounter(uint32_t type, uint64_t config) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = type;
+    attr.config = config;
+    attr.disabled = 1;
+    // user space only, that is all perf_event_paranoid 2 allows
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+}
+
+PerfCounters::~PerfCounters() {
+    for (int fd : m_fds) {
+        if (fd >= 0) close(fd);
+    }
+}
+
+bool PerfCounters::Open() {
+    static constexpr uint64_t L1D_READ_MISS = PERF_COUNT_HW_CACHE_L1D |
+                                              (PERF_COUNT_HW_CACHE_OP_READ << 8) |
+                                              (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+
+    const struct {
+        uint32_t type;
+        uint64_t config;
+    } configs[COUNTER_COUNT] = {
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+        {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+        {PERF_TYPE_HW_CACHE, L1D_READ_MISS},
+    };
+
+    bool any_open = false;
+    int error = 0;
+    for (uint8_t i = 0; i < COUNTER_COUNT; ++i) {
+        if (m_fds[i] < 0) m_fds[i] = openCounter(configs[i].type, configs[i].config);
+        if (m_fds[i] >= 0) {
+            any_open = true;
+        } else {
+            error = errno;
+            printf("Hardware counter %s unavailable: %s\n", GetName(static_cast<perf_counter_t>(i)), strerror(error));
+        }
+    }
+
+    if (!any_open && (error == EACCES || error == EPERM)) {
+        printf("Lowering /proc/sys/kernel/perf_event_paranoid or running with CAP_PERFMON enables them\n");
+    }
+    return any_open;
+}
+
+void PerfCounters::Start() {
+    for (int fd : m_fds) {
+        if (fd < 0) continue;
+        ioctl(fd, PERF_EVENT_IOC_RESET, 0);
+        ioctl(fd, PERF_EVENT_IOC_ENABLE, 0);
+    }
+}
+
+perf_counter_values_t PerfCounters::Stop() {
+    for (int fd : m_fds) {
+        if (fd >= 0) ioctl(fd, PERF_EVENT_IOC_DISABLE, 0);
+    }
+
+    perf_counter_values_t result;
+    for (uint8_t i = 0; i < COUNTER_COUNT; ++i) {
+        if (m_fds[i] < 0) continue;
+
+        // value, time enabled, time running
+        uint64_t data[3] = {};
+        if (read(m_fds[i], data, sizeof(data)) != sizeof(data) || data[2] == 0) continue;
+
+        result.values[i] = data[2] < data[1] ? static_cast<uint64_t>(static_cast<double>(data[0]) * data[1] / data[2]) : data[0];
+        result.valid[i] = true;
+    }
+    return result;
+}
+
+#else
+
+PerfCounters::~PerfCounters() {}
+
+bool PerfCounters::Open() {
+    printf("Hardware counters are only supported on Linux\n");
+    return false;
+}
+
+void PerfCounters::Start() {}
+
+perf_counter_values_t PerfCounters::Stop() {
+    return {};
+}
+
+#endif
+
+bool PerfCounters::IsOpen(perf_counter_t counter) const {
+    return m_fds[static_cast<uint8_t>(counter)] >= 0;
+}
+
+const char* PerfCounters::GetName(perf_counter_t counter) {
+    switch (counter) {
+        case perf_counter_t::Cycles: return "cycles";
+        case perf_counter_t::Instructions: return "instructions";
+        case perf_counter_t::BranchMisses: return "branch_misses";
+        case perf_counter_t::L1dMisses: return "l1d_misses";
+        default: return "unknown";
+    }
+}
@@ -0,0 +1,47 @@
+#pragma once
+#include <stdint.h>
+
+/*
+Hardware performance counters of the calling thread, through perf_event_open on Linux.
+Every counter is opened on its own, so a machine or container that lacks some of them still
+gets the rest. Elsewhere nothing opens and the benchmarks only report host time.
+*/
+
+enum class perf_counter_t : uint8_t {
+    Cycles = 0,
+    Instructions,
+    BranchMisses,
+    L1dMisses,
+    COUNT,
+};
+
+struct perf_counter_values_t {
+    uint64_t values[static_cast<uint8_t>(perf_counter_t::COUNT)] = {};
+    bool valid[static_cast<uint8_t>(perf_counter_t::COUNT)] = {};
+
+    inline bool IsValid(perf_counter_t counter) const { return valid[static_cast<uint8_t>(counter)]; }
+    inline uint64_t Get(perf_counter_t counter) const { return values[static_cast<uint8_t>(counter)]; }
+};
+
+class PerfCounters {
+public:
+    PerfCounters() = default;
+    ~PerfCounters();
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    // returns false if none of the counters could be opened, after printing why
+    bool Open();
+    bool IsOpen(perf_counter_t counter) const;
+
+    // counts between the two calls only, values are scaled up if the kernel had to multiplex them
+    void Start();
+    perf_counter_values_t Stop();
+
+    static const char* GetName(perf_counter_t counter);
+
+private:
+    static constexpr uint8_t COUNTER_COUNT = static_cast<uint8_t>(perf_counter_t::COUNT);
+
+    int m_fds[COUNTER_COUNT] = {-1, -1, -1, -1};
+};
@@ -0,0 +1,120 @@
+#include "regression_gate.hpp"
+#include "json_reader.hpp"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+RegressionGate::RegressionGate(double threshold_percent): m_threshold_percent(threshold_percent) {}
+
+bool RegressionGate::LoadBaseline(const std::string& path) {
+    json_value_t root;
+    if (!ReadJsonFile(path, root)) {
+        printf("No baseline at %s\n", path.c_str());
+        return false;
+    }
+
+    const json_value_t& results = root["results"];
+    if (results.type != json_type_t::Array) {
+        printf("%s has no results\n", path.c_str());
+        return false;
+    }
+
+    m_baseline_path = path;
+    m_baseline_optimized = root["build"]["optimized"].boolean;
+    m_baseline_sanitized = root["build"]["sanitized"].boolean;
+    m_baseline_frames = static_cast<unsigned int>(root["options"]["frames"].number);
+
+    m_baseline.clear();
+    for (const json_value_t& result : results.items) {
+        // recomputed from the samples, older files don't store the spread
+        std::vector<double> samples;
+        for (const json_value_t& sample : result["samples"].items) samples.push_back(sample.number);
+        if (samples.empty()) continue;
+
+        m_baseline.push_back({
+            result["name"].string,
+            result["unit"].string,
+            result["higher_is_better"].boolean,
+            BenchmarkSuite::Median(samples),
+            BenchmarkSuite::MedianAbsoluteDeviation(samples),
+        });
+    }
+    return true;
+}
+
+const RegressionGate::baseline_result_t* RegressionGate::findBaseline(const std::string& name) const {
+    for (const baseline_result_t& result : m_baseline) {
+        if (result.name == name) return &result;
+    }
+    return nullptr;
+}
+
+bool RegressionGate::Check(const BenchmarkSuite& suite) const {
+    const bench_build_t build = BenchmarkSuite::GetBuild();
+    if (build.optimized != m_baseline_optimized || build.sanitized != m_baseline_sanitized) {
+        printf("Warning: the baseline was built with different flags (optimized %d sanitized %d, now %d %d)\n",
+               m_baseline_optimized, m_baseline_sanitized, build.optimized, build.sanitized);
+    }
+    if (suite.GetOptions().frames != m_baseline_frames) {
+        printf("Warning: the baseline ran %u frames per rom, now %u\n", m_baseline_frames, suite.GetOptions().frames);
+    }
+
+    printf("\nCompared to %s, threshold %.1f%%\n", m_baseline_path.c_str(), m_threshold_percent);
+    printf("%-48s %14s %14s %-18s %9s %7s  %s\n", "benchmark", "baseline", "current", "unit", "change", "noise", "status");
+
+    std::vector<std::string> regressed;
+    unsigned int improved_count = 0;
+    unsigned int new_count = 0;
+
+    for (const bench_result_t& result : suite.GetResults()) {
+        const double median = BenchmarkSuite::Median(result.samples);
+        const baseline_result_t* baseline = findBaseline(result.name);
+
+        if (!baseline || baseline->unit != result.unit) {
+            printf("%-48s %14s %14.3f %-18s %9s %7s  %s\n", result.name.c_str(), "-", median, result.unit.c_str(), "-", "-", "new");
+            new_count++;
+            continue;
+        }
+
+        // counters can legitimately be zero, there is no relative change to gate on then
+        if (baseline->median == 0.0) {
+            printf("%-48s %14.3f %14.3f %-18s %9s %7s  %s\n", result.name.c_str(), baseline->median, median,
+                   result.unit.c_str(), "-", "-", "ok");
+            continue;
+        }
+
+        const double change_percent = 100.0 * (median - baseline->median) / std::abs(baseline->median);
+        const double worse_percent = result.higher_is_better ? -change_percent : change_percent;
+
+        // each run's spread relative to its own median, the noisier of the two counts
+        const double baseline_noise = baseline->mad / std::abs(baseline->median);
+        const double current_noise = median == 0.0 ? 0.0 : BenchmarkSuite::MedianAbsoluteDeviation(result.samples) / std::abs(median);
+        const double noise_percent = 100.0 * MAD_TO_SIGMA * std::max(baseline_noise, current_noise);
+        const double limit_percent = std::max(m_threshold_percent, NOISE_FACTOR * noise_percent);
+
+        const char* status = "ok";
+        if (worse_percent > limit_percent) {
+            status = "REGRESSED";
+            regressed.push_back(result.name);
+        } else if (-worse_percent > limit_percent) {
+            status = "improved";
+            improved_count++;
+        }
+
+        printf("%-48s %14.3f %14.3f %-18s %+8.1f%% %6.1f%%  %s\n", result.name.c_str(), baseline->median, median,
+               result.unit.c_str(), change_percent, noise_percent, status);
+    }
+
+    unsigned int missing_count = 0;
+    for (const baseline_result_t& baseline : m_baseline) {
+        const bool ran = std::any_of(suite.GetResults().begin(), suite.GetResults().end(),
+                                     [&] (const bench_result_t& result) { return result.name == baseline.name; });
+        if (!ran) missing_count++;
+    }
+
+    printf("\n%zu regressed, %u improved, %u new, %u in the baseline but not run\n",
+           regressed.size(), improved_count, new_count, missing_count);
+    for (const std::string& name : regressed) printf("  regressed: %s\n", name.c_str());
+
+    return regressed.empty();
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include "benchmark.hpp"
+#include <string>
+#include <vector>
+
+/*
+Compares a run against a stored baseline, the results of an earlier run on the same class of machine.
+A benchmark regresses when its median got worse by more than the threshold and also by more than
+NOISE_FACTOR times the spread of its samples (scaled MAD of whichever run was noisier), so a noisy
+benchmark doesn't fail the gate on its own. Benchmarks missing on either side are only listed.
+*/
+
+class RegressionGate {
+public:
+    RegressionGate(double threshold_percent);
+
+    bool LoadBaseline(const std::string& path);
+
+    // prints the diff table for every benchmark that ran, returns false if any of them regressed
+    bool Check(const BenchmarkSuite& suite) const;
+
+private:
+    struct baseline_result_t {
+        std::string name;
+        std::string unit;
+        bool higher_is_better;
+        double median;
+        double mad;
+    };
+
+    const baseline_result_t* findBaseline(const std::string& name) const;
+
+    // scales a MAD to the standard deviation of normally distributed samples
+    static constexpr double MAD_TO_SIGMA = 1.4826;
+    static constexpr double NOISE_FACTOR = 3.0;
+
+    double m_threshold_percent;
+    std::string m_baseline_path;
+    std::vector<baseline_result_t> m_baseline;
+    bool m_baseline_optimized = false;
+    bool m_baseline_sanitized = false;
+    unsigned int m_baseline_frames = 0;
+};
@@ -1,432 +1,591 @@
 #include "apu.hpp"
+#include "trace.hpp"
 #include "common.hpp"
+#include <cstring>
+#include <algorithm>
+
+// advances a channel timer by elapsed clocks, returns how many times it expired
+static unsigned int advanceTimer(unsigned int& timer, unsigned int period, unsigned int elapsed) {
+    if (elapsed < timer) {
+        timer -= elapsed;
+        return 0;
+    }
+    elapsed -= timer;
+    timer = period - elapsed % period;
+    return 1 + elapsed / period;
+}
 
-Apu::Apu(Memory* memory_ref, AudioLayer* audio_layer_ref):
- m_memory(memory_ref), m_audio_layer(audio_layer_ref) {
-
-    m_memory->AddToWriteAddressMapper(CHANNEL_1_PERIOD_HIGH_ADDR, [&] (uint8_t byte) {
-        m_channel_1_trigger = bitGet(byte, 7);
-        m_memory->WriteByteDirect(CHANNEL_1_PERIOD_HIGH_ADDR, byte);
-    });
-
-    m_memory->AddToWriteAddressMapper(CHANNEL_2_PERIOD_HIGH_ADDR, [&] (uint8_t byte) {
-        m_channel_2_trigger = bitGet(byte, 7);
-        m_memory->WriteByteDirect(CHANNEL_2_PERIOD_HIGH_ADDR, byte);
-    });
+Apu::Apu(Memory* memory_ref, AudioSink* audio_sink_ref, Scheduler* scheduler_ref, Timer* timer_ref):
+ m_memory(memory_ref), m_audio_sink(audio_sink_ref), m_scheduler(scheduler_ref), m_timer(timer_ref),
+ m_audio_enabled(audio_sink_ref != nullptr),
+ m_blip_buffer(CYCLES_PER_SECOND * APU_CLOCKS_PER_M_CYCLE,
+               m_audio_enabled ? audio_sink_ref->GetSampleRate() : 1,
+               m_audio_enabled ? MAX_FRAME_SAMPLES : 0) {
+
+    for (uint16_t addr = CHANNEL_1_SWEEP_ADDR; addr <= AUDIO_MASTER_CONTROLL_ADDR; ++addr) {
+        m_memory->AddToWriteAddressMapper(addr, [this, addr] (uint8_t byte) {
+            writeRegister(addr, byte);
+        });
+    }
 
-    m_memory->AddToWriteAddressMapper(CHANNEL_3_PERIOD_HIGH_CONTROL_ADDR, [&] (uint8_t byte) {
-        m_channel_3_trigger = bitGet(byte, 7);
-        m_memory->WriteByteDirect(CHANNEL_3_PERIOD_HIGH_CONTROL_ADDR, byte);
+    m_timer->SetDivResetCallback([this] (uint16_t old_div_counter) {
+        onDivReset(old_div_counter);
     });
 
-    m_memory->AddToWriteAddressMapper(CHANNEL_4_CONTROL_ADDR, [&] (uint8_t byte) {
-        m_channel_4_trigger = bitGet(byte, 7);
-        m_memory->WriteByteDirect(CHANNEL_4_CONTROL_ADDR, byte);
-    });
+    if (m_audio_enabled) {
+        m_frame_samples.resize(MAX_FRAME_SAMPLES);
+        m_stereo_samples.resize(2 * MAX_FRAME_SAMPLES);
+
+        m_scheduler->SetEventHandler(scheduler_event_t::ApuFrameSequencer, [this] (uint64_t cycle) {
+            runFrameSequencer(cycle);
+        });
+
+        m_scheduler->SetEventHandler(scheduler_event_t::ApuEndFrame, [this] (uint64_t cycle) {
+            endFrame(cycle);
+        });
+
+        m_frame_start_cycle = m_scheduler->GetCurrentCycle();
+        m_scheduler->Schedule(scheduler_event_t::ApuEndFrame, m_frame_start_cycle + CYCLES_PER_FRAME);
+    } else {
+        // the frame sequencer state these registers expose is caught up when they are read
+        for (uint16_t addr : {CHANNEL_1_PERIOD_LOW_ADDR, CHANNEL_1_PERIOD_HIGH_ADDR, AUDIO_MASTER_CONTROLL_ADDR}) {
+            m_memory->AddToReadAddressMapper(addr, [this, addr] () {
+                return readRegister(addr);
+            });
+        }
+    }
 
-    m_memory->AddToWriteAddressMapper(CHANNEL_4_LENGTH_TIMER_ADDR, [&] (uint8_t byte) {
-        m_channel_4_length_reload = true;
-        m_memory->WriteByteDirect(CHANNEL_4_LENGTH_TIMER_ADDR, byte);
-    });
+    scheduleFrameSequencer();
 
+    updateMasterControlRegister();
 }
 
-void Apu::ApuStep(unsigned int m_cycle_count) {
-    static unsigned int cycle_pool = 0;
-    cycle_pool += m_cycle_count;
-    static const unsigned int CYCLES_PER_SAMPLE = (1 << 20) / m_audio_layer->GetSampleRate();
-    const bool produce_sample = cycle_pool >= CYCLES_PER_SAMPLE;
+void Apu::SaveState(SaveStateWriter& writer) const {
+    apu_state_t state = {};
+    state.channel_1 = m_channel_1;
+    state.channel_2 = m_channel_2;
+    state.channel_3 = m_channel_3;
+    state.channel_4 = m_channel_4;
+    state.frame_start_cycle = m_frame_start_cycle;
+    state.next_frame_sequencer_cycle = m_next_frame_sequencer_cycle;
+    std::memcpy(state.channel_output, m_channel_output, sizeof(m_channel_output));
+    state.last_run_time = m_last_run_time;
+    state.frame_sequencer_step = m_frame_sequencer_step;
+    state.powered = m_powered;
+    state.audio_enabled = m_audio_enabled;
+    writer.AddChunk(saveStateChunkId("APU "), state);
+
+    if (m_audio_enabled) m_blip_buffer.SaveState(writer);
+}
 
-    const uint8_t master_control = m_memory->ReadByteDirect(AUDIO_MASTER_CONTROLL_ADDR);
+bool Apu::LoadState(const SaveStateReader& reader) {
+    apu_state_t state;
+    if (!reader.ReadChunk(saveStateChunkId("APU "), state)) return false;
+    m_channel_1 = state.channel_1;
+    m_channel_2 = state.channel_2;
+    m_channel_3 = state.channel_3;
+    m_channel_4 = state.channel_4;
+    m_frame_start_cycle = state.frame_start_cycle;
+    m_next_frame_sequencer_cycle = state.next_frame_sequencer_cycle;
+    std::memcpy(m_channel_output, state.channel_output, sizeof(m_channel_output));
+    m_last_run_time = state.last_run_time;
+    m_frame_sequencer_step = state.frame_sequencer_step;
+    m_powered = state.powered;
+
+    if (!m_audio_enabled) {
+        m_scheduler->Cancel(scheduler_event_t::ApuFrameSequencer);
+        m_scheduler->Cancel(scheduler_event_t::ApuEndFrame);
+        return true;
+    }
 
-    if (!bitGet(master_control, 7)) {
-        cycle_pool = 0;
-        return;
+    // a state without audio has no frame in progress and its frame sequencer may lag behind,
+    // catch the sequencer up silently and start a fresh frame
+    if (!state.audio_enabled || !m_blip_buffer.LoadState(reader)) {
+        m_audio_enabled = false;
+        runFrameSequencer(m_scheduler->GetCurrentCycle());
+        m_audio_enabled = true;
+
+        m_blip_buffer.Clear();
+        m_frame_start_cycle = m_scheduler->GetCurrentCycle();
+        m_last_run_time = 0;
+        std::fill(std::begin(m_channel_output), std::end(m_channel_output), 0.0f);
+        m_scheduler->Schedule(scheduler_event_t::ApuEndFrame, m_frame_start_cycle + CYCLES_PER_FRAME);
     }
 
-    std::memset(m_mixer_buffer, 0x0, sizeof(m_mixer_buffer));
+    m_scheduler->Schedule(scheduler_event_t::ApuFrameSequencer, m_next_frame_sequencer_cycle);
+    return true;
+}
 
-    handleChannel1(m_cycle_count, produce_sample);
-    handleChannel2(m_cycle_count, produce_sample);
-    handleChannel3(m_cycle_count, produce_sample);
-    handleChannel4(m_cycle_count, produce_sample);
+void Apu::scheduleFrameSequencer() {
+    // the next falling edge of DIV bit 4
+    const unsigned int div_phase = m_timer->GetDivCounter() % CYCLES_PER_FRAME_SEQUENCER_STEP;
+    m_next_frame_sequencer_cycle = m_scheduler->GetCurrentCycle() + CYCLES_PER_FRAME_SEQUENCER_STEP - div_phase;
 
-    if (produce_sample) {
-        cycle_pool -= CYCLES_PER_SAMPLE;
+    if (m_audio_enabled) {
+        m_scheduler->Schedule(scheduler_event_t::ApuFrameSequencer, m_next_frame_sequencer_cycle);
+    }
+}
 
-        sample_t final_sample = {0, 0};
-        for (int i = 0;i < 4; ++i) {
-            final_sample.left += m_mixer_buffer[2 * i];
-            final_sample.right += m_mixer_buffer[2 * i + 1];
+void Apu::runFrameSequencer(uint64_t cycle) {
+    while (m_next_frame_sequencer_cycle <= cycle) {
+        const auto is_idle = [] (bool enabled, bool length_enabled, uint16_t length_counter) {
+            return !enabled && !(length_enabled && length_counter > 0);
+        };
+        const bool idle = is_idle(m_channel_1.enabled, m_channel_1.length_enabled, m_channel_1.length_counter) &&
+                          is_idle(m_channel_2.enabled, m_channel_2.length_enabled, m_channel_2.length_counter) &&
+                          is_idle(m_channel_3.enabled, m_channel_3.length_enabled, m_channel_3.length_counter) &&
+                          is_idle(m_channel_4.enabled, m_channel_4.length_enabled, m_channel_4.length_counter);
+        if (idle) {
+            // nothing observable can change, skip straight to the last due step
+            const uint64_t skipped = (cycle - m_next_frame_sequencer_cycle) / CYCLES_PER_FRAME_SEQUENCER_STEP;
+            m_frame_sequencer_step = (m_frame_sequencer_step + skipped) & 0x7;
+            m_next_frame_sequencer_cycle += skipped * CYCLES_PER_FRAME_SEQUENCER_STEP;
         }
-        final_sample.left *= m_volume;
-        final_sample.right *= m_volume;
 
-        m_audio_layer->PushSamples(&final_sample, sizeof(float) * 2);
+        frameSequencerStep(m_next_frame_sequencer_cycle);
+        m_next_frame_sequencer_cycle += CYCLES_PER_FRAME_SEQUENCER_STEP;
     }
 
+    if (m_audio_enabled) {
+        m_scheduler->Schedule(scheduler_event_t::ApuFrameSequencer, m_next_frame_sequencer_cycle);
+    }
 }
 
-void Apu::pushSampleToMixer(float sampleL, float sampleR, unsigned int channel) {
-    m_mixer_buffer[2 * channel] = sampleL;
-    m_mixer_buffer[2 * channel + 1] = sampleR;
+void Apu::synchronize(uint64_t cycle) {
+    if (m_audio_enabled) {
+        // frame sequencer events are already up to date, only the waveforms lag behind
+        runChannels(cycle);
+    } else {
+        runFrameSequencer(cycle);
+    }
 }
 
-void Apu::handleChannel1(unsigned int m_cycle_count, bool produce_sample) {
-    static unsigned int timer_cycle_pool = 0;
-    static bool is_active = false;
-    static unsigned int length_timer = 0;
-    static unsigned int pace_cycle_pool = 0;
-    static unsigned int envelope_cycle_pool = 0;
-    static constexpr unsigned int CYCLES_PER_APU_DIV_TICK = (1 << 20) / 256;
-    static constexpr unsigned int CYCLES_PER_SWEEP_ITERATION = (1 << 20) / 128;
-    static constexpr unsigned int CYCLES_PER_ENV_ITERATION = (1 << 20) / 64;
-
-    const uint8_t length_and_duty_register = m_memory->ReadByteDirect(CHANNEL_1_LENGTH_AND_DUTY_ADDR);
-    const uint8_t volume_and_envelope_register = m_memory->ReadByteDirect(CHANNEL_1_VOLUME_AND_ENVELOPE_ADDR);
-    const uint8_t period_low_register = m_memory->ReadByteDirect(CHANNEL_1_PERIOD_LOW_ADDR);
-    const uint8_t period_high_and_control_register = m_memory->ReadByteDirect(CHANNEL_1_PERIOD_HIGH_ADDR);
-    
-    static uint8_t wave_duty = (length_and_duty_register >> 6) & 0x3;
-
-    static uint8_t pace = (m_memory->ReadByteDirect(CHANNEL_1_SWEEP_ADDR) >> 4) & 0x7;
-    static uint8_t direction = (m_memory->ReadByteDirect(CHANNEL_1_SWEEP_ADDR) >> 3) & 0x1;
-    static uint8_t indiviual_step = m_memory->ReadByteDirect(CHANNEL_1_SWEEP_ADDR) & 0x7;
-
-    uint8_t audio_master_control = m_memory->ReadByteDirect(AUDIO_MASTER_CONTROLL_ADDR);
-    bitSet(audio_master_control, 0, is_active);
-    m_memory->WriteByteDirect(AUDIO_MASTER_CONTROLL_ADDR, audio_master_control);
-
-    static uint16_t period_value = 0;
-    static uint8_t current_volume = 0;
-    static uint8_t current_env_dir = 0;
-    static uint8_t current_env_pace = 0;
-
-    if (m_channel_1_trigger) {
-        // trigger the channel
-        is_active = true;
-        m_channel_1_trigger = false;
-        length_timer = length_and_duty_register & 0b111111;
-        wave_duty = (length_and_duty_register >> 6) & 0x3;
-
-        pace = (m_memory->ReadByteDirect(CHANNEL_1_SWEEP_ADDR) >> 4) & 0x7;
-        direction = (m_memory->ReadByteDirect(CHANNEL_1_SWEEP_ADDR) >> 3) & 0x1;
-        indiviual_step = m_memory->ReadByteDirect(CHANNEL_1_SWEEP_ADDR) & 0x7;
-        period_value = period_low_register | ((period_high_and_control_register & 0b111) << 8);
-
-        current_volume = volume_and_envelope_register >> 4;
-        current_env_dir = (volume_and_envelope_register >> 3) & 0x1;
-        current_env_pace = volume_and_envelope_register & 0x7;
-    }
+void Apu::onDivReset(uint16_t old_div_counter) {
+    const uint64_t now = m_scheduler->GetCurrentCycle();
+    synchronize(now);
 
-    if (bitGet(period_high_and_control_register, 6) && length_timer == 64) {
-        // timer runs out 
-        is_active = false;
+    // resetting DIV while bit 4 is set is a falling edge, so the sequencer ticks right away
+    if (old_div_counter & (CYCLES_PER_FRAME_SEQUENCER_STEP / 2)) {
+        frameSequencerStep(now);
     }
+    scheduleFrameSequencer();
+}
 
-    if ((volume_and_envelope_register >> 3) == 0) {
-        is_active = false;
-    } 
-
-    if (!is_active) {
-        timer_cycle_pool = 0;
-        pace_cycle_pool = 0;
-        envelope_cycle_pool = 0;
-        return;
-    }
+uint8_t Apu::readRegister(uint16_t addr) {
+    synchronize(m_scheduler->GetCurrentCycle());
+    return m_memory->ReadByteDirect(addr);
+}
 
-    timer_cycle_pool += m_cycle_count;
-    if (timer_cycle_pool >= CYCLES_PER_APU_DIV_TICK) {
-        length_timer++;
-        timer_cycle_pool -= CYCLES_PER_APU_DIV_TICK;
-    }
+void Apu::frameSequencerStep(uint64_t cycle) {
+    runChannels(cycle);
+
+    if (m_powered) {
+        const auto clock_length = [] (bool length_enabled, uint16_t& length_counter, bool& enabled) {
+            if (length_enabled && length_counter > 0) {
+                length_counter--;
+                if (length_counter == 0) enabled = false;
+            }
+        };
+
+        // length on even steps, sweep on 2 and 6, envelope on 7
+        if ((m_frame_sequencer_step & 1) == 0) {
+            clock_length(m_channel_1.length_enabled, m_channel_1.length_counter, m_channel_1.enabled);
+            clock_length(m_channel_2.length_enabled, m_channel_2.length_counter, m_channel_2.enabled);
+            clock_length(m_channel_3.length_enabled, m_channel_3.length_counter, m_channel_3.enabled);
+            clock_length(m_channel_4.length_enabled, m_channel_4.length_counter, m_channel_4.enabled);
+        }
 
-    pace_cycle_pool += m_cycle_count;
+        if (m_frame_sequencer_step == 2 || m_frame_sequencer_step == 6) {
+            clockSweep();
+        }
 
-    if (pace != 0 && pace_cycle_pool >= CYCLES_PER_SWEEP_ITERATION) {
-        if (period_value >= 0x7FF) {
-            is_active = false;
+        if (m_frame_sequencer_step == 7) {
+            clockEnvelope(m_channel_1.envelope);
+            clockEnvelope(m_channel_2.envelope);
+            clockEnvelope(m_channel_4.envelope);
         }
-        pace_cycle_pool = 0;
-        pace = (m_memory->ReadByteDirect(CHANNEL_1_SWEEP_ADDR) >> 4) & 0x7;
-        period_value = period_value + (period_value / (1 << indiviual_step)) * (1 - 2 * direction);
-        m_memory->WriteByteDirect(CHANNEL_1_PERIOD_LOW_ADDR, period_value & 0xFF);
-        uint8_t new_period_high_and_control_register = period_high_and_control_register & 0b11111000;
-        new_period_high_and_control_register |= (period_value >> 8) & 0x7;
-        m_memory->WriteByteDirect(CHANNEL_1_PERIOD_HIGH_ADDR, new_period_high_and_control_register);
-    }
 
-    envelope_cycle_pool += m_cycle_count;
-    if (current_env_pace != 0 && envelope_cycle_pool >= current_env_pace * CYCLES_PER_ENV_ITERATION) {
-        envelope_cycle_pool -= current_env_pace * CYCLES_PER_ENV_ITERATION;
-        // TODO FIX THIS
-        // if (current_volume != 0 && current_volume != 0xFF) {
-        //     current_volume -= 1 - 2 * current_env_dir; 
-        // }
+        updateMasterControlRegister();
+        updateOutputs(toFrameTime(cycle));
     }
 
-    static uint16_t period_clock = 2048;
-    period_clock += m_cycle_count;
+    m_frame_sequencer_step = (m_frame_sequencer_step + 1) & 0x7;
+}
 
-    static unsigned int sample_counter = 0;
+void Apu::clockEnvelope(envelope_t& envelope) {
+    if (envelope.pace == 0) return;
 
-    if (period_clock >= 2048) {
-        if (sample_counter == 7) {
-            period_value = period_low_register | ((period_high_and_control_register & 0b111) << 8);
-        }
-        period_clock = period_value;
-        sample_counter = (sample_counter + 1) % 8;
-    }
+    if (envelope.timer > 0) envelope.timer--;
+    if (envelope.timer != 0) return;
 
-    if (produce_sample) {
-        float sample = static_cast<float>(DUTY_CYCLES[wave_duty * 8 + sample_counter]);
-        sample *= static_cast<float>(current_volume);
-        pushSampleToMixer(sample, sample, 0);
+    envelope.timer = envelope.pace;
+    if (envelope.increase && envelope.volume < 15) {
+        envelope.volume++;
+    } else if (!envelope.increase && envelope.volume > 0) {
+        envelope.volume--;
     }
 }
 
-void Apu::handleChannel2(unsigned int m_cycle_count, bool produce_sample) {
-    static unsigned int timer_cycle_pool = 0;
-    static bool is_active = false;
-    static unsigned int length_timer = 0;
-    static unsigned int envelope_cycle_pool = 0;
-    static constexpr unsigned int CYCLES_PER_APU_DIV_TICK = (1 << 20) / 256;
-    static constexpr unsigned int CYCLES_PER_ENV_ITERATION = (1 << 20) / 64;
-
-    const uint8_t length_and_duty_register = m_memory->ReadByteDirect(CHANNEL_2_LENGTH_AND_DUTY_ADDR);
-    const uint8_t volume_and_envelope_register = m_memory->ReadByteDirect(CHANNEL_2_VOLUME_AND_ENVELOPE_ADDR);
-    const uint8_t period_low_register = m_memory->ReadByteDirect(CHANNEL_2_PERIOD_LOW_ADDR);
-    const uint8_t period_high_and_control_register = m_memory->ReadByteDirect(CHANNEL_2_PERIOD_HIGH_ADDR);
-    
-    static uint8_t wave_duty = (length_and_duty_register >> 6) & 0x3;
-
-    uint8_t audio_master_control = m_memory->ReadByteDirect(AUDIO_MASTER_CONTROLL_ADDR);
-    bitSet(audio_master_control, 1, is_active);
-    m_memory->WriteByteDirect(AUDIO_MASTER_CONTROLL_ADDR, audio_master_control);
-
-    static uint16_t period_value = 0;
-    static uint8_t current_volume = 0;
-    static uint8_t current_env_dir = 0;
-    static uint8_t current_env_pace = 0;
-
-    if (m_channel_2_trigger) {
-        // trigger the channel
-        is_active = true;
-        m_channel_2_trigger = false;
-        length_timer = length_and_duty_register & 0b111111;
-        wave_duty = (length_and_duty_register >> 6) & 0x3;
-
-        period_value = period_low_register | ((period_high_and_control_register & 0b111) << 8);
-
-        current_volume = volume_and_envelope_register >> 4;
-        current_env_dir = (volume_and_envelope_register >> 3) & 0x1;
-        current_env_pace = volume_and_envelope_register & 0x7;
-    }
-
-    if (bitGet(period_high_and_control_register, 6) && length_timer == 64) {
-        // timer runs out 
-        is_active = false;
-    }
+uint16_t Apu::calculateSweepPeriod() {
+    const uint8_t sweep_register = m_memory->ReadByteDirect(CHANNEL_1_SWEEP_ADDR);
+    const uint8_t step = sweep_register & 0x7;
+    const bool decrease = bitGet(sweep_register, 3);
 
-    if ((volume_and_envelope_register >> 3) == 0) {
-        is_active = false;
-    } 
+    const uint16_t delta = m_channel_1.sweep_shadow_period >> step;
+    const uint16_t new_period = decrease ? m_channel_1.sweep_shadow_period - delta
+                                         : m_channel_1.sweep_shadow_period + delta;
 
-    if (!is_active) {
-        timer_cycle_pool = 0;
-        envelope_cycle_pool = 0;
-        return;
+    if (new_period > 0x7FF) {
+        m_channel_1.enabled = false;
     }
 
-    timer_cycle_pool += m_cycle_count;
-    if (timer_cycle_pool >= CYCLES_PER_APU_DIV_TICK) {
-        length_timer++;
-        timer_cycle_pool -= CYCLES_PER_APU_DIV_TICK;
-    }
+    return new_period;
+}
 
-    envelope_cycle_pool += m_cycle_count;
-    if (current_env_pace != 0 && envelope_cycle_pool >= current_env_pace * CYCLES_PER_ENV_ITERATION) {
-        envelope_cycle_pool -= current_env_pace * CYCLES_PER_ENV_ITERATION;
-        // TODO FIX THIS AS WELL
-        // if (current_volume != 0 && current_volume != 0xFF) {
-        //     current_volume -= 1 - 2 * current_env_dir; 
-        // }
-    }
+void Apu::clockSweep() {
+    if (m_channel_1.sweep_timer > 0) m_channel_1.sweep_timer--;
+    if (m_channel_1.sweep_timer != 0) return;
 
-    static uint16_t period_clock = 2048;
-    period_clock += m_cycle_count;
+    const uint8_t sweep_register = m_memory->ReadByteDirect(CHANNEL_1_SWEEP_ADDR);
+    const uint8_t pace = (sweep_register >> 4) & 0x7;
+    const uint8_t step = sweep_register & 0x7;
+    m_channel_1.sweep_timer = pace ? pace : 8;
 
-    static unsigned int sample_counter = 0;
+    if (!m_channel_1.sweep_enabled || pace == 0) return;
 
-    if (period_clock >= 2048) {
-        if (sample_counter == 7) {
-            period_value = period_low_register | ((period_high_and_control_register & 0b111) << 8);
-        }
-        period_clock = period_value;
-        sample_counter = (sample_counter + 1) % 8;
-    }
+    const uint16_t new_period = calculateSweepPeriod();
+    if (new_period <= 0x7FF && step != 0) {
+        m_channel_1.sweep_shadow_period = new_period;
+        m_channel_1.period = new_period;
+
+        // the new period is visible in NR13 and NR14
+        m_memory->WriteByteDirect(CHANNEL_1_PERIOD_LOW_ADDR, new_period & 0xFF);
+        uint8_t period_high_register = m_memory->ReadByteDirect(CHANNEL_1_PERIOD_HIGH_ADDR) & 0b11111000;
+        period_high_register |= (new_period >> 8) & 0x7;
+        m_memory->WriteByteDirect(CHANNEL_1_PERIOD_HIGH_ADDR, period_high_register);
 
-    if (produce_sample) {
-        float sample = static_cast<float>(DUTY_CYCLES[wave_duty * 8 + sample_counter]);
-        sample *= static_cast<float>(current_volume);
-        pushSampleToMixer(sample, sample, 1);
+        // overflow check with the new period, its result is discarded
+        calculateSweepPeriod();
     }
 }
 
-void Apu::handleChannel3(unsigned int m_cycle_count, bool produce_sample) {
-    static bool is_active = false;
+void Apu::triggerSquare(square_channel_t& channel, uint16_t base_addr, bool has_sweep) {
+    const uint8_t volume_and_envelope = m_memory->ReadByteDirect(base_addr + 1);
 
-    const uint8_t period_low_register = m_memory->ReadByteDirect(CHANNEL_3_PERIOD_LOW_ADDR);
-    const uint8_t period_high_control_register = m_memory->ReadByteDirect(CHANNEL_3_PERIOD_HIGH_CONTROL_ADDR);
-    
-    const unsigned int period_value = period_low_register | ((period_high_control_register & 0x7) << 8);
+    channel.enabled = channel.dac_enabled;
+    if (channel.length_counter == 0) channel.length_counter = 64;
+    channel.timer = APU_CLOCKS_PER_M_CYCLE * (2048 - channel.period);
 
-    static unsigned int period = 2048;
-    static unsigned int sample_counter = 0;
-    static uint8_t current_volume = 0;
+    channel.envelope.volume = volume_and_envelope >> 4;
+    channel.envelope.increase = bitGet(volume_and_envelope, 3);
+    channel.envelope.pace = volume_and_envelope & 0x7;
+    channel.envelope.timer = channel.envelope.pace;
 
-    uint8_t audio_master_control = m_memory->ReadByteDirect(AUDIO_MASTER_CONTROLL_ADDR);
-    bitSet(audio_master_control, 3, is_active);
-    m_memory->WriteByteDirect(AUDIO_MASTER_CONTROLL_ADDR, audio_master_control);
+    if (has_sweep) {
+        const uint8_t sweep_register = m_memory->ReadByteDirect(CHANNEL_1_SWEEP_ADDR);
+        const uint8_t pace = (sweep_register >> 4) & 0x7;
+        const uint8_t step = sweep_register & 0x7;
 
-    if (m_channel_3_trigger) {
-        is_active = true;
-        m_channel_3_trigger = false;
-        period = period_value;
-        current_volume = (m_memory->ReadByte(CHANNEL_3_OUTPUT_LEVEL_ADDR) >> 5) & 0x3;
-        sample_counter = 0;
+        channel.sweep_shadow_period = channel.period;
+        channel.sweep_timer = pace ? pace : 8;
+        channel.sweep_enabled = pace != 0 || step != 0;
+        if (step != 0) calculateSweepPeriod();
     }
+}
+
+void Apu::triggerWave() {
+    m_channel_3.enabled = m_channel_3.dac_enabled;
+    if (m_channel_3.length_counter == 0) m_channel_3.length_counter = 256;
+    m_channel_3.timer = 2048 - m_channel_3.period;
+    m_channel_3.position = 0;
+}
+
+void Apu::triggerNoise() {
+    const uint8_t volume_and_envelope = m_memory->ReadByteDirect(CHANNEL_4_VOLUME_AND_ENVELOPE_ADDR);
 
-    is_active = bitGet(m_memory->ReadByteDirect(CHANNEL_3_DAC_ENABLE_ADDR), 7);
+    m_channel_4.enabled = m_channel_4.dac_enabled;
+    if (m_channel_4.length_counter == 0) m_channel_4.length_counter = 64;
+    m_channel_4.timer = m_channel_4.clock_period;
+    m_channel_4.lfsr = 0x7FFF;
 
-    if (!is_active) {
+    m_channel_4.envelope.volume = volume_and_envelope >> 4;
+    m_channel_4.envelope.increase = bitGet(volume_and_envelope, 3);
+    m_channel_4.envelope.pace = volume_and_envelope & 0x7;
+    m_channel_4.envelope.timer = m_channel_4.envelope.pace;
+}
+
+void Apu::writeRegister(uint16_t addr, uint8_t byte) {
+    const uint64_t now = m_scheduler->GetCurrentCycle();
+    synchronize(now);
+
+    if (addr == AUDIO_MASTER_CONTROLL_ADDR) {
+        const bool power = bitGet(byte, 7);
+        if (!power && m_powered) {
+            powerOff();
+        } else if (power && !m_powered) {
+            m_powered = true;
+            m_frame_sequencer_step = 0;
+        }
+        updateMasterControlRegister();
+        updateOutputs(toFrameTime(now));
         return;
     }
 
-    period += 2 * m_cycle_count;
+    // registers are read only while the apu is off
+    if (!m_powered) return;
 
-    if (period >= 2048) {
-        period = period_value;
-        sample_counter = (sample_counter + 1) % 32;
-    }
+    m_memory->WriteByteDirect(addr, byte);
+
+    // NRx2 of the square and noise channels, the upper 5 bits being zero turns off the DAC
+    const auto write_dac = [byte] (bool& dac_enabled, bool& enabled) {
+        dac_enabled = (byte & 0xF8) != 0;
+        if (!dac_enabled) enabled = false;
+    };
 
-    if (produce_sample) {
-        uint8_t sample = m_memory->ReadByteDirect(CHANNEL_3_WAVE_RAM_ADDR + (sample_counter / 2));
-        if (sample_counter & 0b1) {
-            sample = sample & 0x0F;
-        } else {
-            sample = sample >> 4;
+    switch (addr) {
+        case CHANNEL_1_LENGTH_AND_DUTY_ADDR:
+        case CHANNEL_2_LENGTH_AND_DUTY_ADDR: {
+            square_channel_t& channel = addr == CHANNEL_1_LENGTH_AND_DUTY_ADDR ? m_channel_1 : m_channel_2;
+            channel.duty = byte >> 6;
+            channel.length_counter = 64 - (byte & 0x3F);
+            break;
         }
-        if (current_volume == 0) {
-            sample = 0;
-        } else {
-            sample = sample >> (current_volume - 1);
+        case CHANNEL_1_VOLUME_AND_ENVELOPE_ADDR:
+            write_dac(m_channel_1.dac_enabled, m_channel_1.enabled);
+            break;
+        case CHANNEL_2_VOLUME_AND_ENVELOPE_ADDR:
+            write_dac(m_channel_2.dac_enabled, m_channel_2.enabled);
+            break;
+        case CHANNEL_1_PERIOD_LOW_ADDR:
+            m_channel_1.period = (m_channel_1.period & 0x700) | byte;
+            break;
+        case CHANNEL_2_PERIOD_LOW_ADDR:
+            m_channel_2.period = (m_channel_2.period & 0x700) | byte;
+            break;
+        case CHANNEL_1_PERIOD_HIGH_ADDR:
+        case CHANNEL_2_PERIOD_HIGH_ADDR: {
+            const bool is_channel_1 = addr == CHANNEL_1_PERIOD_HIGH_ADDR;
+            square_channel_t& channel = is_channel_1 ? m_channel_1 : m_channel_2;
+            channel.period = (channel.period & 0xFF) | ((byte & 0x7) << 8);
+            channel.length_enabled = bitGet(byte, 6);
+            if (bitGet(byte, 7)) {
+                triggerSquare(channel, is_channel_1 ? CHANNEL_1_LENGTH_AND_DUTY_ADDR
+                                                    : CHANNEL_2_LENGTH_AND_DUTY_ADDR, is_channel_1);
+            }
+            break;
         }
-        pushSampleToMixer(static_cast<float>(sample), static_cast<float>(sample), 2);
+        case CHANNEL_3_DAC_ENABLE_ADDR:
+            m_channel_3.dac_enabled = bitGet(byte, 7);
+            if (!m_channel_3.dac_enabled) m_channel_3.enabled = false;
+            break;
+        case CHANNEL_3_LENGTH_TIMER_ADDR:
+            m_channel_3.length_counter = 256 - byte;
+            break;
+        case CHANNEL_3_OUTPUT_LEVEL_ADDR: {
+            // mute, 100%, 50%, 25%
+            static constexpr uint8_t output_shifts[] = {4, 0, 1, 2};
+            m_channel_3.output_shift = output_shifts[(byte >> 5) & 0x3];
+            break;
+        }
+        case CHANNEL_3_PERIOD_LOW_ADDR:
+            m_channel_3.period = (m_channel_3.period & 0x700) | byte;
+            break;
+        case CHANNEL_3_PERIOD_HIGH_CONTROL_ADDR:
+            m_channel_3.period = (m_channel_3.period & 0xFF) | ((byte & 0x7) << 8);
+            m_channel_3.length_enabled = bitGet(byte, 6);
+            if (bitGet(byte, 7)) triggerWave();
+            break;
+        case CHANNEL_4_LENGTH_TIMER_ADDR:
+            m_channel_4.length_counter = 64 - (byte & 0x3F);
+            break;
+        case CHANNEL_4_VOLUME_AND_ENVELOPE_ADDR:
+            write_dac(m_channel_4.dac_enabled, m_channel_4.enabled);
+            break;
+        case CHANNEL_4_FREQUENCY_AND_RANDOMNESS_ADDR:
+            m_channel_4.clock_period = NOISE_DIVISORS[byte & 0x7] << (byte >> 4);
+            m_channel_4.short_mode = bitGet(byte, 3);
+            break;
+        case CHANNEL_4_CONTROL_ADDR:
+            m_channel_4.length_enabled = bitGet(byte, 6);
+            if (bitGet(byte, 7)) triggerNoise();
+            break;
+        default:
+            break;
     }
-}
 
-void Apu::handleChannel4(unsigned int m_cycle_count, bool produce_sample) {
-    const uint8_t initial_length_timer = m_memory->ReadByteDirect(CHANNEL_4_LENGTH_TIMER_ADDR);
-    const uint8_t volume_and_envelope = m_memory->ReadByteDirect(CHANNEL_4_VOLUME_AND_ENVELOPE_ADDR);
-    const uint8_t frequency_and_randomness = m_memory->ReadByteDirect(CHANNEL_4_FREQUENCY_AND_RANDOMNESS_ADDR);
-    const uint8_t control_register = m_memory->ReadByteDirect(CHANNEL_4_CONTROL_ADDR);
+    updateMasterControlRegister();
+    updateOutputs(toFrameTime(now));
+}
 
-    static constexpr uint8_t divisor_table[] = {
-        8, 16, 32, 48, 64, 80, 96, 112
-    };
-    static constexpr unsigned int CYCLES_PER_LENGTH_TIMER_TICK = (1 << 20) / 256;
-    static constexpr unsigned int CYCLES_PER_ENEVLOPE_TIMER_TICK = (1 << 20) / 64;
+void Apu::powerOff() {
+    for (uint16_t addr = CHANNEL_1_SWEEP_ADDR; addr < AUDIO_MASTER_CONTROLL_ADDR; ++addr) {
+        m_memory->WriteByteDirect(addr, 0);
+    }
 
-    static bool is_active = false;
+    m_channel_1 = square_channel_t();
+    m_channel_2 = square_channel_t();
+    m_channel_3 = wave_channel_t();
+    // the registers were just cleared, so the noise period is the one NR43 = 0 selects
+    m_channel_4 = noise_channel_t();
+    m_powered = false;
+}
 
-    static unsigned int clock = 0;
-    static uint8_t current_LFSR_width = 0;
+void Apu::updateMasterControlRegister() {
+    // bits 4-6 are unused and read as 1, the low nibble reports which channels are on
+    uint8_t master_control = 0x70;
+    bitSet(master_control, 7, m_powered);
+    bitSet(master_control, 0, m_channel_1.enabled);
+    bitSet(master_control, 1, m_channel_2.enabled);
+    bitSet(master_control, 2, m_channel_3.enabled);
+    bitSet(master_control, 3, m_channel_4.enabled);
+    m_memory->WriteByteDirect(AUDIO_MASTER_CONTROLL_ADDR, master_control);
+}
 
-    static unsigned int cycles_per_clock_tick = 0;
-    static uint16_t LFSR = 0;
+float Apu::squareOutput(const square_channel_t& channel) const {
+    if (!channel.enabled || !channel.dac_enabled) return 0;
+    return static_cast<float>(DUTY_CYCLES[channel.duty * 8 + channel.duty_position] * channel.envelope.volume);
+}
 
-    static uint8_t envelope_sweep_pace = 0;
-    static unsigned int envelope_cycle_pool = 0;
-    static uint8_t current_volume = 0;
-    static uint8_t envelope_dir = 0;
+float Apu::waveOutput() const {
+    if (!m_channel_3.enabled || !m_channel_3.dac_enabled) return 0;
+    uint8_t sample = m_memory->ReadByteDirect(CHANNEL_3_WAVE_RAM_ADDR + (m_channel_3.position / 2));
+    if (m_channel_3.position & 0b1) {
+        sample = sample & 0x0F;
+    } else {
+        sample = sample >> 4;
+    }
+    return static_cast<float>(sample >> m_channel_3.output_shift);
+}
 
-    static unsigned int length_counter = 0;
-    static unsigned int length_timer_pool = 0; 
+float Apu::noiseOutput() const {
+    if (!m_channel_4.enabled || !m_channel_4.dac_enabled) return 0;
+    return static_cast<float>((!bitGet(m_channel_4.lfsr, 0)) * m_channel_4.envelope.volume);
+}
 
-    uint8_t audio_master_control = m_memory->ReadByteDirect(AUDIO_MASTER_CONTROLL_ADDR);
-    bitSet(audio_master_control, 3, is_active);
-    m_memory->WriteByteDirect(AUDIO_MASTER_CONTROLL_ADDR, audio_master_control);
+void Apu::updateOutputs(unsigned int time) {
+    if (!m_audio_enabled || m_muted) return;
 
-    if (m_channel_4_trigger) {
-        m_channel_4_trigger = false;
-        is_active = true;
-        clock = 0;
+    setChannelOutput(0, squareOutput(m_channel_1), time);
+    setChannelOutput(1, squareOutput(m_channel_2), time);
+    setChannelOutput(2, waveOutput(), time);
+    setChannelOutput(3, noiseOutput(), time);
+}
 
-        uint8_t divider = frequency_and_randomness & 0x7;
-        uint8_t shift = frequency_and_randomness >> 4;
-        current_LFSR_width = (frequency_and_randomness >> 3) & 0x1; 
-        if (divider == 0) {
-            divider = 1;
-            if (shift != 0) shift--;
-        }
-        unsigned int frequency = (262144 / (divider * (1 << shift)));
-        cycles_per_clock_tick = (1 << 20) / frequency;
-        LFSR = 0xFFFF;
+void Apu::runChannels(uint64_t cycle) {
+    TRACE_SCOPE("Apu::runChannels");
+    if (!m_audio_enabled || m_muted) return;
 
-        current_volume = volume_and_envelope >> 4;
-        envelope_sweep_pace = volume_and_envelope & 0x7;
-        envelope_dir = bitGet(volume_and_envelope, 3);
-        envelope_cycle_pool = 0;
+    const unsigned int end_time = toFrameTime(cycle);
+    if (end_time <= m_last_run_time) return;
 
-        length_timer_pool = 0;
-        length_counter = initial_length_timer;
+    if (m_powered) {
+        runSquare(m_channel_1, 0, end_time);
+        runSquare(m_channel_2, 1, end_time);
+        runWave(end_time);
+        runNoise(end_time);
     }
-    
-    if (volume_and_envelope >> 3 == 0) {
-        is_active = false;
+
+    m_last_run_time = end_time;
+}
+
+void Apu::runSquare(square_channel_t& channel, unsigned int index, unsigned int end_time) {
+    if (!channel.enabled) return;
+
+    const unsigned int period = APU_CLOCKS_PER_M_CYCLE * (2048 - channel.period);
+    unsigned int time = m_last_run_time;
+
+    if (!channel.dac_enabled || channel.envelope.volume == 0) {
+        // silent, only the duty position has to stay in phase
+        const unsigned int steps = advanceTimer(channel.timer, period, end_time - time);
+        channel.duty_position = (channel.duty_position + steps) & 0x7;
+        return;
     }
 
-    envelope_cycle_pool += m_cycle_count;
-    if (envelope_sweep_pace != 0 && envelope_cycle_pool >= CYCLES_PER_ENEVLOPE_TIMER_TICK * envelope_sweep_pace) {
-        envelope_cycle_pool -= CYCLES_PER_ENEVLOPE_TIMER_TICK * envelope_sweep_pace;
-        if (current_volume != 0) {
-            current_volume -= 1 + (-2 * envelope_dir);
-        }
+    while (time + channel.timer <= end_time) {
+        time += channel.timer;
+        channel.timer = period;
+        channel.duty_position = (channel.duty_position + 1) & 0x7;
+        setChannelOutput(index, squareOutput(channel), time);
     }
+    channel.timer -= end_time - time;
+}
+
+void Apu::runWave(unsigned int end_time) {
+    if (!m_channel_3.enabled) return;
 
-    if (!is_active) {
+    const unsigned int period = 2048 - m_channel_3.period;
+    unsigned int time = m_last_run_time;
+
+    if (!m_channel_3.dac_enabled || m_channel_3.output_shift == 4) {
+        const unsigned int steps = advanceTimer(m_channel_3.timer, period, end_time - time);
+        m_channel_3.position = (m_channel_3.position + steps) & 0x1F;
         return;
     }
 
-    if (m_channel_4_length_reload) {
-        m_channel_4_length_reload = false;
-        length_counter = initial_length_timer;
+    while (time + m_channel_3.timer <= end_time) {
+        time += m_channel_3.timer;
+        m_channel_3.timer = period;
+        m_channel_3.position = (m_channel_3.position + 1) & 0x1F;
+        setChannelOutput(2, waveOutput(), time);
     }
+    m_channel_3.timer -= end_time - time;
+}
+
+void Apu::runNoise(unsigned int end_time) {
+    if (!m_channel_4.enabled) return;
+    ASSERT(m_channel_4.clock_period > 0);
 
-    length_timer_pool += m_cycle_count;
-    if (length_timer_pool >= CYCLES_PER_LENGTH_TIMER_TICK) {
-        length_timer_pool -= CYCLES_PER_LENGTH_TIMER_TICK;
-        length_counter++;
-        if (length_counter == 64 && bitGet(control_register, 6)) {
-            is_active = false;
+    unsigned int time = m_last_run_time;
+
+    while (time + m_channel_4.timer <= end_time) {
+        time += m_channel_4.timer;
+        m_channel_4.timer = m_channel_4.clock_period;
+
+        const uint16_t xor_res = (m_channel_4.lfsr ^ (m_channel_4.lfsr >> 1)) & 0x1;
+        m_channel_4.lfsr = (m_channel_4.lfsr >> 1) | (xor_res << 14);
+        if (m_channel_4.short_mode) {
+            bitSet(m_channel_4.lfsr, 6, xor_res);
         }
+
+        setChannelOutput(3, noiseOutput(), time);
     }
+    m_channel_4.timer -= end_time - time;
+}
 
-    clock += m_cycle_count;
-    if (clock >= cycles_per_clock_tick) {
-        clock -= cycles_per_clock_tick;
-        bool xor_res = bitGet(LFSR, 0) ^ bitGet(LFSR, 1);
-        LFSR = LFSR >> 1;
-        bitSet(LFSR, 14, xor_res);
-        if (current_LFSR_width) {
-            bitSet(LFSR, 6, xor_res);
-        }
+void Apu::setChannelOutput(unsigned int channel, float amplitude, unsigned int time) {
+    amplitude *= m_volume;
+    const float delta = amplitude - m_channel_output[channel];
+    if (delta != 0) {
+        m_channel_output[channel] = amplitude;
+        m_blip_buffer.AddDelta(time, delta);
     }
+}
 
-    if (produce_sample) {
-        uint8_t sample = (!bitGet(LFSR, 0)) * current_volume;
-        pushSampleToMixer(static_cast<float>(sample), static_cast<float>(sample), 3);
+void Apu::endFrame(uint64_t cycle) {
+    TRACE_SCOPE("Apu::endFrame");
+    if (m_muted) {
+        m_blip_buffer.Clear();
+        m_frame_start_cycle = cycle;
+        m_last_run_time = 0;
+        m_scheduler->Schedule(scheduler_event_t::ApuEndFrame, cycle + CYCLES_PER_FRAME);
+        return;
     }
 
-}
\ No newline at end of file
+    runChannels(cycle);
+
+    m_blip_buffer.EndFrame(toFrameTime(cycle));
+    m_frame_start_cycle = cycle;
+    m_last_run_time = 0;
+
+    const size_t count = m_blip_buffer.ReadSamples(m_frame_samples.data(), m_frame_samples.size());
+
+    // both sides get the same mix
+    for (size_t i = 0; i < count; ++i) {
+        m_stereo_samples[2 * i] = m_frame_samples[i];
+        m_stereo_samples[2 * i + 1] = m_frame_samples[i];
+    }
+
+    m_audio_sink->PushSamples(m_stereo_samples.data(), count * 2 * sizeof(float));
+
+    m_scheduler->Schedule(scheduler_event_t::ApuEndFrame, cycle + CYCLES_PER_FRAME);
+}
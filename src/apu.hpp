@@ -1,43 +1,175 @@
 #pragma once
 #include "memory.hpp"
-#include "audio_layer.hpp"
+#include "audio_sink.hpp"
+#include "blip_buffer.hpp"
+#include "scheduler.hpp"
+#include "timer.hpp"
+
+struct envelope_t {
+    uint8_t volume = 0;
+    uint8_t pace = 0;
+    uint8_t timer = 0;
+    bool increase = false;
+};
+
+struct square_channel_t {
+    bool enabled = false;
+    bool dac_enabled = false;
+    bool length_enabled = false;
+    uint16_t length_counter = 0;
+    uint16_t period = 0;
+    uint8_t duty = 0;
+    uint8_t duty_position = 0;
+    unsigned int timer = 0; // apu clocks left until the next duty step
+    envelope_t envelope;
+
+    // frequency sweep, only used by channel 1
+    bool sweep_enabled = false;
+    uint8_t sweep_timer = 0;
+    uint16_t sweep_shadow_period = 0;
+};
+
+struct wave_channel_t {
+    bool enabled = false;
+    bool dac_enabled = false;
+    bool length_enabled = false;
+    uint16_t length_counter = 0;
+    uint16_t period = 0;
+    uint8_t position = 0;
+    uint8_t output_shift = 4;
+    unsigned int timer = 0; // apu clocks left until the next wave sample
+};
+
+// noise clock divisors in apu clocks
+static constexpr uint8_t NOISE_DIVISORS[] = {
+    4, 8, 16, 24, 32, 40, 48, 56
+};
+
+struct noise_channel_t {
+    bool enabled = false;
+    bool dac_enabled = false;
+    bool length_enabled = false;
+    uint16_t length_counter = 0;
+    uint16_t lfsr = 0x7FFF;
+    bool short_mode = false;
+    unsigned int clock_period = NOISE_DIVISORS[0]; // what NR43 = 0 selects, never 0
+    unsigned int timer = 0; // apu clocks left until the next lfsr shift
+    envelope_t envelope;
+};
+
+struct apu_state_t {
+    square_channel_t channel_1;
+    square_channel_t channel_2;
+    wave_channel_t channel_3;
+    noise_channel_t channel_4;
+    uint64_t frame_start_cycle;
+    uint64_t next_frame_sequencer_cycle;
+    float channel_output[4];
+    uint32_t last_run_time;
+    uint8_t frame_sequencer_step;
+    uint8_t powered;
+    uint8_t audio_enabled;
+};
 
 class Apu {
 public:
-    Apu(Memory* memory_ref, AudioLayer* audio_layer_ref);
+    // without an audio sink no waveforms are generated, the channel state visible through the
+    // registers (NR52, length counters, sweep) is only brought up to date when the game accesses them
+    Apu(Memory* memory_ref, AudioSink* audio_sink_ref, Scheduler* scheduler_ref, Timer* timer_ref);
 
-    void ApuStep(unsigned int m_cycle_count);
+    inline bool IsAudioEnabled() const { return m_audio_enabled; }
 
-private:
+    // nothing is synthesized or handed to the sink while muted, only meant for frames whose state
+    // gets thrown away afterwards since the waveform state falls behind
+    inline void SetMuted(bool val) { m_muted = val; }
 
-    void handleChannel1(unsigned int m_cycle_count, bool produce_sample);
-    void handleChannel2(unsigned int m_cycle_count, bool produce_sample);
-    void handleChannel3(unsigned int m_cycle_count, bool produce_sample);
-    void handleChannel4(unsigned int m_cycle_count, bool produce_sample);
-    void pushSampleToMixer(float sampleL, float sampleR, unsigned int channel);
+    // has to be loaded after the scheduler, the apu events are rescheduled to match its mode
+    void SaveState(SaveStateWriter& writer) const;
+    bool LoadState(const SaveStateReader& reader);
 
 private:
 
-    struct sample_t {
-        float left;
-        float right;
-    };
+    void writeRegister(uint16_t addr, uint8_t byte);
+    uint8_t readRegister(uint16_t addr);
+
+    // brings the apu up to the given absolute m-cycle
+    void synchronize(uint64_t cycle);
+    void runFrameSequencer(uint64_t cycle);
+
+    // synthesizes all channels up to the given absolute m-cycle
+    void runChannels(uint64_t cycle);
+    void runSquare(square_channel_t& channel, unsigned int index, unsigned int end_time);
+    void runWave(unsigned int end_time);
+    void runNoise(unsigned int end_time);
+
+    void frameSequencerStep(uint64_t cycle);
+    void scheduleFrameSequencer();
+    void onDivReset(uint16_t old_div_counter);
+
+    void triggerSquare(square_channel_t& channel, uint16_t base_addr, bool has_sweep);
+    void triggerWave();
+    void triggerNoise();
+
+    void clockEnvelope(envelope_t& envelope);
+    void clockSweep();
+    uint16_t calculateSweepPeriod();
+
+    void powerOff();
+    void updateMasterControlRegister();
+
+    float squareOutput(const square_channel_t& channel) const;
+    float waveOutput() const;
+    float noiseOutput() const;
+
+    // records an amplitude transition of a channel at the given apu clock of the current frame
+    void setChannelOutput(unsigned int channel, float amplitude, unsigned int time);
+    void updateOutputs(unsigned int time);
+    void endFrame(uint64_t cycle);
+
+    inline unsigned int toFrameTime(uint64_t cycle) const {
+        return static_cast<unsigned int>(cycle - m_frame_start_cycle) * APU_CLOCKS_PER_M_CYCLE;
+    }
+
+private:
 
     Memory* m_memory = nullptr;
-    AudioLayer* m_audio_layer = nullptr;
-    float m_mixer_buffer[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    AudioSink* m_audio_sink = nullptr;
+    Scheduler* m_scheduler = nullptr;
+    Timer* m_timer = nullptr;
+    bool m_audio_enabled = true;
+    bool m_muted = false;
     float m_volume = 0.05f;
 
-    bool m_channel_1_trigger = false;
-    bool m_channel_2_trigger = false;
-    bool m_channel_3_trigger = false;
-    bool m_channel_4_trigger = false;
+    // the wave channel is clocked at 2MHz, so all channel timers count in half m-cycles
+    static constexpr unsigned int APU_CLOCKS_PER_M_CYCLE = 2;
+    static constexpr unsigned int CYCLES_PER_SECOND = 1 << 20;
+
+    // cycles are batched into frames of roughly one video frame before samples are generated
+    static constexpr unsigned int CYCLES_PER_FRAME = 17556;
+    static constexpr size_t MAX_FRAME_SAMPLES = 4096;
+
+    // 512Hz, ticks on the falling edge of DIV bit 4
+    static constexpr unsigned int CYCLES_PER_FRAME_SEQUENCER_STEP = 2048;
+
+    BlipBuffer m_blip_buffer;
+    uint64_t m_frame_start_cycle = 0;
+    unsigned int m_last_run_time = 0;
+    float m_channel_output[4] = {0, 0, 0, 0};
+    std::vector<float> m_frame_samples;
+    std::vector<float> m_stereo_samples;
+
+    bool m_powered = true;
+    uint8_t m_frame_sequencer_step = 0;
+    uint64_t m_next_frame_sequencer_cycle = 0;
 
-    bool m_channel_4_length_reload = false;
+    square_channel_t m_channel_1;
+    square_channel_t m_channel_2;
+    wave_channel_t m_channel_3;
+    noise_channel_t m_channel_4;
 
     // Global registers
-    static constexpr uint16_t AUDIO_MASTER_CONTROLL_ADDR = 0xFF26; // NR52 
-    static constexpr uint16_t SOUND_PANNING_ADDR = 0xFF25; // NR51 
+    static constexpr uint16_t AUDIO_MASTER_CONTROLL_ADDR = 0xFF26; // NR52
+    static constexpr uint16_t SOUND_PANNING_ADDR = 0xFF25; // NR51
     static constexpr uint16_t MASTER_VOLUME_ADDR = 0xFF24; // NR50
 
     // Per channel registers
@@ -76,4 +208,4 @@ private:
         0, 1, 1, 1, 1, 0, 0, 0,
         1, 0, 0, 0, 0, 0, 0, 0,
     };
-};
\ No newline at end of file
+};
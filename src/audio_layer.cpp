@@ -1,20 +1,24 @@
 #include "audio_layer.hpp"
+#include "trace.hpp"
 #include "common.hpp"
+#include <algorithm>
+#include <chrono>
+#include <thread>
 
-AudioLayer::AudioLayer() {
+AudioLayer::AudioLayer(): m_ring_buffer(RING_BUFFER_SIZE), m_flush_block(FLUSH_BLOCK_SIZE) {
 
-    if (SDL_Init(SDL_INIT_AUDIO) != 0) {
+    if (!SDL_Init(SDL_INIT_AUDIO)) {
         printf("%s\n", SDL_GetError());
         ASSERT(false);
     }
 
-    m_device_id = SDL_OpenAudioDevice(SDL_AUDIO_DEVICE_DEFAULT_OUTPUT, NULL);
+    m_device_id = SDL_OpenAudioDevice(SDL_AUDIO_DEVICE_DEFAULT_PLAYBACK, NULL);
     if (m_device_id == 0) {
         printf("%s\n", SDL_GetError());
         ASSERT(false);
     }
 
-    if (SDL_GetAudioDeviceFormat(m_device_id, &m_device_spec, NULL) != 0) {
+    if (!SDL_GetAudioDeviceFormat(m_device_id, &m_device_spec, NULL)) {
         printf("%s\n", SDL_GetError());
         ASSERT(false);
     }
@@ -25,7 +29,7 @@ AudioLayer::AudioLayer() {
         ASSERT(false);
     }
 
-    if (SDL_BindAudioStream(m_device_id, m_audio_stream) != 0) {
+    if (!SDL_BindAudioStream(m_device_id, m_audio_stream)) {
         printf("%s\n", SDL_GetError());
         ASSERT(false);
     }
@@ -41,20 +45,80 @@ AudioLayer::~AudioLayer() {
 }
 
 void AudioLayer::PushSamples(void* ptr, size_t len) {
+    TRACE_SCOPE("AudioLayer::PushSamples");
 
-    if (SDL_PutAudioStreamData(m_audio_stream, ptr, len) != 0) {
-        printf("%s\n", SDL_GetError());
-        ASSERT(false);
+    const size_t count = len / sizeof(float);
+    const size_t written = m_ring_buffer.Push(static_cast<float*>(ptr), count);
+    if (written != count) {
+        m_overrun_count.fetch_add(count - written, std::memory_order_relaxed);
     }
 
 }
 
-
 void AudioLayer::PushSample(float sample) {
 
-    if (SDL_PutAudioStreamData(m_audio_stream, &sample, sizeof(sample)) != 0) {
+    PushSamples(&sample, sizeof(sample));
+
+}
+
+void AudioLayer::Flush() {
+    TRACE_SCOPE("AudioLayer::Flush");
+
+    if (m_stream_started && SDL_GetAudioStreamQueued(m_audio_stream) == 0) {
+        m_underrun_count.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    size_t count = 0;
+    while ((count = m_ring_buffer.Pop(m_flush_block.data(), m_flush_block.size())) != 0) {
+        if (!SDL_PutAudioStreamData(m_audio_stream, m_flush_block.data(), static_cast<int>(count * sizeof(float)))) {
+            printf("%s\n", SDL_GetError());
+            ASSERT(false);
+        }
+        m_stream_started = true;
+    }
+
+}
+
+void AudioLayer::Discard() {
+
+    while (m_ring_buffer.Pop(m_flush_block.data(), m_flush_block.size()) != 0) {}
+
+    // the device is expected to run dry, that's not an underrun
+    m_stream_started = false;
+
+}
+
+float AudioLayer::GetQueuedLatency() const {
+
+    const size_t queued_bytes = static_cast<size_t>(SDL_GetAudioStreamQueued(m_audio_stream)) +
+                                m_ring_buffer.Size() * sizeof(float);
+    return static_cast<float>(queued_bytes) / (INPUT_SAMPLE_RATE * CHANNEL_COUNT * sizeof(float));
+
+}
+
+void AudioLayer::updateRateControl() {
+
+    // above the target the device has to consume faster, below it slower
+    const float error = (GetQueuedLatency() - m_target_latency) / m_target_latency;
+    const float target_ratio = 1.0f + std::clamp(error, -1.0f, 1.0f) * MAX_RATE_ADJUSTMENT;
+    m_rate_ratio += (target_ratio - m_rate_ratio) * RATE_SMOOTHING;
+
+    if (!SDL_SetAudioStreamFrequencyRatio(m_audio_stream, m_rate_ratio)) {
         printf("%s\n", SDL_GetError());
         ASSERT(false);
     }
 
-}
\ No newline at end of file
+}
+
+void AudioLayer::Throttle() {
+    TRACE_SCOPE("AudioLayer::Throttle");
+
+    while (GetQueuedLatency() > m_target_latency) {
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+    }
+
+    // the queue is at its lowest point of the frame here, at the target unless the emulation
+    // can't keep up, so the rate only corrects the drift around it
+    updateRateControl();
+
+}
@@ -1,17 +1,43 @@
 #pragma once
 
-#include <SDL.h>
-#include <SDL_audio.h>
+#include <SDL3/SDL.h>
+#include <atomic>
+#include <vector>
+#include "ring_buffer.hpp"
+#include "audio_sink.hpp"
 
-class AudioLayer {
+class AudioLayer : public AudioSink {
 public:
     AudioLayer();
     ~AudioLayer();
 
-    void PushSamples(void* ptr, size_t len);
+    // called from the emulation side, only copies into the ring buffer
+    void PushSamples(void* ptr, size_t len) override;
     void PushSample(float sample);
 
-    inline unsigned int GetSampleRate() const { return INPUT_SAMPLE_RATE; }
+    // moves everything queued in the ring buffer to SDL, meant to be called once per video frame
+    void Flush();
+
+    // drops everything queued in the ring buffer, used while not running at real time
+    void Discard();
+
+    // blocks while more audio than the target latency is queued, which makes the audio device the
+    // clock the emulation runs against; call right after Flush
+    void Throttle();
+
+    inline void SetTargetLatency(float seconds) { m_target_latency = seconds; }
+    inline float GetTargetLatency() const { return m_target_latency; }
+
+    // seconds of audio waiting in the ring buffer and the SDL stream
+    float GetQueuedLatency() const;
+    inline float GetRateRatio() const { return m_rate_ratio; }
+
+    inline unsigned int GetSampleRate() const override { return INPUT_SAMPLE_RATE; }
+
+    // samples dropped because the ring buffer was full
+    inline uint64_t GetOverrunCount() const { return m_overrun_count.load(std::memory_order_relaxed); }
+    // flushes that found the SDL stream already drained, i.e. the device ran dry
+    inline uint64_t GetUnderrunCount() const { return m_underrun_count.load(std::memory_order_relaxed); }
 
 private:
 
@@ -19,12 +45,31 @@ private:
     SDL_AudioSpec m_device_spec; 
     SDL_AudioStream* m_audio_stream = nullptr;
 
-    static constexpr unsigned int INPUT_SAMPLE_RATE = 32768 * 2;
+    static constexpr unsigned int INPUT_SAMPLE_RATE = DEFAULT_SAMPLE_RATE;
+    // a quarter of a second of stereo audio
+    static constexpr size_t RING_BUFFER_SIZE = INPUT_SAMPLE_RATE * CHANNEL_COUNT / 4;
+    static constexpr size_t FLUSH_BLOCK_SIZE = 4096;
 
     static constexpr SDL_AudioSpec INPUT_AUDIO_SPEC = {
         SDL_AUDIO_F32,
-        2,
+        CHANNEL_COUNT,
         INPUT_SAMPLE_RATE
     };
 
-};
\ No newline at end of file
+    void updateRateControl();
+
+    // dynamic rate control: the playback rate is nudged by at most this much to pull the queue
+    // towards the target latency, small enough for the pitch change to be inaudible
+    static constexpr float MAX_RATE_ADJUSTMENT = 0.005f;
+    static constexpr float RATE_SMOOTHING = 0.05f;
+
+    float m_target_latency = 0.04f;
+    float m_rate_ratio = 1.0f;
+
+    RingBuffer<float> m_ring_buffer;
+    std::vector<float> m_flush_block;
+    bool m_stream_started = false;
+
+    std::atomic<uint64_t> m_overrun_count = 0;
+    std::atomic<uint64_t> m_underrun_count = 0;
+};
@@ -0,0 +1,122 @@
+#include "audio_sink.hpp"
+#include "trace.hpp"
+#include "common.hpp"
+#include <vector>
+#include <chrono>
+#include <stdexcept>
+
+FileAudioSink::FileAudioSink(const std::string& path, audio_file_format_t format, unsigned int sample_rate):
+ m_file(path, std::ios::binary | std::ios::trunc), m_format(format), m_sample_rate(sample_rate),
+ m_ring_buffer(RING_BUFFER_SIZE) {
+
+    if (!m_file) {
+        throw std::runtime_error("Failed to open the audio output file");
+    }
+
+    // sizes are patched in once the stream is closed
+    if (m_format == audio_file_format_t::Wav) writeWavHeader(0);
+
+    m_writer_thread = std::thread(&FileAudioSink::writerLoop, this);
+
+}
+
+FileAudioSink::~FileAudioSink() {
+
+    m_stop.store(true, std::memory_order_release);
+    m_writer_thread.join();
+
+    if (m_format == audio_file_format_t::Wav) {
+        m_file.seekp(0);
+        writeWavHeader(static_cast<uint32_t>(m_data_size));
+    }
+
+}
+
+void FileAudioSink::PushSamples(void* ptr, size_t len) {
+
+    const float* samples = static_cast<float*>(ptr);
+    size_t count = len / sizeof(float);
+
+    size_t written = m_ring_buffer.Push(samples, count);
+    if (written == count) return;
+
+    // only reached when the disk can't keep up, dropping samples would break the capture
+    m_stall_count.fetch_add(1, std::memory_order_relaxed);
+    while (written != count) {
+        std::this_thread::yield();
+        written += m_ring_buffer.Push(samples + written, count - written);
+    }
+
+}
+
+void FileAudioSink::writerLoop() {
+    TRACE_THREAD_NAME("audio file writer");
+
+    std::vector<float> block(WRITE_BLOCK_SIZE);
+
+    while (true) {
+        // read the flag first so nothing pushed before the stop request is lost
+        const bool stop = m_stop.load(std::memory_order_acquire);
+
+        const size_t count = m_ring_buffer.Pop(block.data(), block.size());
+        if (count != 0) {
+            TRACE_SCOPE("FileAudioSink write");
+            m_file.write(reinterpret_cast<const char*>(block.data()), count * sizeof(float));
+            m_data_size += count * sizeof(float);
+            continue;
+        }
+
+        if (stop) break;
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+
+    m_file.flush();
+
+}
+
+void FileAudioSink::writeWavHeader(uint32_t data_size) {
+
+    const auto write_u32 = [this] (uint32_t val) {
+        const uint8_t bytes[] = {
+            static_cast<uint8_t>(val), static_cast<uint8_t>(val >> 8),
+            static_cast<uint8_t>(val >> 16), static_cast<uint8_t>(val >> 24)
+        };
+        m_file.write(reinterpret_cast<const char*>(bytes), 4);
+    };
+    const auto write_u16 = [this] (uint16_t val) {
+        const uint8_t bytes[] = {static_cast<uint8_t>(val), static_cast<uint8_t>(val >> 8)};
+        m_file.write(reinterpret_cast<const char*>(bytes), 2);
+    };
+
+    const uint16_t bits_per_sample = 32;
+    const uint16_t block_align = CHANNEL_COUNT * bits_per_sample / 8;
+
+    m_file.write("RIFF", 4);
+    write_u32(36 + data_size);
+    m_file.write("WAVE", 4);
+
+    m_file.write("fmt ", 4);
+    write_u32(16);
+    write_u16(3); // IEEE float
+    write_u16(CHANNEL_COUNT);
+    write_u32(m_sample_rate);
+    write_u32(m_sample_rate * block_align);
+    write_u16(block_align);
+    write_u16(bits_per_sample);
+
+    m_file.write("data", 4);
+    write_u32(data_size);
+
+}
+
+HashAudioSink::HashAudioSink(unsigned int sample_rate): m_sample_rate(sample_rate) {}
+
+void HashAudioSink::PushSamples(void* ptr, size_t len) {
+
+    const uint8_t* bytes = static_cast<uint8_t*>(ptr);
+    for (size_t i = 0; i < len; ++i) {
+        m_hash = (m_hash ^ bytes[i]) * FNV_PRIME;
+    }
+    m_sample_count += len / sizeof(float);
+
+}
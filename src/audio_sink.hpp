@@ -0,0 +1,78 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <thread>
+#include <atomic>
+#include <fstream>
+#include "ring_buffer.hpp"
+
+// Destination of the apu output, interleaved stereo float samples
+class AudioSink {
+public:
+    virtual ~AudioSink() = default;
+
+    // len is in bytes
+    virtual void PushSamples(void* ptr, size_t len) = 0;
+    virtual unsigned int GetSampleRate() const = 0;
+
+    static constexpr unsigned int DEFAULT_SAMPLE_RATE = 32768 * 2;
+    static constexpr unsigned int CHANNEL_COUNT = 2;
+};
+
+enum class audio_file_format_t {
+    Wav,      // 32 bit float WAV
+    RawFloat, // headerless interleaved 32 bit float
+};
+
+// Streams samples to a file from a background thread, the emulation side only copies into a ring buffer
+class FileAudioSink : public AudioSink {
+public:
+    FileAudioSink(const std::string& path, audio_file_format_t format,
+                  unsigned int sample_rate = DEFAULT_SAMPLE_RATE);
+    ~FileAudioSink();
+
+    void PushSamples(void* ptr, size_t len) override;
+    inline unsigned int GetSampleRate() const override { return m_sample_rate; }
+
+    // times the emulation had to wait because the writer thread fell behind
+    inline uint64_t GetStallCount() const { return m_stall_count.load(std::memory_order_relaxed); }
+
+private:
+    void writerLoop();
+    void writeWavHeader(uint32_t data_size);
+
+    // 4 seconds of audio at the default rate
+    static constexpr size_t RING_BUFFER_SIZE = 1 << 20;
+    static constexpr size_t WRITE_BLOCK_SIZE = 1 << 16;
+
+    std::ofstream m_file;
+    audio_file_format_t m_format;
+    unsigned int m_sample_rate;
+    uint64_t m_data_size = 0;
+
+    RingBuffer<float> m_ring_buffer;
+    std::thread m_writer_thread;
+    std::atomic<bool> m_stop = false;
+    std::atomic<uint64_t> m_stall_count = 0;
+};
+
+// Keeps a rolling FNV-1a hash of the sample stream, for comparing audio output between runs
+class HashAudioSink : public AudioSink {
+public:
+    HashAudioSink(unsigned int sample_rate = DEFAULT_SAMPLE_RATE);
+
+    void PushSamples(void* ptr, size_t len) override;
+    inline unsigned int GetSampleRate() const override { return m_sample_rate; }
+
+    inline uint64_t GetHash() const { return m_hash; }
+    inline uint64_t GetSampleCount() const { return m_sample_count; }
+
+private:
+    static constexpr uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ULL;
+    static constexpr uint64_t FNV_PRIME = 0x100000001b3ULL;
+
+    unsigned int m_sample_rate;
+    uint64_t m_hash = FNV_OFFSET_BASIS;
+    uint64_t m_sample_count = 0;
+};
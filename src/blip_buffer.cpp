@@ -0,0 +1,100 @@
+#include "blip_buffer.hpp"
+#include "common.hpp"
+#include <cmath>
+#include <cstring>
+#include <algorithm>
+
+BlipBuffer::BlipBuffer(unsigned int clock_rate, unsigned int sample_rate, size_t max_frame_samples) {
+    m_factor = (static_cast<uint64_t>(sample_rate) << TIME_BITS) / clock_rate;
+    m_buffer.resize(max_frame_samples + KERNEL_SIZE);
+    Clear();
+}
+
+const std::vector<float>& BlipBuffer::getStepKernel() {
+    static const std::vector<float> kernel = [] () {
+        constexpr double PI = 3.14159265358979323846;
+        // slightly below nyquist, leaves room for the window's transition band
+        constexpr double CUTOFF = 0.9;
+
+        std::vector<float> result(PHASE_COUNT * KERNEL_SIZE);
+        for (unsigned int phase = 0; phase < PHASE_COUNT; ++phase) {
+            double sum = 0;
+            double taps[KERNEL_SIZE];
+            for (unsigned int i = 0; i < KERNEL_SIZE; ++i) {
+                const double x = static_cast<double>(i) - KERNEL_SIZE / 2 + 1 -
+                                 static_cast<double>(phase) / PHASE_COUNT;
+                const double sinc = x == 0 ? 1.0 : std::sin(PI * CUTOFF * x) / (PI * CUTOFF * x);
+                const double w = 2 * PI * (x + KERNEL_SIZE / 2) / KERNEL_SIZE;
+                const double blackman = 0.42 - 0.5 * std::cos(w) + 0.08 * std::cos(2 * w);
+                taps[i] = sinc * blackman;
+                sum += taps[i];
+            }
+            // every phase must add up to exactly one step, otherwise the integrator drifts
+            for (unsigned int i = 0; i < KERNEL_SIZE; ++i) {
+                result[phase * KERNEL_SIZE + i] = static_cast<float>(taps[i] / sum);
+            }
+        }
+        return result;
+    }();
+    return kernel;
+}
+
+void BlipBuffer::AddDelta(unsigned int clock_time, float delta) {
+    const uint64_t position = m_offset + clock_time * m_factor;
+    const size_t sample_index = position >> TIME_BITS;
+    const unsigned int phase = (position >> (TIME_BITS - PHASE_BITS)) & (PHASE_COUNT - 1);
+
+    ASSERT(sample_index + KERNEL_SIZE <= m_buffer.size());
+
+    const float* kernel = getStepKernel().data() + phase * KERNEL_SIZE;
+    float* out = m_buffer.data() + sample_index;
+    for (unsigned int i = 0; i < KERNEL_SIZE; ++i) {
+        out[i] += kernel[i] * delta;
+    }
+}
+
+void BlipBuffer::EndFrame(unsigned int clock_duration) {
+    m_offset += clock_duration * m_factor;
+    ASSERT(GetSamplesAvailable() + KERNEL_SIZE <= m_buffer.size());
+}
+
+size_t BlipBuffer::ReadSamples(float* dest, size_t count) {
+    count = std::min(count, GetSamplesAvailable());
+
+    for (size_t i = 0; i < count; ++i) {
+        m_integrator += m_buffer[i];
+        dest[i] = m_integrator - m_dc_level;
+        m_dc_level += (m_integrator - m_dc_level) * HIGH_PASS_RATE;
+    }
+
+    // move the tails of the kernels that reach into the next frame to the front
+    const size_t remaining = GetSamplesAvailable() - count + KERNEL_SIZE;
+    std::memmove(m_buffer.data(), m_buffer.data() + count, remaining * sizeof(float));
+    std::fill(m_buffer.begin() + remaining, m_buffer.end(), 0.0f);
+    m_offset -= static_cast<uint64_t>(count) << TIME_BITS;
+
+    return count;
+}
+
+void BlipBuffer::SaveState(SaveStateWriter& writer) const {
+    const blip_buffer_state_t state = {m_factor, m_offset, m_integrator, m_dc_level};
+    writer.AddChunk(saveStateChunkId("BLIP"), state);
+    writer.AddChunk(saveStateChunkId("BLPB"), m_buffer.data(), m_buffer.size() * sizeof(float));
+}
+
+bool BlipBuffer::LoadState(const SaveStateReader& reader) {
+    blip_buffer_state_t state;
+    if (!reader.ReadChunk(saveStateChunkId("BLIP"), state) || state.factor != m_factor) return false;
+    if (!reader.ReadChunk(saveStateChunkId("BLPB"), m_buffer.data(), m_buffer.size() * sizeof(float))) return false;
+    m_offset = state.offset;
+    m_integrator = state.integrator;
+    m_dc_level = state.dc_level;
+    return true;
+}
+
+void BlipBuffer::Clear() {
+    std::fill(m_buffer.begin(), m_buffer.end(), 0.0f);
+    m_offset = 0;
+    m_integrator = 0.0f;
+    m_dc_level = 0.0f;
+}
@@ -0,0 +1,59 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include "save_state.hpp"
+
+/*
+Band-limited step synthesis.
+Instead of point sampling the channels, every change of the output amplitude is recorded
+as a delta at the clock it happened. Each delta is spread over a few output samples with a
+windowed sinc step, and the samples of a whole frame are produced at once by integrating
+the accumulated deltas.
+*/
+
+struct blip_buffer_state_t {
+    uint64_t factor;
+    uint64_t offset;
+    float integrator;
+    float dc_level;
+};
+
+class BlipBuffer {
+public:
+    BlipBuffer(unsigned int clock_rate, unsigned int sample_rate, size_t max_frame_samples);
+
+    // clock_time is relative to the start of the current frame
+    void AddDelta(unsigned int clock_time, float delta);
+
+    // closes the current frame, making its samples readable
+    void EndFrame(unsigned int clock_duration);
+
+    size_t ReadSamples(float* dest, size_t count);
+
+    void Clear();
+
+    inline size_t GetSamplesAvailable() const { return m_offset >> TIME_BITS; }
+
+    // only loads state saved by a buffer with the same rates and size
+    void SaveState(SaveStateWriter& writer) const;
+    bool LoadState(const SaveStateReader& reader);
+
+private:
+    static constexpr unsigned int TIME_BITS = 20;
+    static constexpr unsigned int PHASE_BITS = 5;
+    static constexpr unsigned int PHASE_COUNT = 1 << PHASE_BITS;
+    static constexpr unsigned int KERNEL_SIZE = 16;
+
+    // cutoff of the output dc blocker, similar to the capacitor on the real hardware
+    static constexpr float HIGH_PASS_RATE = 1.0f / 1024.0f;
+
+    static const std::vector<float>& getStepKernel();
+
+    std::vector<float> m_buffer;
+    uint64_t m_factor = 0; // output samples per clock, TIME_BITS fixed point
+    uint64_t m_offset = 0; // position of the current frame start, TIME_BITS fixed point
+
+    float m_integrator = 0.0f;
+    float m_dc_level = 0.0f;
+};
@@ -1,4 +1,5 @@
 #include "cpu.hpp"
+#include "profiler.hpp"
 #include <cstring>
 #include <iostream>
 
@@ -18,6 +19,29 @@ Cpu::Cpu(Memory* memory_ref, size_t clock_speed): m_memory{memory_ref}, m_clock_
     PC = ROM_LOCATION;
 }
 
+void Cpu::SaveState(SaveStateWriter& writer) const {
+    cpu_state_t state = {};
+    std::memcpy(state.regs, m_regs, sizeof(m_regs));
+    state.sp = SP;
+    state.pc = PC;
+    state.halted = m_halted;
+    state.enable_ime_next_cycle = m_enable_ime_next_cycle;
+    state.ime = m_ime;
+    writer.AddChunk(saveStateChunkId("CPU "), state);
+}
+
+bool Cpu::LoadState(const SaveStateReader& reader) {
+    cpu_state_t state;
+    if (!reader.ReadChunk(saveStateChunkId("CPU "), state)) return false;
+    std::memcpy(m_regs, state.regs, sizeof(m_regs));
+    SP = state.sp;
+    PC = state.pc;
+    m_halted = state.halted;
+    m_enable_ime_next_cycle = state.enable_ime_next_cycle;
+    m_ime = state.ime;
+    return true;
+}
+
 bool Cpu::checkFlagsConditions(uint8_t condition) {
 
     bool res = false;
@@ -110,6 +134,7 @@ void Cpu::handleInterrupts(unsigned int& cycle_count) {
                 m_memory->WriteByte(SP, LSB(PC));
                 PC = handlers[i];
                 cycle_count += 5;
+                if (m_profiler) m_profiler->OnCall(PC, SP);
             }
             
             break;
@@ -119,7 +144,8 @@ void Cpu::handleInterrupts(unsigned int& cycle_count) {
 }
 
 void Cpu::CpuStep(bool& stop_signal, unsigned int& cycle_count) {
-    
+    const unsigned int start_cycle_count = cycle_count;
+
     handleInterrupts(cycle_count);
 
     if (m_enable_ime_next_cycle) { 
@@ -128,6 +154,7 @@ void Cpu::CpuStep(bool& stop_signal, unsigned int& cycle_count) {
     }
 
     if (!m_halted) {
+        m_memory->CountExecute(PC);
         uint8_t instruction = m_memory->ReadByte(PC);
 
         LOG_CPU_VERBOSE(
@@ -143,6 +170,7 @@ void Cpu::CpuStep(bool& stop_signal, unsigned int& cycle_count) {
         if (m_past_instrs.size() == PAST_INTRS_BUFFER_SIZE) m_past_instrs.pop_front();
         m_past_instrs.push_back({PC, instruction});
         PC += 1;
+        m_instruction_count++;
 
         if (instruction == 0xCB) {
             instruction = m_memory->ReadByte(PC++);
@@ -152,7 +180,11 @@ void Cpu::CpuStep(bool& stop_signal, unsigned int& cycle_count) {
         }
     } else {
         cycle_count += 1;
+        m_halted_cycle_count++;
     }
+
+    m_cycle_count += cycle_count - start_cycle_count;
+    if (m_profiler) m_profiler->OnStep(PC, m_cycle_count, m_halted);
 }
 
 void Cpu::decodeAndExecuteNonCB(uint8_t opcode, bool& stop_signal, unsigned int& m_cycles_count) {
@@ -850,6 +882,7 @@ void Cpu::decodeAndExecuteNonCB(uint8_t opcode, bool& stop_signal, unsigned int&
             m_memory->WriteByte(SP, LSB(PC));
             PC = addr;
             m_cycles_count = 6;
+            if (m_profiler) m_profiler->OnCall(PC, SP);
             break;
         }
         // CALL cc, a16 | 3/6 M-cycles
@@ -865,6 +898,7 @@ void Cpu::decodeAndExecuteNonCB(uint8_t opcode, bool& stop_signal, unsigned int&
                 m_memory->WriteByte(SP, LSB(PC));
                 PC = addr;
                 m_cycles_count = 6;
+                if (m_profiler) m_profiler->OnCall(PC, SP);
             } else {
                 m_cycles_count = 3;
             }
@@ -873,6 +907,7 @@ void Cpu::decodeAndExecuteNonCB(uint8_t opcode, bool& stop_signal, unsigned int&
         // RET | 4 M-cycles
         case 0xC9: 
         {
+            if (m_profiler) m_profiler->OnReturn(SP);
             uint8_t lsb = m_memory->ReadByte(SP++);
             uint8_t msb = m_memory->ReadByte(SP++);
             uint16_t addr = (msb << 8) | lsb;
@@ -884,6 +919,7 @@ void Cpu::decodeAndExecuteNonCB(uint8_t opcode, bool& stop_signal, unsigned int&
         case 0xC0: case 0xD0: case 0xC8: case 0xD8:
         {
             if (checkFlagsConditions((opcode & 0b00011000) >> 3)) {
+                if (m_profiler) m_profiler->OnReturn(SP);
                 uint8_t lsb = m_memory->ReadByte(SP++);
                 uint8_t msb = m_memory->ReadByte(SP++);
                 uint16_t addr = (msb << 8) | lsb;
@@ -897,6 +933,7 @@ void Cpu::decodeAndExecuteNonCB(uint8_t opcode, bool& stop_signal, unsigned int&
         // RETI | 4 M-cycles
         case 0xD9:
         {
+            if (m_profiler) m_profiler->OnReturn(SP);
             uint8_t lsb = m_memory->ReadByte(SP++);
             uint8_t msb = m_memory->ReadByte(SP++);
             uint16_t addr = (msb << 8) | lsb;
@@ -915,6 +952,7 @@ void Cpu::decodeAndExecuteNonCB(uint8_t opcode, bool& stop_signal, unsigned int&
             m_memory->WriteByte(SP, LSB(PC));
             PC = static_cast<uint16_t>(rst_addr);
             m_cycles_count = 4;
+            if (m_profiler) m_profiler->OnCall(PC, SP);
             break;
         }
         // STOP
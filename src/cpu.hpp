@@ -1,6 +1,7 @@
 #pragma once
 
 #include "memory.hpp"                    
+#include "save_state.hpp"
 #include <chrono>
 #include <cstring>
 #include <cstdio>
@@ -48,6 +49,18 @@
 
 #define AF_GET static_cast<uint16_t>((m_regs[REG_A] << 8) | m_regs[REG_F])
 
+struct cpu_state_t {
+    uint8_t regs[8];
+    uint16_t sp;
+    uint16_t pc;
+    uint8_t halted;
+    uint8_t enable_ime_next_cycle;
+    uint8_t ime;
+    uint8_t padding;
+};
+
+class GuestProfiler;
+
 class Cpu {
 public:
 
@@ -57,6 +70,18 @@ public:
 
     inline void SetLogVerbose(bool val) {m_log_verbose = val;}
 
+    // sees every call, return and interrupt dispatch, null to turn it off
+    inline void SetProfiler(GuestProfiler* profiler) { m_profiler = profiler; }
+
+    // instructions executed since construction, halted steps don't count
+    inline uint64_t GetInstructionCount() const { return m_instruction_count; }
+    // m-cycles stepped since construction, and how many of them were spent halted
+    inline uint64_t GetCycleCount() const { return m_cycle_count; }
+    inline uint64_t GetHaltedCycleCount() const { return m_halted_cycle_count; }
+
+    void SaveState(SaveStateWriter& writer) const;
+    bool LoadState(const SaveStateReader& reader);
+
     inline void PostBoodSetup() {
         m_regs[REG_A] = 0x01;
         m_regs[REG_F] = 0b10110000;
@@ -73,6 +98,8 @@ public:
     }
 
 private:
+    // the benchmark suite times single instructions, resetting the registers around each step
+    friend class CpuBenchmark;
 
     void decodeAndExecuteNonCB(uint8_t opcode, bool& stop_signal, unsigned int& m_cycles_count);
     void decodeAndExecuteCB(uint8_t opcode, unsigned int& m_cycles_count);
@@ -115,4 +142,9 @@ private:
     static constexpr size_t PAST_INTRS_BUFFER_SIZE = 15;
 
     bool m_write_logs_to_file = true;
+
+    uint64_t m_instruction_count = 0;
+    uint64_t m_cycle_count = 0;
+    uint64_t m_halted_cycle_count = 0;
+    GuestProfiler* m_profiler = nullptr;
 };
\ No newline at end of file
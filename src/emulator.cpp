@@ -0,0 +1,368 @@
+#include "emulator.hpp"
+#include "trace.hpp"
+#include "profiler.hpp"
+#include "common.hpp"
+#include <fstream>
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <cstdio>
+
+Emulator::Emulator(const std::string& rom_path, AudioSink* audio_sink_ref):
+    m_framebuffer(SCREEN_WIDTH * SCREEN_HEIGHT * 3),
+    m_frames(m_framebuffer),
+    m_input_queue(INPUT_QUEUE_SIZE),
+    m_memory(0xFFFF + 1),
+    m_cpu(&m_memory, CYCLES_PER_SECOND),
+    m_ppu(&m_memory, m_framebuffer, [this] () { m_frame_ready = true; }),
+    m_timer(&m_memory, &m_scheduler),
+    m_serial(&m_memory, &m_scheduler),
+    m_joypad(&m_memory),
+    m_apu(&m_memory, audio_sink_ref, &m_scheduler, &m_timer) {
+
+    m_scheduler.SetEventHandler(scheduler_event_t::JoypadInput, [this] (uint64_t cycle) { applyScheduledInput(cycle); });
+
+    loadRom(rom_path);
+    setupPostBootData();
+    m_cpu.PostBoodSetup();
+}
+
+Emulator::Emulator(const Emulator& parent, fork_tag_t):
+    m_frames(m_framebuffer),
+    m_input_queue(INPUT_QUEUE_SIZE),
+    m_memory(0xFFFF + 1),
+    m_cpu(&m_memory, CYCLES_PER_SECOND),
+    m_ppu(&m_memory, m_framebuffer, [this] () { m_frame_ready = true; }),
+    m_timer(&m_memory, &m_scheduler),
+    m_serial(&m_memory, &m_scheduler),
+    m_joypad(&m_memory),
+    m_apu(&m_memory, nullptr, &m_scheduler, &m_timer) {
+
+    m_scheduler.SetEventHandler(scheduler_event_t::JoypadInput, [this] (uint64_t cycle) { applyScheduledInput(cycle); });
+
+    // no framebuffer to draw into
+    m_ppu.SetRenderingEnabled(false);
+    m_memory.ShareRom(parent.m_memory);
+    m_cpu.SetLogVerbose(false);
+}
+
+void Emulator::RunUntil(uint64_t cycle) {
+    TRACE_SCOPE("Emulator::RunUntil");
+    while (!IsStopped() && m_scheduler.GetCurrentCycle() < cycle) {
+
+        unsigned int tmp = 0;
+        m_cpu.CpuStep(m_stopped, tmp);
+        m_ppu.PpuStep(tmp);
+        m_scheduler.Advance(tmp);
+
+        if (m_frame_ready) {
+            m_frame_ready = false;
+            TRACE_SPLIT("guest frame");
+
+            applyInput();
+            if (m_run_ahead_frames > 0) runAhead();
+            else publishFrame();
+
+            if (m_frame_callback) {
+                if (m_profiler) m_profiler->Suspend();
+                m_frame_callback();
+                if (m_profiler) m_profiler->Resume();
+            }
+        }
+    }
+}
+
+void Emulator::publishFrame() {
+    TRACE_SCOPE("Emulator::publishFrame");
+    if (m_skipped_frames >= m_frame_skip) {
+        std::copy(m_framebuffer.begin(), m_framebuffer.end(), m_frames.GetWriteBuffer().begin());
+        m_frames.Publish();
+        m_skipped_frames = 0;
+        m_published_frame_count++;
+    } else {
+        m_skipped_frames++;
+    }
+}
+
+void Emulator::SetProfiler(GuestProfiler* profiler) {
+    m_profiler = profiler;
+    m_cpu.SetProfiler(profiler);
+}
+
+void Emulator::SetRunAhead(unsigned int frames) {
+    m_run_ahead_frames = frames;
+
+    // with run-ahead the real frames are never shown
+    m_ppu.SetRenderingEnabled(frames == 0);
+}
+
+void Emulator::runHiddenFrame() {
+    // the lcd may be off, in which case no frame ever finishes
+    const uint64_t limit = m_scheduler.GetCurrentCycle() + 2 * CYCLES_PER_FRAME;
+    while (!m_frame_ready && !m_stopped && m_scheduler.GetCurrentCycle() < limit) {
+        unsigned int tmp = 0;
+        m_cpu.CpuStep(m_stopped, tmp);
+        m_ppu.PpuStep(tmp);
+        m_scheduler.Advance(tmp);
+    }
+    m_frame_ready = false;
+}
+
+void Emulator::runAhead() {
+    TRACE_SCOPE("Emulator::runAhead");
+    const auto start = std::chrono::steady_clock::now();
+
+    SaveState(m_run_ahead_state);
+    const bool stopped = m_stopped;
+    const bool shown = m_skipped_frames >= m_frame_skip;
+
+    // the hidden frames keep the current input, recorded input resumes with the restored scheduler
+    m_scheduler.Cancel(scheduler_event_t::JoypadInput);
+    m_apu.SetMuted(true);
+    const cpu_work_t work_start = {m_cpu.GetInstructionCount(), m_cpu.GetCycleCount(), m_cpu.GetHaltedCycleCount()};
+    for (unsigned int i = 0; i < m_run_ahead_frames; ++i) {
+        m_ppu.SetRenderingEnabled(shown && i + 1 == m_run_ahead_frames);
+        runHiddenFrame();
+    }
+    m_run_ahead_work.instructions += m_cpu.GetInstructionCount() - work_start.instructions;
+    m_run_ahead_work.cycles += m_cpu.GetCycleCount() - work_start.cycles;
+    m_run_ahead_work.halted_cycles += m_cpu.GetHaltedCycleCount() - work_start.halted_cycles;
+    m_ppu.SetRenderingEnabled(false);
+    m_apu.SetMuted(false);
+    publishFrame();
+
+    restoreState(m_run_ahead_state.data(), m_run_ahead_state.size());
+    m_stopped = stopped;
+
+    m_run_ahead_time += std::chrono::steady_clock::now() - start;
+    m_run_ahead_count++;
+}
+
+std::chrono::nanoseconds Emulator::GetRunAheadCost() const {
+    if (m_run_ahead_count == 0) return std::chrono::nanoseconds(0);
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(m_run_ahead_time) / m_run_ahead_count;
+}
+
+void Emulator::PushInput(uint8_t button, bool pressed) {
+    const joypad_input_t input = {button, pressed};
+    if (m_input_queue.Push(&input, 1) == 0) {
+        printf("Input queue full, dropping a button change\n");
+    }
+}
+
+void Emulator::applyInput() {
+    joypad_input_t input;
+    while (m_input_queue.Pop(&input, 1) == 1) {
+        setButton(input.button, input.pressed);
+    }
+}
+
+void Emulator::ScheduleInput(const joypad_event_t& event) {
+    ASSERT(m_scheduled_input.empty() || m_scheduled_input.back().cycle <= event.cycle);
+    m_scheduled_input.push_back(event);
+    if (m_scheduled_input.size() == 1) m_scheduler.Schedule(scheduler_event_t::JoypadInput, event.cycle);
+}
+
+void Emulator::ClearScheduledInput() {
+    m_scheduled_input.clear();
+    m_scheduler.Cancel(scheduler_event_t::JoypadInput);
+}
+
+void Emulator::applyScheduledInput(uint64_t cycle) {
+    while (!m_scheduled_input.empty() && m_scheduled_input.front().cycle <= cycle) {
+        setButton(m_scheduled_input.front().button, m_scheduled_input.front().pressed);
+        m_scheduled_input.pop_front();
+    }
+    if (!m_scheduled_input.empty()) m_scheduler.Schedule(scheduler_event_t::JoypadInput, m_scheduled_input.front().cycle);
+}
+
+void Emulator::setButton(uint8_t button, bool pressed) {
+    m_joypad.SetButton(button, pressed);
+    if (m_input_callback) m_input_callback({m_scheduler.GetCurrentCycle(), button, pressed});
+}
+
+emulator_state_t Emulator::GetRomInfo() const {
+    emulator_state_t info = {};
+    for (uint16_t i = 0; i < sizeof(info.title); ++i) info.title[i] = m_memory.ReadByteDirect(0x0134 + i);
+    info.header_checksum = m_memory.ReadByteDirect(0x014D);
+    info.global_checksum[0] = m_memory.ReadByteDirect(0x014E);
+    info.global_checksum[1] = m_memory.ReadByteDirect(0x014F);
+    return info;
+}
+
+std::unique_ptr<Emulator> Emulator::Fork() {
+    std::unique_ptr<Emulator> child(new Emulator(*this, fork_tag_t{}));
+    m_memory.TakeSnapshot(child->m_fork_memory);
+    writeState(child->m_fork_state, false);
+    child->m_fork_stopped = m_stopped;
+    child->Reset();
+    return child;
+}
+
+void Emulator::Reset() {
+    ASSERT(IsFork());
+    m_memory.RestoreSnapshot(m_fork_memory);
+    const bool restored = restoreState(m_fork_state.data(), m_fork_state.size(), false);
+    ASSERT(restored);
+
+    ClearScheduledInput();
+    m_frame_ready = false;
+    m_stopped = m_fork_stopped;
+    m_stop_requested.store(false, std::memory_order_relaxed);
+}
+
+void Emulator::SaveState(std::vector<uint8_t>& buffer) const {
+    writeState(buffer, true);
+}
+
+void Emulator::writeState(std::vector<uint8_t>& buffer, bool with_memory) const {
+    SaveStateWriter writer(buffer);
+    writer.AddChunk(saveStateChunkId("INFO"), GetRomInfo());
+    m_scheduler.SaveState(writer);
+    if (with_memory) m_memory.SaveState(writer);
+    m_cpu.SaveState(writer);
+    m_ppu.SaveState(writer);
+    m_timer.SaveState(writer);
+    m_joypad.SaveState(writer);
+    m_apu.SaveState(writer);
+    writer.Finish();
+}
+
+bool Emulator::LoadState(const uint8_t* data, size_t size) {
+    const bool loaded = restoreState(data, size);
+
+    // scheduled input belongs to the timeline that was left
+    ClearScheduledInput();
+    return loaded;
+}
+
+bool Emulator::restoreState(const uint8_t* data, size_t size, bool with_memory) {
+    SaveStateReader reader(data, size);
+    if (!reader.IsValid()) return false;
+
+    emulator_state_t info;
+    const emulator_state_t rom_info = GetRomInfo();
+    if (!reader.ReadChunk(saveStateChunkId("INFO"), info) || std::memcmp(&info, &rom_info, sizeof(info)) != 0) {
+        printf("Save state belongs to a different rom\n");
+        return false;
+    }
+
+    // the apu reschedules its events, so it has to come after the scheduler
+    return m_scheduler.LoadState(reader) &&
+           (!with_memory || m_memory.LoadState(reader)) &&
+           m_cpu.LoadState(reader) &&
+           m_ppu.LoadState(reader) &&
+           m_timer.LoadState(reader) &&
+           m_joypad.LoadState(reader) &&
+           m_apu.LoadState(reader);
+}
+
+bool Emulator::SaveStateToFile(const std::string& path) const {
+    std::vector<uint8_t> buffer;
+    SaveState(buffer);
+
+    std::ofstream file(path, std::ios::binary);
+    if (!file.write(reinterpret_cast<const char*>(buffer.data()), buffer.size())) {
+        printf("Failed to write save state: %s\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool Emulator::LoadStateFromFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    const std::streamsize size = file.tellg();
+    if (size <= 0) {
+        printf("Failed to open save state: %s\n", path.c_str());
+        return false;
+    }
+
+    std::vector<uint8_t> buffer(size);
+    file.seekg(0, std::ios::beg);
+    if (!file.read(reinterpret_cast<char*>(buffer.data()), size)) {
+        printf("Failed to read save state: %s\n", path.c_str());
+        return false;
+    }
+
+    std::vector<uint8_t> backup;
+    SaveState(backup);
+    if (!LoadState(buffer)) {
+        printf("Failed to load save state: %s\n", path.c_str());
+        LoadState(backup);
+        return false;
+    }
+    return true;
+}
+
+void Emulator::loadRom(const std::string& rom_path) {
+    std::ifstream file(rom_path, std::ios::binary | std::ios::ate);
+    std::streamsize size = file.tellg();
+    file.seekg(0, std::ios::beg);
+    if (size == -1) throw std::runtime_error("Failed to load the program");
+
+    std::vector<uint8_t> data(size);
+    if (!file.read(reinterpret_cast<char *>(data.data()), size)) {
+        throw std::runtime_error("Failed to load the program");
+    }
+
+    m_memory.LoadRom(data.data(), data.size());
+}
+
+void Emulator::setupPostBootData() {
+    m_memory.WriteByte(0xFF00, 0xCF);   // P1
+    m_memory.WriteByte(0xFF01, 0x00);   // SB
+    m_memory.WriteByte(0xFF02, 0x7E);   // SC
+    m_memory.WriteByte(0xFF04, 0x18);   // DIV
+    m_memory.WriteByte(0xFF05, 0x00);   // TIMA
+    m_memory.WriteByte(0xFF06, 0x00);   // TMA
+    m_memory.WriteByte(0xFF07, 0xF8);   // TAC
+    m_memory.WriteByte(0xFF0F, 0xE1);   // IF
+    m_memory.WriteByte(0xFF10, 0x80);   // NR10
+    m_memory.WriteByte(0xFF11, 0xBF);   // NR11
+    m_memory.WriteByte(0xFF12, 0xF3);   // NR12
+    m_memory.WriteByte(0xFF13, 0xFF);   // NR13
+    m_memory.WriteByte(0xFF14, 0xBF);   // NR14
+    m_memory.WriteByte(0xFF16, 0x3F);   // NR21
+    m_memory.WriteByte(0xFF17, 0x00);   // NR22
+    m_memory.WriteByte(0xFF18, 0xFF);   // NR23
+    m_memory.WriteByte(0xFF19, 0xBF);   // NR24
+    m_memory.WriteByte(0xFF1A, 0x7F);   // NR30
+    m_memory.WriteByte(0xFF1B, 0xFF);   // NR31
+    m_memory.WriteByte(0xFF1C, 0x9F);   // NR32
+    m_memory.WriteByte(0xFF1D, 0xFF);   // NR33
+    m_memory.WriteByte(0xFF1E, 0xBF);   // NR34
+    m_memory.WriteByte(0xFF20, 0xFF);   // NR41
+    m_memory.WriteByte(0xFF21, 0x00);   // NR42
+    m_memory.WriteByte(0xFF22, 0x00);   // NR43
+    m_memory.WriteByte(0xFF23, 0xBF);   // NR44
+    m_memory.WriteByte(0xFF24, 0x77);   // NR50
+    m_memory.WriteByte(0xFF25, 0xF3);   // NR51
+    m_memory.WriteByte(0xFF26, 0xF1);   // NR52
+    m_memory.WriteByte(0xFF40, 0x91);   // LCDC
+    m_memory.WriteByte(0xFF41, 0x81);   // STAT
+    m_memory.WriteByte(0xFF42, 0x00);   // SCY
+    m_memory.WriteByte(0xFF43, 0x00);   // SCX
+    m_memory.WriteByte(0xFF44, 0x91);   // LY
+    m_memory.WriteByte(0xFF45, 0x00);   // LYC
+    m_memory.WriteByte(0xFF46, 0xFF);   // DMA
+    m_memory.WriteByte(0xFF47, 0xFC);   // BGP
+    m_memory.WriteByte(0xFF48, 0x00);   // OBP0
+    m_memory.WriteByte(0xFF49, 0x00);   // OBP1
+    m_memory.WriteByte(0xFF4A, 0x00);   // WY
+    m_memory.WriteByte(0xFF4B, 0x00);   // WX
+    m_memory.WriteByte(0xFF4D, 0xFF);   // KEY1
+    m_memory.WriteByte(0xFF4F, 0xFF);   // VBK
+    m_memory.WriteByte(0xFF51, 0xFF);   // HDMA1
+    m_memory.WriteByte(0xFF52, 0xFF);   // HDMA2
+    m_memory.WriteByte(0xFF53, 0xFF);   // HDMA3
+    m_memory.WriteByte(0xFF54, 0xFF);   // HDMA4
+    m_memory.WriteByte(0xFF55, 0xFF);   // HDMA5
+    m_memory.WriteByte(0xFF56, 0xFF);   // RP
+    m_memory.WriteByte(0xFF68, 0xFF);   // BCPS
+    m_memory.WriteByte(0xFF69, 0xFF);   // BCPD
+    m_memory.WriteByte(0xFF6A, 0xFF);   // OCPS
+    m_memory.WriteByte(0xFF6B, 0xFF);   // OCPD
+    m_memory.WriteByte(0xFF70, 0xFF);   // SVBK
+    m_memory.WriteByte(0xFF0F, 0x00);   // IF
+    m_memory.WriteByte(0xFFFF, 0x00);   // IE
+}
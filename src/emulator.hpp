@@ -0,0 +1,190 @@
+#pragma once
+#include "memory.hpp"
+#include "scheduler.hpp"
+#include "cpu.hpp"
+#include "ppu.hpp"
+#include "timer.hpp"
+#include "serial.hpp"
+#include "joypad.hpp"
+#include "apu.hpp"
+#include "audio_sink.hpp"
+#include "ring_buffer.hpp"
+#include "triple_buffer.hpp"
+#include <string>
+#include <vector>
+#include <functional>
+#include <atomic>
+#include <deque>
+#include <chrono>
+#include <memory>
+
+/*
+One complete machine. Nothing is shared between instances, so several of them can run in the
+same process, each on its own thread.
+Finished frames and input cross over to the frontend thread through lock-free queues, Stop
+and PushInput are the only calls that are safe from another thread.
+Forked machines share all memory pages with their parent until either side writes to them. They
+can run on other threads while the parent keeps going, as long as each machine stays on one thread.
+*/
+
+// cpu counters over some stretch of emulation
+struct cpu_work_t {
+    uint64_t instructions = 0;
+    uint64_t cycles = 0;
+    uint64_t halted_cycles = 0;
+};
+
+// identifies the rom a save state belongs to
+struct emulator_state_t {
+    uint8_t title[16];
+    uint8_t header_checksum;
+    uint8_t global_checksum[2];
+    uint8_t padding[5];
+};
+
+class Emulator {
+public:
+    // a null audio sink runs the apu in audio-off mode
+    Emulator(const std::string& rom_path, AudioSink* audio_sink_ref);
+    Emulator(const Emulator&) = delete;
+    Emulator& operator=(const Emulator&) = delete;
+
+    // steps the machine until the given absolute m-cycle is reached or it gets stopped
+    void RunUntil(uint64_t cycle);
+    inline void Run() { RunUntil(UINT64_MAX); }
+
+    inline void Stop() { m_stop_requested.store(true, std::memory_order_relaxed); }
+    inline bool IsStopped() const { return m_stopped || m_stop_requested.load(std::memory_order_relaxed); }
+
+    // queues a button change from the frontend thread, applied at the next frame boundary
+    void PushInput(uint8_t button, bool pressed);
+
+    // button changes that come from a recording rather than the frontend, applied exactly at their
+    // cycle; emulation thread only, events have to be queued in order
+    void ScheduleInput(const joypad_event_t& event);
+    void ClearScheduledInput();
+
+    // called on the emulation thread with every button change that reaches the joypad, stamped with the cycle it was applied at
+    inline void SetInputCallback(std::function<void(const joypad_event_t&)> callback) { m_input_callback = callback; }
+
+    // called on the emulation thread every time the ppu finishes a frame
+    inline void SetFrameCallback(std::function<void()> callback) { m_frame_callback = callback; }
+
+    inline uint64_t GetCurrentCycle() const { return m_scheduler.GetCurrentCycle(); }
+    inline std::vector<uint8_t>& GetFramebuffer() { return m_framebuffer; }
+
+    // snapshots the whole machine, call between steps on the emulation thread; the buffer keeps
+    // its capacity so repeated saves don't allocate
+    void SaveState(std::vector<uint8_t>& buffer) const;
+
+    // meant for states this instance saved itself, a failed load can leave the machine half restored
+    bool LoadState(const uint8_t* data, size_t size);
+    inline bool LoadState(const std::vector<uint8_t>& buffer) { return LoadState(buffer.data(), buffer.size()); }
+
+    // title and checksums from the cartridge header, what save states and movies are matched against
+    emulator_state_t GetRomInfo() const;
+
+    // checks the rom and rolls back if anything doesn't load
+    bool SaveStateToFile(const std::string& path) const;
+    bool LoadStateFromFile(const std::string& path);
+
+    // shows the machine this many frames ahead of where it really is, predicting with the current
+    // input to hide that much input latency; 0 disables it. Emulation thread only, and not for
+    // machines on a link cable since the hidden frames would talk to the partner
+    void SetRunAhead(unsigned int frames);
+    inline unsigned int GetRunAhead() const { return m_run_ahead_frames; }
+
+    // host time spent running ahead, averaged over the frames it was enabled for
+    std::chrono::nanoseconds GetRunAheadCost() const;
+    // what the cpu did in hidden frames so far; the cpu's own counters include it since they
+    // aren't rolled back with the state
+    inline const cpu_work_t& GetRunAheadWork() const { return m_run_ahead_work; }
+
+    // a new machine in the current state of this one, call between steps on this machine's thread;
+    // the child has no audio and no video, its memory is shared copy-on-write with the parent
+    std::unique_ptr<Emulator> Fork();
+
+    // puts a forked machine back into the state it was forked in, only the pages written since are
+    // restored; a stopped child can run again afterwards
+    void Reset();
+    inline bool IsFork() const { return !m_fork_state.empty(); }
+
+    // every finished frame is published here for the presentation thread
+    inline TripleBuffer<std::vector<uint8_t>>& GetFrames() { return m_frames; }
+
+    // only every (skip + 1)th frame is published, used when running faster than the display
+    inline void SetFrameSkip(unsigned int skip) { m_frame_skip = skip; }
+    // frames handed to the presentation thread since construction
+    inline uint64_t GetPublishedFrameCount() const { return m_published_frame_count; }
+
+    // samples the guest code, the time spent in the frame callback is left out; null to turn it off
+    void SetProfiler(GuestProfiler* profiler);
+
+    inline Memory& GetMemory() { return m_memory; }
+    inline Cpu& GetCpu() { return m_cpu; }
+    inline Ppu& GetPpu() { return m_ppu; }
+    inline Apu& GetApu() { return m_apu; }
+    inline Serial& GetSerial() { return m_serial; }
+    inline Joypad& GetJoypad() { return m_joypad; }
+
+    static constexpr unsigned int CYCLES_PER_SECOND = 1 << 20;
+    static constexpr unsigned int CYCLES_PER_FRAME = 17556;
+    static constexpr unsigned int SCREEN_WIDTH = 160;
+    static constexpr unsigned int SCREEN_HEIGHT = 144;
+
+private:
+    static constexpr size_t INPUT_QUEUE_SIZE = 64;
+
+    void loadRom(const std::string& rom_path);
+    void setupPostBootData();
+    void applyInput();
+    struct fork_tag_t {};
+    Emulator(const Emulator& parent, fork_tag_t);
+
+    void publishFrame();
+    void writeState(std::vector<uint8_t>& buffer, bool with_memory) const;
+    bool restoreState(const uint8_t* data, size_t size, bool with_memory = true);
+
+    // steps until the ppu finishes a frame, without input, callbacks or publishing
+    void runHiddenFrame();
+    void runAhead();
+    void applyScheduledInput(uint64_t cycle);
+    void setButton(uint8_t button, bool pressed);
+
+private:
+    std::vector<uint8_t> m_framebuffer;
+    bool m_frame_ready = false;
+    bool m_stopped = false;
+    std::atomic<bool> m_stop_requested = false;
+    std::function<void()> m_frame_callback;
+
+    TripleBuffer<std::vector<uint8_t>> m_frames;
+    unsigned int m_frame_skip = 0;
+    unsigned int m_skipped_frames = 0;
+    uint64_t m_published_frame_count = 0;
+
+    RingBuffer<joypad_input_t> m_input_queue;
+    std::deque<joypad_event_t> m_scheduled_input;
+
+    unsigned int m_run_ahead_frames = 0;
+    std::vector<uint8_t> m_run_ahead_state;
+    std::chrono::steady_clock::duration m_run_ahead_time{0};
+    uint64_t m_run_ahead_count = 0;
+    cpu_work_t m_run_ahead_work;
+
+    // the point a forked machine resets to, everything but memory is kept as a state
+    memory_snapshot_t m_fork_memory;
+    std::vector<uint8_t> m_fork_state;
+    bool m_fork_stopped = false;
+    std::function<void(const joypad_event_t&)> m_input_callback;
+    GuestProfiler* m_profiler = nullptr;
+
+    Memory m_memory;
+    Scheduler m_scheduler;
+    Cpu m_cpu;
+    Ppu m_ppu;
+    Timer m_timer;
+    Serial m_serial;
+    Joypad m_joypad;
+    Apu m_apu;
+};
@@ -1,68 +1,175 @@
 #include "gui.hpp"
-#include <unordered_map>
+#include "trace.hpp"
+#include <cstdio>
+#include <cmath>
+#include <algorithm>
 
-Gui::Gui(uint8_t screen_width, uint8_t screen_height, uint8_t* frame_buffer_ref, bool* button_map) {
+const std::unordered_map<SDL_Keycode, uint8_t> Gui::KEY_MAP = {
+    {SDLK_RIGHT, 0},
+    {SDLK_LEFT, 1},
+    {SDLK_UP, 2},
+    {SDLK_DOWN, 3},
+    {SDLK_A, 4},
+    {SDLK_S, 5},
+    {SDLK_D, 6},
+    {SDLK_F, 7},
+};
 
-    m_button_map = button_map;
-    m_framebuffer = frame_buffer_ref;
+const std::unordered_map<SDL_Keycode, gui_hotkey_t> Gui::HOTKEY_MAP = {
+    {SDLK_TAB, gui_hotkey_t::FastForward},
+    {SDLK_EQUALS, gui_hotkey_t::SpeedUp},
+    {SDLK_MINUS, gui_hotkey_t::SpeedDown},
+    {SDLK_F5, gui_hotkey_t::SaveState},
+    {SDLK_F7, gui_hotkey_t::LoadState},
+    {SDLK_BACKSPACE, gui_hotkey_t::Rewind},
+    {SDLK_F3, gui_hotkey_t::Overlay},
+};
+
+Gui::Gui(uint8_t screen_width, uint8_t screen_height, std::function<void(uint8_t, bool)> input_callback) {
+
+    m_input_callback = input_callback;
 
     gb_screen_width = screen_width;
     gb_screen_height = screen_height;
 
     SDL_Init(SDL_INIT_VIDEO);
     SDL_SetHint(SDL_HINT_RENDER_VSYNC, "1");
-    SDL_CreateWindowAndRenderer(gb_screen_width, gb_screen_height, 0, &m_window, &m_renderer);
+    SDL_CreateWindowAndRenderer("gb_emulator", gb_screen_width, gb_screen_height, 0, &m_window, &m_renderer);
     SDL_SetWindowSize(m_window, m_window_width, m_window_height);
-    SDL_SetWindowResizable(m_window, SDL_TRUE);
+    SDL_SetWindowResizable(m_window, true);
 
     SDL_SetWindowPosition(m_window, SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED);
 
-    m_texture = SDL_CreateTexture(m_renderer, SDL_PixelFormatEnum::SDL_PIXELFORMAT_RGB24, SDL_TextureAccess::SDL_TEXTUREACCESS_STREAMING, gb_screen_width, gb_screen_height);
+    // ARGB8888 is what practically every renderer backend stores natively, so locking it hands out
+    // the texture memory directly instead of a staging buffer that gets converted on unlock
+    m_texture = SDL_CreateTexture(m_renderer, SDL_PixelFormat::SDL_PIXELFORMAT_ARGB8888, SDL_TextureAccess::SDL_TEXTUREACCESS_STREAMING, gb_screen_width, gb_screen_height);
 }
 
-void Gui::RenderFrame(bool& stop_signal) {
-    
-    std::unordered_map<SDL_Keycode, uint8_t> key_map = {
-        {SDLK_RIGHT, 0},
-        {SDLK_LEFT, 1},
-        {SDLK_UP, 2},
-        {SDLK_DOWN, 3},
-        {SDLK_a, 4},
-        {SDLK_s, 5},
-        {SDLK_d, 6},
-        {SDLK_f, 7},
-    };
-    
-    // Render SDL stuff
+void Gui::PollEvents(bool& stop_signal) {
     SDL_Event event;
     while (SDL_PollEvent(&event)) {
-        stop_signal = event.type == SDL_EVENT_QUIT;
-        if (event.type == SDL_EVENT_KEY_DOWN) {
-            const SDL_Keycode code = event.key.keysym.sym;
-            auto itr = key_map.find(code);
-            if(itr != key_map.end()) {
-                m_button_map[itr->second] = true;
+        if (event.type == SDL_EVENT_QUIT) stop_signal = true;
+
+        if (event.type == SDL_EVENT_KEY_DOWN || event.type == SDL_EVENT_KEY_UP) {
+            // held keys repeat, the emulator only cares about changes
+            if (event.key.repeat) continue;
+
+            const SDL_Keycode code = event.key.key;
+            const bool pressed = event.type == SDL_EVENT_KEY_DOWN;
+            auto itr = KEY_MAP.find(code);
+            if(itr != KEY_MAP.end()) {
+                m_input_callback(itr->second, pressed);
             }
 
-        } else if (event.type == SDL_EVENT_KEY_UP) {
-            const SDL_Keycode code = event.key.keysym.sym;
-            auto itr = key_map.find(code);
-            if(itr != key_map.end()) {
-                m_button_map[itr->second] = false;
+            auto hotkey_itr = HOTKEY_MAP.find(code);
+            if (hotkey_itr != HOTKEY_MAP.end() && m_hotkey_callback) {
+                m_hotkey_callback(hotkey_itr->second, pressed);
             }
         }
     }
-    SDL_SetRenderDrawColor(m_renderer, 255, 0, 0, 255);
-    SDL_RenderClear(m_renderer);
+}
+
+void Gui::SetTitle(const std::string& title) {
+    SDL_SetWindowTitle(m_window, title.c_str());
+}
+
+void Gui::RenderFrame(const uint8_t* frame_buffer) {
+    TRACE_SCOPE("Gui::RenderFrame");
+    const auto start = std::chrono::steady_clock::now();
+
+    void* pixels = nullptr;
+    int pitch = 0;
+    if (!SDL_LockTexture(m_texture, NULL, &pixels, &pitch)) {
+        printf("Failed to lock the screen texture: %s\n", SDL_GetError());
+        return;
+    }
+
+    for (unsigned int y = 0; y < gb_screen_height; ++y) {
+        const uint8_t* src = frame_buffer + y * gb_screen_width * 3;
+        uint32_t* dest = reinterpret_cast<uint32_t*>(static_cast<uint8_t*>(pixels) + y * pitch);
+        for (unsigned int x = 0; x < gb_screen_width; ++x) {
+            dest[x] = 0xFF000000 | (src[x * 3] << 16) | (src[x * 3 + 1] << 8) | src[x * 3 + 2];
+        }
+    }
+
+    SDL_UnlockTexture(m_texture);
 
-    SDL_UpdateTexture(m_texture, NULL, m_framebuffer, 160 * 3);
+    const auto uploaded = std::chrono::steady_clock::now();
 
+    // the texture is stretched over the whole window, so there is nothing to clear
     SDL_RenderTexture(m_renderer, m_texture, NULL, NULL);
+    if (m_overlay_enabled) drawOverlay();
     SDL_RenderPresent(m_renderer);
+
+    const auto presented = std::chrono::steady_clock::now();
+    if (m_rendered_frames != 0) {
+        m_frame_times_ms[m_frame_time_index] = std::chrono::duration<float, std::milli>(presented - m_last_present).count();
+        m_frame_time_index = (m_frame_time_index + 1) % m_frame_times_ms.size();
+    }
+    m_last_present = presented;
+
+    m_upload_time += uploaded - start;
+    m_present_time += presented - uploaded;
+    m_rendered_frames++;
+}
+
+void Gui::fillRect(float x, float y, float w, float h, uint8_t r, uint8_t g, uint8_t b, uint8_t a) {
+    const SDL_FRect rect = {x * m_overlay_scale_x, y * m_overlay_scale_y, w * m_overlay_scale_x, h * m_overlay_scale_y};
+
+    SDL_SetRenderDrawColor(m_renderer, r, g, b, a);
+    SDL_RenderFillRect(m_renderer, &rect);
+}
+
+void Gui::drawOverlay() {
+    int output_width = 0;
+    int output_height = 0;
+    SDL_GetRenderOutputSize(m_renderer, &output_width, &output_height);
+
+    // laid out in game pixels, scaled like the game is
+    m_overlay_scale_x = static_cast<float>(output_width) / gb_screen_width;
+    m_overlay_scale_y = static_cast<float>(output_height) / gb_screen_height;
+
+    SDL_SetRenderDrawBlendMode(m_renderer, SDL_BLENDMODE_BLEND);
+    const float width = static_cast<float>(gb_screen_width);
+
+    // speed and audio queue, full width is twice the target
+    fillRect(0, 0, width, 6, 0, 0, 0, 160);
+    const float target_speed = m_overlay.target_speed_percent > 0.0f ? m_overlay.target_speed_percent : 100.0f;
+    const float speed = std::min(m_overlay.speed_percent / (2.0f * target_speed), 1.0f);
+    const bool on_target = m_overlay.target_speed_percent == 0.0f || std::abs(m_overlay.speed_percent - target_speed) < 0.05f * target_speed;
+    fillRect(0, 0, speed * width, 2, on_target ? 0 : 255, on_target ? 200 : 160, 0, 220);
+    if (m_overlay.audio_fill_percent >= 0.0f) {
+        fillRect(0, 3, std::min(m_overlay.audio_fill_percent / 200.0f, 1.0f) * width, 2, 60, 140, 255, 220);
+    }
+    fillRect(width / 2, 0, 1, 6, 255, 255, 255, 200);
+
+    // the last frame times oldest first, the line is one frame period and bars reach up to two
+    const float graph_height = 24.0f;
+    const float graph_top = gb_screen_height - graph_height;
+    const float period = m_overlay.frame_period_ms > 0.0f ? m_overlay.frame_period_ms : 16.74f;
+    fillRect(0, graph_top, width, graph_height, 0, 0, 0, 120);
+
+    for (size_t i = 0; i < m_frame_times_ms.size(); ++i) {
+        const float frame_time = m_frame_times_ms[(m_frame_time_index + i) % m_frame_times_ms.size()];
+        const float height = std::min(frame_time / (2.0f * period), 1.0f) * graph_height;
+        // held for a second refresh
+        const bool late = frame_time > 1.5f * period;
+        fillRect(static_cast<float>(i), gb_screen_height - height, 1, height, late ? 255 : 0, late ? 40 : 200, 0, 220);
+    }
+    fillRect(0, graph_top + graph_height / 2, width, 0.5f, 255, 255, 255, 160);
 }
 
 Gui::~Gui() {
 
+    if (m_rendered_frames != 0) {
+        const auto average_us = [this] (std::chrono::steady_clock::duration total) {
+            return std::chrono::duration<double, std::micro>(total).count() / m_rendered_frames;
+        };
+        printf("Host frame time: upload %.1fus present %.1fus (%llu frames)\n",
+               average_us(m_upload_time), average_us(m_present_time),
+               static_cast<unsigned long long>(m_rendered_frames));
+    }
+
     SDL_DestroyTexture(m_texture);
 
     SDL_DestroyRenderer(m_renderer);
@@ -1,14 +1,57 @@
 #pragma once
-#include "SDL.h"
+#include <SDL3/SDL.h>
+#include <functional>
+#include <unordered_map>
+#include <chrono>
+#include <string>
+#include <array>
+
+enum class gui_hotkey_t {
+    FastForward,
+    SpeedUp,
+    SpeedDown,
+    SaveState,
+    LoadState,
+    Rewind,
+    Overlay,
+};
+
+// what the overlay shows besides the frame times it measures itself
+struct gui_overlay_t {
+    float speed_percent;
+    float target_speed_percent;
+    // queued audio relative to the target latency, negative without a sound device
+    float audio_fill_percent;
+    // how long a frame should stay on screen at the current speed
+    float frame_period_ms;
+};
 
 class Gui {
 public:
-    Gui(uint8_t screen_with, uint8_t screen_height, uint8_t* frame_buffer_ref, bool* button_map);
+    // input_callback receives (button, pressed), buttons are ordered right left up down a b select start
+    Gui(uint8_t screen_with, uint8_t screen_height, std::function<void(uint8_t, bool)> input_callback);
     ~Gui();
 
-    void RenderFrame(bool& stop_signal);
+    // receives (hotkey, pressed) for keys that control the emulator rather than the game
+    inline void SetHotkeyCallback(std::function<void(gui_hotkey_t, bool)> callback) { m_hotkey_callback = callback; }
+
+    // handles window and keyboard events, stop_signal is set when the window gets closed
+    void PollEvents(bool& stop_signal);
+
+    void SetTitle(const std::string& title);
+
+    // takes an RGB24 frame, blocks on vsync
+    void RenderFrame(const uint8_t* frame_buffer);
+
+    // bars for the speed and the audio queue plus a graph of the recent frame times, drawn over the game
+    inline void SetOverlayEnabled(bool val) { m_overlay_enabled = val; }
+    inline bool IsOverlayEnabled() const { return m_overlay_enabled; }
+    inline void SetOverlay(const gui_overlay_t& overlay) { m_overlay = overlay; }
 
 private:
+    void drawOverlay();
+    void fillRect(float x, float y, float w, float h, uint8_t r, uint8_t g, uint8_t b, uint8_t a);
+
     unsigned int gb_screen_width = 160;
     unsigned int gb_screen_height = 144;
 
@@ -21,6 +64,23 @@ private:
     SDL_Surface *m_surface;
     SDL_Texture *m_texture;
 
-    uint8_t* m_framebuffer;
-    bool* m_button_map;
-};
\ No newline at end of file
+    std::function<void(uint8_t, bool)> m_input_callback;
+    std::function<void(gui_hotkey_t, bool)> m_hotkey_callback;
+
+    // host side cost of getting a frame on screen, printed on exit
+    std::chrono::steady_clock::duration m_upload_time{0};
+    std::chrono::steady_clock::duration m_present_time{0};
+    uint64_t m_rendered_frames = 0;
+
+    bool m_overlay_enabled = false;
+    gui_overlay_t m_overlay = {};
+    // time between presented frames, one column of the screen per frame
+    std::array<float, 160> m_frame_times_ms = {};
+    size_t m_frame_time_index = 0;
+    std::chrono::steady_clock::time_point m_last_present;
+    float m_overlay_scale_x = 1.0f;
+    float m_overlay_scale_y = 1.0f;
+
+    static const std::unordered_map<SDL_Keycode, uint8_t> KEY_MAP;
+    static const std::unordered_map<SDL_Keycode, gui_hotkey_t> HOTKEY_MAP;
+};
@@ -0,0 +1,60 @@
+#include "joypad.hpp"
+#include "common.hpp"
+
+Joypad::Joypad(Memory* memory_ref): m_memory{memory_ref} {
+
+    m_memory->AddToReadAddressMapper(P1_ADDR, [&] () {
+        return static_cast<uint8_t>(0xC0 | m_select | m_lines);
+    });
+
+    m_memory->AddToWriteAddressMapper(P1_ADDR, [&] (uint8_t byte) {
+        m_select = byte & 0x30;
+        updateLines();
+    });
+}
+
+void Joypad::SetButton(uint8_t button, bool pressed) {
+    ASSERT(button < BUTTON_COUNT);
+    if (m_buttons[button] == pressed) return;
+    m_buttons[button] = pressed;
+    updateLines();
+}
+
+void Joypad::SaveState(SaveStateWriter& writer) const {
+    joypad_state_t state;
+    for (uint8_t i = 0; i < BUTTON_COUNT; ++i) state.buttons[i] = m_buttons[i];
+    state.select = m_select;
+    state.lines = m_lines;
+    writer.AddChunk(saveStateChunkId("JOYP"), state);
+}
+
+bool Joypad::LoadState(const SaveStateReader& reader) {
+    joypad_state_t state;
+    if (!reader.ReadChunk(saveStateChunkId("JOYP"), state)) return false;
+    for (uint8_t i = 0; i < BUTTON_COUNT; ++i) m_buttons[i] = state.buttons[i];
+    m_select = state.select;
+    m_lines = state.lines;
+    return true;
+}
+
+uint8_t Joypad::inputLines() const {
+    uint8_t lines = 0x0F;
+    for (uint8_t i = 0; i < 4; ++i) {
+        // directions on P14, actions on P15, both can be selected at once
+        if (!bitGet(m_select, 4) && m_buttons[i]) bitSet(lines, i, false);
+        if (!bitGet(m_select, 5) && m_buttons[i + 4]) bitSet(lines, i, false);
+    }
+    return lines;
+}
+
+void Joypad::updateLines() {
+    const uint8_t lines = inputLines();
+    const bool falling_edge = (m_lines & ~lines) & 0x0F;
+    m_lines = lines;
+
+    if (falling_edge) {
+        uint8_t requests = m_memory->ReadByteDirect(0xFF0F);
+        bitSet(requests, 4, true);
+        m_memory->WriteByteDirect(0xFF0F, requests);
+    }
+}
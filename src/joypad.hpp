@@ -0,0 +1,53 @@
+#pragma once
+#include "memory.hpp"
+
+/*
+P1 is computed on read from the select bits and the button state, the joypad interrupt is
+only requested when one of the input lines goes from high to low.
+*/
+
+// a button change, stamped with the cycle from which it may be applied
+struct joypad_event_t {
+    uint64_t cycle;
+    uint8_t button;
+    bool pressed;
+};
+
+// a live button change from the frontend, it has no cycle since it applies at the next frame boundary
+struct joypad_input_t {
+    uint8_t button;
+    bool pressed;
+};
+
+struct joypad_state_t {
+    uint8_t buttons[8];
+    uint8_t select;
+    uint8_t lines;
+};
+
+class Joypad {
+public:
+    Joypad(Memory* memory_ref);
+
+    // right left up down a b select start
+    void SetButton(uint8_t button, bool pressed);
+
+    void SaveState(SaveStateWriter& writer) const;
+    bool LoadState(const SaveStateReader& reader);
+
+    static constexpr uint8_t BUTTON_COUNT = 8;
+
+private:
+    // low nibble of P1, a line is 0 while a selected button is held
+    uint8_t inputLines() const;
+    void updateLines();
+
+private:
+    Memory* m_memory;
+
+    bool m_buttons[BUTTON_COUNT] = {false, false, false, false, false, false, false, false};
+    uint8_t m_select = 0x30;
+    uint8_t m_lines = 0x0F;
+
+    static constexpr uint16_t P1_ADDR = 0xFF00;
+};
@@ -0,0 +1,80 @@
+#include "link_cable.hpp"
+#include "trace.hpp"
+#include <algorithm>
+#include <thread>
+
+LinkCable::LinkCable(Emulator* first_ref, Emulator* second_ref):
+    m_instances{first_ref, second_ref}, m_barrier(2, barrier_completion_t{this}) {
+
+    for (unsigned int i = 0; i < 2; ++i) {
+        m_instances[i]->GetSerial().SetTransferRequestCallback([this, i] (uint64_t cycle) {
+            onTransferRequest(i, cycle);
+        });
+    }
+}
+
+void LinkCable::Run() {
+    std::thread second_thread([this] () {
+        TRACE_THREAD_NAME("link partner");
+        runInstance(1);
+    });
+    runInstance(0);
+    second_thread.join();
+}
+
+void LinkCable::runInstance(unsigned int index) {
+    Emulator* emulator = m_instances[index];
+    while (true) {
+        emulator->RunUntil(m_target_cycle);
+        m_barrier.arrive_and_wait();
+        if (!m_running) break;
+    }
+}
+
+void LinkCable::onTransferRequest(unsigned int index, uint64_t cycle) {
+    m_activity[index] = true;
+
+    if (!m_instances[index]->GetSerial().IsInternalClock()) return;
+
+    // the other instance may already be past the natural end of the transfer
+    m_transfer_end_cycle[index] = std::max(cycle + Serial::CYCLES_PER_TRANSFER, m_target_cycle);
+}
+
+void LinkCable::onQuantumEnd() {
+    if (m_instances[0]->IsStopped() || m_instances[1]->IsStopped()) {
+        m_running = false;
+        return;
+    }
+
+    for (unsigned int i = 0; i < 2; ++i) {
+        if (m_transfer_end_cycle[i] <= m_target_cycle) {
+            finishTransfer(i);
+            m_transfer_end_cycle[i] = NO_TRANSFER;
+        }
+    }
+
+    if (m_activity[0] || m_activity[1]) {
+        m_active_until_cycle = m_target_cycle + ACTIVE_WINDOW;
+        m_activity[0] = m_activity[1] = false;
+    }
+
+    const unsigned int quantum = m_target_cycle < m_active_until_cycle ? ACTIVE_QUANTUM : IDLE_QUANTUM;
+    m_target_cycle = std::min({m_target_cycle + quantum, m_transfer_end_cycle[0], m_transfer_end_cycle[1]});
+}
+
+void LinkCable::finishTransfer(unsigned int master_index) {
+    Serial& master = m_instances[master_index]->GetSerial();
+    Serial& peer = m_instances[1 - master_index]->GetSerial();
+
+    // the transfer was aborted by clearing SC bit 7
+    if (!master.IsTransferRequested()) return;
+
+    // the other side only shifts if it's waiting on the external clock
+    uint8_t received = 0xFF;
+    if (peer.IsTransferRequested() && !peer.IsInternalClock()) {
+        received = peer.GetOutgoingByte();
+        peer.CompleteTransfer(master.GetOutgoingByte());
+    }
+
+    master.CompleteTransfer(received);
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include "emulator.hpp"
+#include <barrier>
+
+/*
+Connects the serial ports of two emulator instances and runs them on two threads.
+Both instances run freely for a quantum of cycles and then meet at a barrier, transfers are
+exchanged while both are parked there. While the link is idle the quantum is a whole frame,
+after any serial activity it shrinks to the length of one transfer so every transfer
+completes exactly on its last bit clock. Only the first transfer after an idle stretch can
+be stretched to the end of the quantum it was started in.
+*/
+
+class LinkCable {
+public:
+    LinkCable(Emulator* first_ref, Emulator* second_ref);
+
+    // runs both instances until either one stops, the first one on the calling thread
+    void Run();
+
+private:
+    struct barrier_completion_t {
+        LinkCable* link;
+        void operator()() noexcept { link->onQuantumEnd(); }
+    };
+
+    void runInstance(unsigned int index);
+    void onTransferRequest(unsigned int index, uint64_t cycle);
+    void onQuantumEnd();
+    void finishTransfer(unsigned int master_index);
+
+private:
+    Emulator* m_instances[2];
+    std::barrier<barrier_completion_t> m_barrier;
+
+    // only touched while both threads are parked at the barrier, or by the owning instance's thread
+    bool m_running = true;
+    uint64_t m_target_cycle = IDLE_QUANTUM;
+    uint64_t m_active_until_cycle = 0;
+    bool m_activity[2] = {false, false};
+    uint64_t m_transfer_end_cycle[2] = {NO_TRANSFER, NO_TRANSFER};
+
+    static constexpr uint64_t NO_TRANSFER = UINT64_MAX;
+    static constexpr unsigned int IDLE_QUANTUM = Emulator::CYCLES_PER_FRAME;
+    static constexpr unsigned int ACTIVE_QUANTUM = Serial::CYCLES_PER_TRANSFER;
+
+    // how long the link stays in the short quantum after the last serial activity
+    static constexpr unsigned int ACTIVE_WINDOW = Emulator::CYCLES_PER_SECOND;
+};
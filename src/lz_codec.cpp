@@ -0,0 +1,161 @@
+#include "lz_codec.hpp"
+#include <algorithm>
+#include <bit>
+#include <cstring>
+
+static constexpr unsigned int HASH_BITS = 12;
+static constexpr size_t MIN_MATCH = 4;
+static constexpr size_t MAX_OFFSET = 0xFFFF;
+
+static inline uint32_t read32(const uint8_t* ptr) {
+    uint32_t value;
+    std::memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+static inline uint64_t read64(const uint8_t* ptr) {
+    uint64_t value;
+    std::memcpy(&value, ptr, sizeof(value));
+    return value;
+}
+
+// length of the common prefix, compared 8 bytes at a time
+static inline size_t matchLength(const uint8_t* a, const uint8_t* b, const uint8_t* b_end) {
+    const uint8_t* const start = b;
+    while (b_end - b >= 8) {
+        const uint64_t diff = read64(a) ^ read64(b);
+        // the lowest set bit belongs to the first differing byte on a little endian host
+        if (diff != 0) return (b - start) + (std::countr_zero(diff) >> 3);
+        a += 8;
+        b += 8;
+    }
+    while (b < b_end && *a == *b) {
+        a++;
+        b++;
+    }
+    return b - start;
+}
+
+static inline uint32_t hashSequence(uint32_t sequence) {
+    return (sequence * 2654435761u) >> (32 - HASH_BITS);
+}
+
+static inline uint8_t* writeLength(uint8_t* out, size_t length) {
+    while (length >= 255) {
+        *out++ = 255;
+        length -= 255;
+    }
+    *out++ = static_cast<uint8_t>(length);
+    return out;
+}
+
+static uint8_t* writeSequence(uint8_t* out, const uint8_t* literals, size_t literal_count,
+                              size_t offset, size_t match_length) {
+    uint8_t* token = out++;
+    *token = static_cast<uint8_t>(std::min<size_t>(literal_count, 15) << 4);
+    if (literal_count >= 15) out = writeLength(out, literal_count - 15);
+    if (literal_count != 0) std::memcpy(out, literals, literal_count);
+    out += literal_count;
+
+    if (match_length == 0) return out;
+
+    *out++ = static_cast<uint8_t>(offset);
+    *out++ = static_cast<uint8_t>(offset >> 8);
+
+    const size_t length_code = match_length - MIN_MATCH;
+    *token |= static_cast<uint8_t>(std::min<size_t>(length_code, 15));
+    if (length_code >= 15) out = writeLength(out, length_code - 15);
+    return out;
+}
+
+size_t LzCompress(const uint8_t* src, size_t size, std::vector<uint8_t>& dest) {
+    // worst case is everything literal plus the length bytes
+    dest.resize(size + size / 255 + 16);
+    uint8_t* out = dest.data();
+
+    // positions are stored plus one so zero means empty
+    uint32_t table[1 << HASH_BITS];
+    std::memset(table, 0, sizeof(table));
+
+    size_t anchor = 0;
+    size_t position = 0;
+    unsigned int misses = 0;
+
+    while (position + MIN_MATCH <= size) {
+        const uint32_t sequence = read32(src + position);
+        const uint32_t hash = hashSequence(sequence);
+        const size_t candidate = table[hash];
+        table[hash] = static_cast<uint32_t>(position + 1);
+
+        if (candidate != 0 && position - (candidate - 1) <= MAX_OFFSET && read32(src + candidate - 1) == sequence) {
+            const size_t match = candidate - 1;
+            const size_t length = MIN_MATCH + matchLength(src + match + MIN_MATCH, src + position + MIN_MATCH, src + size);
+
+            out = writeSequence(out, src + anchor, position - anchor, position - match, length);
+            position += length;
+            anchor = position;
+            misses = 0;
+        } else {
+            // skip faster through data that doesn't compress
+            position += 1 + (misses++ >> 5);
+        }
+    }
+
+    out = writeSequence(out, src + anchor, size - anchor, 0, 0);
+
+    dest.resize(out - dest.data());
+    return dest.size();
+}
+
+static inline bool readLength(const uint8_t*& in, const uint8_t* end, size_t& length) {
+    uint8_t byte;
+    do {
+        if (in == end) return false;
+        byte = *in++;
+        length += byte;
+    } while (byte == 255);
+    return true;
+}
+
+bool LzDecompress(const uint8_t* src, size_t size, uint8_t* dest, size_t dest_size) {
+    const uint8_t* in = src;
+    const uint8_t* const in_end = src + size;
+    uint8_t* out = dest;
+    uint8_t* const out_end = dest + dest_size;
+
+    while (in < in_end) {
+        const uint8_t token = *in++;
+
+        size_t literal_count = token >> 4;
+        if (literal_count == 15 && !readLength(in, in_end, literal_count)) return false;
+        if (static_cast<size_t>(in_end - in) < literal_count || static_cast<size_t>(out_end - out) < literal_count) return false;
+        if (literal_count != 0) std::memcpy(out, in, literal_count);
+        in += literal_count;
+        out += literal_count;
+
+        // the last sequence has no match
+        if (in == in_end) break;
+
+        if (in_end - in < 2) return false;
+        const size_t offset = in[0] | (in[1] << 8);
+        in += 2;
+
+        size_t length = token & 0x0F;
+        if (length == 15 && !readLength(in, in_end, length)) return false;
+        length += MIN_MATCH;
+
+        if (offset == 0 || offset > static_cast<size_t>(out - dest)) return false;
+        if (static_cast<size_t>(out_end - out) < length) return false;
+
+        // an overlapping match repeats a pattern, copy it in chunks that double each time
+        const uint8_t* const match = out - offset;
+        while (length > 0) {
+            const size_t count = std::min<size_t>(out - match, length);
+            std::memcpy(out, match, count);
+            out += count;
+            length -= count;
+        }
+    }
+
+    return out == out_end;
+}
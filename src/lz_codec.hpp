@@ -0,0 +1,18 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+
+/*
+Small LZ77 byte codec in the spirit of LZ4, tuned for speed over ratio.
+A block is a list of sequences: a token with the literal and match lengths in its two
+nibbles, the literals, a 16 bit match offset and extra length bytes where a nibble overflows.
+The last sequence has literals only. Long runs of a single byte (the XOR of two similar
+buffers is mostly zeros) become overlapping matches and compress extremely well.
+*/
+
+// replaces the contents of dest with the compressed block, returns its size
+size_t LzCompress(const uint8_t* src, size_t size, std::vector<uint8_t>& dest);
+
+// the decompressed size has to be known up front, fails on a corrupted or mismatched block
+bool LzDecompress(const uint8_t* src, size_t size, uint8_t* dest, size_t dest_size);
@@ -1,183 +1,430 @@
 #include <iostream>
-#include <fstream>
-#include "cpu.hpp"
-#include <chrono>
 #include <memory>
-#include "ppu.hpp"
+#include <thread>
+#include <atomic>
+#include <chrono>
+#include "emulator.hpp"
+#include "link_cable.hpp"
 #include "gui.hpp"
-#include "timer.hpp"
-#include "apu.hpp"
 #include "audio_layer.hpp"
+#include "audio_sink.hpp"
+#include "pacer.hpp"
+#include "rewind.hpp"
+#include "movie.hpp"
+#include "trace.hpp"
+#include "runtime_metrics.hpp"
+#include "profiler.hpp"
 #include <vector>
 #include <numeric>
+#include <algorithm>
+#include <iterator>
+#include <string>
+#include <fstream>
 
-void load_program_from_file(const std::string &filename, std::vector<uint8_t>& data);
-void setupPostBootData(Memory& mem);
-void updateKeymap(Memory& mem, bool* buttons);
+// speeds the speed hotkeys step through, 0 is unlimited
+static constexpr float SPEED_STEPS[] = {0.25f, 0.5f, 1.0f, 2.0f, 4.0f, 0.0f};
+static constexpr unsigned int UNLIMITED_SPEED_FRAME_SKIP = 7;
+static constexpr size_t DEFAULT_REWIND_MB = 32;
+static constexpr size_t PROFILE_ROUTINE_COUNT = 30;
 
 int main(int argc, char** argv) {
 
     std::cout << "Starting the emulator" << std::endl;
 
-    const unsigned int frequency = 1 << 20;
-    const unsigned int mem_size = 0xFFFF + 1;
-
-    std::vector<uint8_t> framebuffer(160 * 144 * 3);
-    bool frame_ready = false;
+    bool verbose_logging = false;
+    bool audio_enabled = true;
+    bool headless = false;
+    bool audio_hash = false;
+    bool link = false;
+    unsigned int frame_limit = 0;
+    float audio_latency_ms = 40.0f;
+    float speed = -1.0f;
+    int rewind_mb = -1;
+    unsigned int rewind_interval = 1;
+    unsigned int run_ahead = 0;
+    std::string audio_file_path;
+    std::string game_rom_path = PROJECT_DIR"/roms/mario.gb";
+    std::string link_rom_path;
+    std::string state_path;
+    std::string start_state_path;
+    std::string record_path;
+    std::string play_path;
+    std::string trace_path;
+    bool metrics_enabled = false;
+    std::string metrics_path;
+    unsigned int metrics_interval_ms = 1000;
+    bool overlay = false;
+    std::string profile_path;
+    std::string symbol_path;
+    unsigned int profile_interval = 256;
+    std::string memory_stats_path;
 
-    Memory mem(mem_size);
-    Cpu cpu(&mem, frequency);
-    Ppu ppu(&mem, framebuffer, [&frame_ready] () {frame_ready = true;});
-    Timer timer(&mem);
-    AudioLayer audio_layer;
-    Apu apu(&mem, &audio_layer);
+    for (int i = 1; i < argc; ++i) {
+        const std::string arg = argv[i];
+        const auto value_of = [&arg] (const std::string& option) {
+            return arg.rfind(option, 0) == 0 ? arg.substr(option.size()) : std::string();
+        };
 
-    // right left up down a b select start
-    bool button_map[] = {false, false, false, false, false, false, false, false};
+        if (arg == "--no-audio") {
+            audio_enabled = false;
+        } else if (arg == "--headless") {
+            headless = true;
+        } else if (arg == "--audio-hash") {
+            audio_hash = true;
+        } else if (!value_of("--audio-latency=").empty()) {
+            audio_latency_ms = std::stof(value_of("--audio-latency="));
+        } else if (!value_of("--audio-file=").empty()) {
+            audio_file_path = value_of("--audio-file=");
+        } else if (!value_of("--speed=").empty()) {
+            speed = std::stof(value_of("--speed="));
+        } else if (!value_of("--frames=").empty()) {
+            frame_limit = std::stoul(value_of("--frames="));
+        } else if (!value_of("--rom=").empty()) {
+            game_rom_path = value_of("--rom=");
+        } else if (!value_of("--state=").empty()) {
+            state_path = value_of("--state=");
+        } else if (!value_of("--start-state=").empty()) {
+            start_state_path = value_of("--start-state=");
+        } else if (!value_of("--record=").empty()) {
+            record_path = value_of("--record=");
+        } else if (!value_of("--play=").empty()) {
+            play_path = value_of("--play=");
+        } else if (!value_of("--rewind=").empty()) {
+            rewind_mb = std::stoi(value_of("--rewind="));
+        } else if (!value_of("--rewind-interval=").empty()) {
+            rewind_interval = std::stoul(value_of("--rewind-interval="));
+        } else if (!value_of("--run-ahead=").empty()) {
+            run_ahead = std::stoul(value_of("--run-ahead="));
+        } else if (arg == "--metrics") {
+            metrics_enabled = true;
+        } else if (!value_of("--metrics=").empty()) {
+            metrics_enabled = true;
+            metrics_path = value_of("--metrics=");
+        } else if (!value_of("--metrics-interval=").empty()) {
+            metrics_interval_ms = std::max(1ul, std::stoul(value_of("--metrics-interval=")));
+        } else if (arg == "--overlay") {
+            overlay = true;
+        } else if (!value_of("--profile=").empty()) {
+            profile_path = value_of("--profile=");
+        } else if (!value_of("--profile-interval=").empty()) {
+            profile_interval = std::stoul(value_of("--profile-interval="));
+        } else if (!value_of("--sym=").empty()) {
+            symbol_path = value_of("--sym=");
+        } else if (!value_of("--memory-stats=").empty()) {
+            memory_stats_path = value_of("--memory-stats=");
+        } else if (!value_of("--trace=").empty()) {
+            trace_path = value_of("--trace=");
+        } else if (arg == "--link") {
+            link = true;
+        } else if (!value_of("--link-rom=").empty()) {
+            link = true;
+            link_rom_path = value_of("--link-rom=");
+        } else {
+            verbose_logging = true;
+        }
+    }
 
-    bool stop_signal = false;
+    if (!trace_path.empty() && !Tracer::IS_ENABLED) {
+        std::cout << "Built without GB_TRACE, --trace records nothing" << std::endl;
+        trace_path.clear();
+    }
 
-    const std::string game_rom_path = PROJECT_DIR"/roms/mario.gb";
+    // the apu feeds a single sink: a capture file, a hash, or the sound device
+    std::unique_ptr<AudioLayer> audio_layer;
+    std::unique_ptr<AudioSink> capture_sink;
+    HashAudioSink* hash_sink = nullptr;
+    AudioSink* audio_sink = nullptr;
 
-    std::vector<uint8_t> rom_buffer;
-    load_program_from_file(game_rom_path, rom_buffer);
-    mem.LoadRom(rom_buffer.data(), rom_buffer.size());
-    rom_buffer = std::vector<uint8_t>();
+    if (!audio_file_path.empty()) {
+        const bool is_wav = audio_file_path.size() >= 4 &&
+                            audio_file_path.compare(audio_file_path.size() - 4, 4, ".wav") == 0;
+        capture_sink = std::make_unique<FileAudioSink>(audio_file_path,
+            is_wav ? audio_file_format_t::Wav : audio_file_format_t::RawFloat);
+        audio_sink = capture_sink.get();
+    } else if (audio_hash) {
+        capture_sink = std::make_unique<HashAudioSink>();
+        hash_sink = static_cast<HashAudioSink*>(capture_sink.get());
+        audio_sink = capture_sink.get();
+    } else if (audio_enabled && !headless) {
+        audio_layer = std::make_unique<AudioLayer>();
+        audio_layer->SetTargetLatency(audio_latency_ms / 1000.0f);
+        audio_sink = audio_layer.get();
+    }
 
+    Emulator emulator(game_rom_path, audio_sink);
     std::cout << "Running rom: " << game_rom_path << std::endl;
 
-    setupPostBootData(mem);
-    cpu.PostBoodSetup();
+    emulator.GetCpu().SetLogVerbose(verbose_logging);
+
+    if (!memory_stats_path.empty() && !emulator.GetMemory().EnableStats()) {
+        std::cout << "Built without GB_MEMORY_STATS, --memory-stats records nothing" << std::endl;
+        memory_stats_path.clear();
+    }
+
+    // rgbds writes the symbols next to the rom
+    std::unique_ptr<GuestProfiler> profiler;
+    if (!profile_path.empty()) {
+        profiler = std::make_unique<GuestProfiler>(&emulator.GetMemory(), profile_interval);
+        if (symbol_path.empty()) {
+            const size_t extension = game_rom_path.find_last_of('.');
+            const std::string default_path = game_rom_path.substr(0, extension) + ".sym";
+            if (std::ifstream(default_path).good()) symbol_path = default_path;
+        }
+        if (!symbol_path.empty() && profiler->LoadSymbols(symbol_path)) {
+            std::cout << "Loaded " << profiler->GetSymbolCount() << " symbols from " << symbol_path << std::endl;
+        }
+        emulator.SetProfiler(profiler.get());
+    }
+
+    if (!start_state_path.empty() && !emulator.LoadStateFromFile(start_state_path)) return 1;
+
+    // a movie either records the session from here or replaces the live input
+    std::unique_ptr<Movie> movie;
+    std::atomic<bool> movie_playing = false;
+    if (!play_path.empty()) {
+        movie = std::make_unique<Movie>(&emulator);
+        if (!movie->LoadFromFile(play_path) || !movie->StartPlayback()) return 1;
+        movie_playing = true;
+        std::cout << "Playing movie: " << play_path << " (" << movie->GetFrameCount() << " frames)" << std::endl;
+    } else if (!record_path.empty()) {
+        movie = std::make_unique<Movie>(&emulator);
+        movie->StartRecording(start_state_path.empty());
+        std::cout << "Recording movie: " << record_path << std::endl;
+    }
+
+    std::unique_ptr<Gui> gui;
+    if (!headless) gui = std::make_unique<Gui>(Emulator::SCREEN_WIDTH, Emulator::SCREEN_HEIGHT,
+        [&emulator, &movie_playing] (uint8_t button, bool pressed) {
+            if (!movie_playing) emulator.PushInput(button, pressed);
+        });
 
-    Gui gui(160, 144, framebuffer.data(), button_map);
-    
-    bool verbose_logging = argc > 1;
+    unsigned int frame_count = 0;
 
-    cpu.SetLogVerbose(verbose_logging);
+    if (state_path.empty()) state_path = game_rom_path + ".state";
 
-    const unsigned int frame_discout_setting = 0;
-    unsigned int frame_discount_coutner = 0;
+    // set by the sdl thread, handled between frames on the emulation thread
+    std::atomic<bool> save_state_requested = false;
+    std::atomic<bool> load_state_requested = false;
+    std::atomic<bool> rewinding = false;
 
-    while (!stop_signal) {
+    // nobody can hold the rewind key without a window
+    if (rewind_mb < 0) rewind_mb = headless ? 0 : DEFAULT_REWIND_MB;
+    std::unique_ptr<RewindBuffer> rewind_buffer;
+    if (rewind_mb > 0) rewind_buffer = std::make_unique<RewindBuffer>(&emulator, static_cast<size_t>(rewind_mb) << 20, rewind_interval);
 
-        updateKeymap(mem, button_map);
+    // headless runs go as fast as possible unless a speed is asked for
+    Pacer pacer;
+    pacer.SetSpeed(speed >= 0.0f ? speed : (headless ? 0.0f : 1.0f));
 
-        unsigned int tmp = 0;
-        cpu.CpuStep(stop_signal, tmp);
-        ppu.PpuStep(tmp);
-        timer.TimerStep(tmp);
-        apu.ApuStep(tmp);
+    // cheap enough to always collect with a window, the overlay can be turned on at any time
+    std::unique_ptr<RuntimeMetrics> metrics;
+    if (metrics_enabled || gui) {
+        metrics = std::make_unique<RuntimeMetrics>(&emulator, &pacer, gui != nullptr);
+        if (metrics_enabled && !metrics->Open(metrics_path, std::chrono::milliseconds(metrics_interval_ms))) return 1;
+    }
+    if (gui) gui->SetOverlayEnabled(overlay);
 
-        if (frame_ready) { 
-            if (frame_discount_coutner != frame_discout_setting) {
-                frame_discount_coutner++;
-                frame_ready = false;
+    // runs on the emulation thread
+    emulator.SetFrameCallback([&] () {
+        TRACE_SCOPE("frame callback");
+        frame_count++;
+        if (frame_limit != 0 && frame_count >= frame_limit) emulator.Stop();
+
+        // a movie's timeline can't jump, loading and rewinding wait until it's done
+        const bool movie_active = movie && movie->GetMode() != movie_mode_t::Idle;
+        if (movie_active) {
+            movie->OnFrame();
+            if (movie->IsFinished()) {
+                movie_playing = false;
+                printf("Movie finished after %u frames, %u of %u checkpoints matched\n", movie->GetFrame(),
+                       movie->GetCheckedCount() - movie->GetDesyncCount(), movie->GetCheckedCount());
+                if (headless) emulator.Stop();
             }
-            else {
-                frame_discount_coutner = 0;
-                gui.RenderFrame(stop_signal);
-                frame_ready = false;
+        }
+
+        if (save_state_requested.exchange(false) && emulator.SaveStateToFile(state_path)) {
+            std::cout << "Saved state to " << state_path << std::endl;
+        }
+        if (load_state_requested.exchange(false) && !movie_active && emulator.LoadStateFromFile(state_path)) {
+            std::cout << "Loaded state from " << state_path << std::endl;
+        }
+
+        // every rewound frame steps back a snapshot, after which one frame runs forward to show it
+        const bool rewound = rewind_buffer && rewinding && !movie_active;
+        if (rewound) rewind_buffer->StepBack();
+        else if (rewind_buffer) rewind_buffer->OnFrame();
+
+        const float current_speed = pacer.GetEffectiveSpeed();
+        const auto wait_start = std::chrono::steady_clock::now();
+
+        // at real time the audio device is the clock, otherwise the samples can't be played anyway
+        const bool audio_paced = audio_layer && current_speed == 1.0f && !rewound;
+        if (audio_paced) {
+            audio_layer->Flush();
+            audio_layer->Throttle();
+        } else if (audio_layer) {
+            audio_layer->Discard();
+        }
+
+        pacer.FrameDone(!audio_paced);
+
+        if (metrics) {
+            if (audio_layer) {
+                metrics->SetAudioState(audio_layer->GetQueuedLatency(), audio_layer->GetTargetLatency(),
+                                       audio_layer->GetUnderrunCount(), audio_layer->GetOverrunCount());
             }
+            metrics->OnFrame(std::chrono::steady_clock::now() - wait_start);
         }
+
+        // don't hand the presenter more frames than the display can show
+        if (current_speed == 0.0f) emulator.SetFrameSkip(UNLIMITED_SPEED_FRAME_SKIP);
+        else emulator.SetFrameSkip(current_speed > 1.0f ? static_cast<unsigned int>(current_speed) - 1 : 0);
+    });
+
+    std::unique_ptr<Emulator> link_emulator;
+    std::unique_ptr<LinkCable> link_cable;
+    if (link) {
+        // the second player has no window or sound, it only mirrors the cable partner
+        if (link_rom_path.empty()) link_rom_path = game_rom_path;
+        link_emulator = std::make_unique<Emulator>(link_rom_path, nullptr);
+        link_cable = std::make_unique<LinkCable>(&emulator, link_emulator.get());
+        std::cout << "Linked rom: " << link_rom_path << std::endl;
+
+        if (run_ahead != 0) std::cout << "Run-ahead is not available with the link cable" << std::endl;
+        run_ahead = 0;
     }
+    emulator.SetRunAhead(run_ahead);
 
-    std::cout << "Terminating the emulator" << std::endl;
+    const auto run_emulation = [&] () {
+        TRACE_THREAD_NAME("emulation");
+        if (link_cable) link_cable->Run();
+        else emulator.Run();
+    };
 
-    return 0;
-}
+    if (gui) {
+        gui->SetHotkeyCallback([&] (gui_hotkey_t hotkey, bool pressed) {
+            if (hotkey == gui_hotkey_t::FastForward) {
+                pacer.SetFastForward(pressed);
+                return;
+            }
+            if (hotkey == gui_hotkey_t::Rewind) {
+                rewinding = pressed;
+                return;
+            }
+            if (!pressed) return;
 
-void updateKeymap(Memory& mem, bool* buttons) {
-    uint8_t current_val = mem.ReadByte(0xFF00);
-    bool direction = bitGet(current_val, 4);
-    bool action = bitGet(current_val, 5);
-    bool trigger_interrupt = false;
-    for (uint8_t i = 0;i < 4; ++i) {
-        if (!direction) {
-            bitSet(current_val, i, !(buttons[i]));
-            trigger_interrupt = trigger_interrupt || (buttons[i]);
-        } else if (!action) {
-            bitSet(current_val, i, !(buttons[i + 4]));
-            trigger_interrupt = trigger_interrupt || (buttons[i + 4]);
-        } else {
-            bitSet(current_val, i, 1);
+            if (hotkey == gui_hotkey_t::Overlay) {
+                gui->SetOverlayEnabled(!gui->IsOverlayEnabled());
+                return;
+            }
+
+            if (hotkey == gui_hotkey_t::SaveState) {
+                save_state_requested = true;
+                return;
+            }
+            if (hotkey == gui_hotkey_t::LoadState) {
+                load_state_requested = true;
+                return;
+            }
+
+            const auto itr = std::find(std::begin(SPEED_STEPS), std::end(SPEED_STEPS), pacer.GetSpeed());
+            const long index = itr == std::end(SPEED_STEPS) ? 2 : itr - std::begin(SPEED_STEPS);
+            const long step_count = static_cast<long>(std::size(SPEED_STEPS));
+            const long next = std::clamp(index + (hotkey == gui_hotkey_t::SpeedUp ? 1 : -1), 0L, step_count - 1);
+            pacer.SetSpeed(SPEED_STEPS[next]);
+        });
+
+        // the sdl thread only presents the latest finished frame and forwards input
+        std::atomic<bool> emulation_finished = false;
+        std::thread emulation_thread([&] () {
+            run_emulation();
+            emulation_finished = true;
+        });
+
+        TRACE_THREAD_NAME("presentation");
+        auto last_title_update = std::chrono::steady_clock::now();
+
+        while (!emulation_finished) {
+            bool stop_signal = false;
+            gui->PollEvents(stop_signal);
+            if (stop_signal) emulator.Stop();
+
+            const auto now = std::chrono::steady_clock::now();
+            if (now - last_title_update >= std::chrono::seconds(1)) {
+                last_title_update = now;
+                const float target = pacer.GetEffectiveSpeed();
+                char title[96];
+                snprintf(title, sizeof(title), "gb_emulator - %.0f%% (target %s)", pacer.GetAchievedSpeed() * 100.0f,
+                         target == 0.0f ? "unlimited" : (std::to_string(static_cast<int>(target * 100)) + "%").c_str());
+                gui->SetTitle(title);
+            }
+
+            if (emulator.GetFrames().Update()) {
+                if (gui->IsOverlayEnabled()) {
+                    const float target = pacer.GetEffectiveSpeed();
+                    gui->SetOverlay({
+                        metrics->GetSpeedPercent(),
+                        target * 100.0f,
+                        audio_layer ? metrics->GetAudioFillPercent() : -1.0f,
+                        static_cast<float>(1000.0 / (Pacer::FRAME_RATE * (target == 0.0f ? 1.0f : std::min(target, 1.0f)))),
+                    });
+                }
+                gui->RenderFrame(emulator.GetFrames().GetReadBuffer().data());
+                metrics->OnPresent();
+            } else {
+                std::this_thread::sleep_for(std::chrono::milliseconds(1));
+            }
         }
+
+        emulation_thread.join();
+    } else {
+        run_emulation();
     }
 
-    if (trigger_interrupt) {
-        uint8_t requests = mem.ReadByte(0xFF0F);
-        bitSet(requests, 4, 1);
-        mem.WriteByte(0xFF0F, requests);
+    printf("Average speed: %.1f%%\n", pacer.GetAverageSpeed() * 100.0f);
+
+    if (movie && !record_path.empty()) {
+        movie->Stop();
+        if (movie->SaveToFile(record_path)) {
+            printf("Recorded %u frames and %zu button changes to %s\n", movie->GetFrameCount(), movie->GetEventCount(), record_path.c_str());
+        }
     }
 
-    mem.WriteByte(0xFF00, current_val);
-}
+    if (run_ahead != 0) {
+        printf("Run-ahead: %u frames, %.1f us per frame\n", run_ahead, emulator.GetRunAheadCost().count() / 1000.0);
+    }
 
-void load_program_from_file(const std::string &filename, std::vector<uint8_t>& data) {
-    std::ifstream file(filename, std::ios::binary | std::ios::ate);
-    std::streamsize size = file.tellg();
-    file.seekg(0, std::ios::beg);
-    if (size == -1) throw std::runtime_error("Failed to load the program");
-    data.reserve(size);
-    if (!file.read(reinterpret_cast<char *>(data.data()), size)) {
-        throw std::runtime_error("Failed to load the program");
+    if (rewind_buffer) {
+        printf("Rewind: %zu snapshots in %zu KB, %.1f us per frame\n", rewind_buffer->GetSnapshotCount(),
+               rewind_buffer->GetUsedBytes() >> 10, rewind_buffer->GetAverageFrameCost().count() / 1000.0);
+    }
+
+    if (profiler) {
+        profiler->PrintRoutines(PROFILE_ROUTINE_COUNT);
+        if (profiler->WriteCollapsedStacks(profile_path)) printf("Wrote the guest call stacks to %s\n", profile_path.c_str());
+    }
+
+    if (!memory_stats_path.empty()) {
+        const MemoryStats* memory_stats = emulator.GetMemory().GetStats();
+        memory_stats->PrintSummary(frame_count);
+        if (memory_stats->WriteToFile(memory_stats_path)) printf("Wrote the memory access counts to %s\n", memory_stats_path.c_str());
     }
-}
 
-void setupPostBootData(Memory& mem) {
-    mem.WriteByte(0xFF00, 0xCF);   // P1
-    mem.WriteByte(0xFF01, 0x00);   // SB
-    mem.WriteByte(0xFF02, 0x7E);   // SC
-    mem.WriteByte(0xFF04, 0x18);   // DIV
-    mem.WriteByte(0xFF05, 0x00);   // TIMA
-    mem.WriteByte(0xFF06, 0x00);   // TMA
-    mem.WriteByte(0xFF07, 0xF8);   // TAC
-    mem.WriteByte(0xFF0F, 0xE1);   // IF
-    mem.WriteByte(0xFF10, 0x80);   // NR10
-    mem.WriteByte(0xFF11, 0xBF);   // NR11
-    mem.WriteByte(0xFF12, 0xF3);   // NR12
-    mem.WriteByte(0xFF13, 0xFF);   // NR13
-    mem.WriteByte(0xFF14, 0xBF);   // NR14
-    mem.WriteByte(0xFF16, 0x3F);   // NR21
-    mem.WriteByte(0xFF17, 0x00);   // NR22
-    mem.WriteByte(0xFF18, 0xFF);   // NR23
-    mem.WriteByte(0xFF19, 0xBF);   // NR24
-    mem.WriteByte(0xFF1A, 0x7F);   // NR30
-    mem.WriteByte(0xFF1B, 0xFF);   // NR31
-    mem.WriteByte(0xFF1C, 0x9F);   // NR32
-    mem.WriteByte(0xFF1D, 0xFF);   // NR33
-    mem.WriteByte(0xFF1E, 0xBF);   // NR34
-    mem.WriteByte(0xFF20, 0xFF);   // NR41
-    mem.WriteByte(0xFF21, 0x00);   // NR42
-    mem.WriteByte(0xFF22, 0x00);   // NR43
-    mem.WriteByte(0xFF23, 0xBF);   // NR44
-    mem.WriteByte(0xFF24, 0x77);   // NR50
-    mem.WriteByte(0xFF25, 0xF3);   // NR51
-    mem.WriteByte(0xFF26, 0xF1);   // NR52
-    mem.WriteByte(0xFF40, 0x91);   // LCDC
-    mem.WriteByte(0xFF41, 0x81);   // STAT
-    mem.WriteByte(0xFF42, 0x00);   // SCY
-    mem.WriteByte(0xFF43, 0x00);   // SCX
-    mem.WriteByte(0xFF44, 0x91);   // LY
-    mem.WriteByte(0xFF45, 0x00);   // LYC
-    mem.WriteByte(0xFF46, 0xFF);   // DMA
-    mem.WriteByte(0xFF47, 0xFC);   // BGP
-    mem.WriteByte(0xFF48, 0x00);   // OBP0
-    mem.WriteByte(0xFF49, 0x00);   // OBP1
-    mem.WriteByte(0xFF4A, 0x00);   // WY
-    mem.WriteByte(0xFF4B, 0x00);   // WX
-    mem.WriteByte(0xFF4D, 0xFF);   // KEY1
-    mem.WriteByte(0xFF4F, 0xFF);   // VBK
-    mem.WriteByte(0xFF51, 0xFF);   // HDMA1
-    mem.WriteByte(0xFF52, 0xFF);   // HDMA2
-    mem.WriteByte(0xFF53, 0xFF);   // HDMA3
-    mem.WriteByte(0xFF54, 0xFF);   // HDMA4
-    mem.WriteByte(0xFF55, 0xFF);   // HDMA5
-    mem.WriteByte(0xFF56, 0xFF);   // RP
-    mem.WriteByte(0xFF68, 0xFF);   // BCPS
-    mem.WriteByte(0xFF69, 0xFF);   // BCPD
-    mem.WriteByte(0xFF6A, 0xFF);   // OCPS
-    mem.WriteByte(0xFF6B, 0xFF);   // OCPD
-    mem.WriteByte(0xFF70, 0xFF);   // SVBK
-    mem.WriteByte(0xFF0F, 0x00);   // IF
-    mem.WriteByte(0xFFFF, 0x00);   // IE
+    // the last stretch since the previous line
+    if (metrics_enabled) metrics->Report();
+
+    if (hash_sink) {
+        printf("Audio hash: %016llx samples: %llu\n",
+               static_cast<unsigned long long>(hash_sink->GetHash()),
+               static_cast<unsigned long long>(hash_sink->GetSampleCount()));
+    }
+
+    // the recording threads have finished, only the file writer may still be draining
+    if (!trace_path.empty() && Tracer::WriteChromeTrace(trace_path)) {
+        printf("Wrote trace to %s\n", trace_path.c_str());
+    }
+
+    std::cout << "Terminating the emulator" << std::endl;
+
+    return 0;
 }
@@ -2,6 +2,7 @@
 #include <cstring>
 #include <cstdio>
 #include <stdexcept>
+#include <algorithm>
 #include "ppu.hpp"
 #include "common.hpp"
 
@@ -13,28 +14,58 @@
 
 Memory::Memory(size_t memory_size) {
 
-    m_memory = new uint8_t[memory_size];
+    ASSERT(memory_size % MEMORY_PAGE_SIZE == 0);
     m_memory_size = memory_size;
+    m_address_page_count = memory_size / MEMORY_PAGE_SIZE;
+    resizePages(0);
     CleanMemory();
 
 }
 
-Memory::~Memory() {
+Memory::~Memory() {}
 
-    for (uint8_t* bank : m_rom_banks) {
-        delete[] bank;
-    }
+const std::shared_ptr<memory_page_t>& Memory::zeroPage() {
+    static const std::shared_ptr<memory_page_t> page = std::make_shared<memory_page_t>();
+    return page;
+}
 
-    for (uint8_t* bank : m_ram_banks) {
-        delete[] bank;
-    }
+void Memory::resizePages(size_t ram_bank_count) {
+    m_ram_bank_count = ram_bank_count;
+    const size_t page_count = m_address_page_count + ram_bank_count * RAM_BANK_PAGES;
+    m_page_refs.resize(page_count, zeroPage());
+    m_page_data.resize(page_count, zeroPage()->data);
+    m_page_owned.resize(page_count, false);
+}
 
-    delete[] m_memory;
+void Memory::copyPage(size_t page) {
+    setPage(page, std::make_shared<memory_page_t>(*m_page_refs[page]));
+    m_page_owned[page] = true;
+}
+
+void Memory::setPage(size_t page, const std::shared_ptr<memory_page_t>& ref) {
+    m_page_refs[page] = ref;
+    m_page_data[page] = ref->data;
+    m_page_owned[page] = false;
+}
 
+bool Memory::loadPage(size_t page, const uint8_t* data) {
+    if (std::memcmp(m_page_data[page], data, MEMORY_PAGE_SIZE) == 0) return false;
+    std::memcpy(writablePage(page), data, MEMORY_PAGE_SIZE);
+    return true;
+}
+
+void Memory::markVramPageDirty(size_t page) {
+    const size_t first_page = VRAM_ADDR / MEMORY_PAGE_SIZE;
+    if (page < first_page || page >= first_page + VRAM_SIZE / MEMORY_PAGE_SIZE) return;
+
+    constexpr size_t BLOCKS_PER_PAGE = MEMORY_PAGE_SIZE / 16;
+    std::memset(m_vram_dirty_blocks + (page - first_page) * BLOCKS_PER_PAGE, 0x01, BLOCKS_PER_PAGE);
+    m_vram_dirty = true;
 }
 
 uint8_t Memory::ReadByte(uint16_t addr) const {
-    LOG_MEM_VERBOSE(printf("MEM: ReadByte | addr: %02x | byte: %01x\n", addr, m_memory[addr]));
+    LOG_MEM_VERBOSE(printf("MEM: ReadByte | addr: %02x | byte: %01x\n", addr, ReadByteDirect(addr)));
+    MEMORY_STATS(if (m_stats) m_stats->OnRead(addr);)
     
     if (addr >= 0x4000 && addr <= 0x7FFF) {
         // rom bank
@@ -44,14 +75,14 @@ uint8_t Memory::ReadByte(uint16_t addr) const {
     if (addr >= 0xA000 && addr <= 0xBFFF) {
         if (!m_ram_enable) return 0xFF;
         // ram bank
-        return m_ram_banks[m_current_ram_bank][addr % 0x2000];
+        return externalRam(m_current_ram_bank, addr % 0x2000);
     }
 
     if (addr >= 0x8000 && addr <= 0x9FFF) {
         // VRAM read
-        uint8_t current_mode = m_memory[0xFF41] & 0x3;
+        uint8_t current_mode = ReadByteDirect(0xFF41) & 0x3;
         if (current_mode > 2) return 0xFF;
-        return m_memory[addr];
+        return ReadByteDirect(addr);
     }
 
     if (addr >= 0xE000 && addr <= 0xFDFF) {
@@ -63,12 +94,21 @@ uint8_t Memory::ReadByte(uint16_t addr) const {
 
     if (addr >= 0xFE00 && addr <= 0xFE9F) {
         // OAM read
-        uint8_t current_mode = m_memory[0xFF41] & 0x3;
+        uint8_t current_mode = ReadByteDirect(0xFF41) & 0x3;
         if (current_mode > 1) return 0xFF;
-        return m_memory[addr];
+        return ReadByteDirect(addr);
     }
 
-    return m_memory[addr];
+    if (addr >= IO_ADDR && addr < IO_ADDR + IO_SIZE && m_io_reads_mapper[addr - IO_ADDR]) {
+        return m_io_reads_mapper[addr - IO_ADDR]();
+    }
+
+    return ReadByteDirect(addr);
+}
+
+void Memory::AddToReadAddressMapper(uint16_t addr, std::function<uint8_t()> callback) {
+    ASSERT(addr >= IO_ADDR && addr < IO_ADDR + IO_SIZE);
+    m_io_reads_mapper[addr - IO_ADDR] = callback;
 }
 
 void Memory::ReadByte(uint16_t addr, void* dest) const {
@@ -77,6 +117,7 @@ void Memory::ReadByte(uint16_t addr, void* dest) const {
 
 void Memory::WriteByte(uint16_t addr, uint8_t byte) {
     LOG_MEM_VERBOSE(printf("MEM: WriteByte | addr: %02x | byte: %01x\n", addr, byte));
+    MEMORY_STATS(if (m_stats) m_stats->OnWrite(addr);)
 
     if (m_writes_address_mapper.count(addr) != 0) {
         m_writes_address_mapper.at(addr)(byte);
@@ -87,7 +128,9 @@ void Memory::WriteByte(uint16_t addr, uint8_t byte) {
 
     if (addr >= 0 && addr <= 0x1FFF) {
         // Write only ram enable
-        m_ram_enable = (byte & 0x0F) == 0x0A && m_ram_banks.size() != 0;
+        const bool ram_enable = (byte & 0x0F) == 0x0A && m_ram_bank_count != 0;
+        MEMORY_STATS(if (m_stats && ram_enable != m_ram_enable) m_stats->OnBankEvent(memory_bank_counter_t::RamEnableChanges);)
+        m_ram_enable = ram_enable;
         return;
     } 
     
@@ -99,17 +142,27 @@ void Memory::WriteByte(uint16_t addr, uint8_t byte) {
             printf("Trying to set current rom bank to a wrong value %u\n", val);
             ASSERT(false);
         }
+        MEMORY_STATS(if (m_stats) {
+            m_stats->OnBankEvent(memory_bank_counter_t::RomBankWrites);
+            if (val != m_current_rom_bank) m_stats->OnBankEvent(memory_bank_counter_t::RomBankSwitches);
+        })
         m_current_rom_bank = val;
         return;
     }
 
     if (addr >= 0x4000 && addr <= 0x5fff) {
         // ram bank selector
+        MEMORY_STATS(const uint8_t ram_bank = m_current_ram_bank;)
+        MEMORY_STATS(const uint8_t rom_bank = m_current_rom_bank;)
         if (m_advanced_banking_mode) {
             m_current_ram_bank = byte & 0b11;
         } else if (m_rom_banks.size() > 32) {
             m_current_rom_bank = m_current_rom_bank | ((byte & 0b11) << 5);
         }
+        MEMORY_STATS(if (m_stats) {
+            if (ram_bank != m_current_ram_bank) m_stats->OnBankEvent(memory_bank_counter_t::RamBankSwitches);
+            if (rom_bank != m_current_rom_bank) m_stats->OnBankEvent(memory_bank_counter_t::RomBankSwitches);
+        })
 
         return;
     }
@@ -117,27 +170,30 @@ void Memory::WriteByte(uint16_t addr, uint8_t byte) {
     if (addr >= 0xA000 && addr <= 0xBFFF) {
         if (!m_ram_enable) return;
         //external ram
-        m_ram_banks[m_current_ram_bank][addr % 0x2000] = byte;
+        externalRam(m_current_ram_bank, addr % 0x2000) = byte;
         return;
     }
 
     if (addr >= 0x6000 && addr <= 0x7FFF) {
         // ROM/RAM selector
-        m_advanced_banking_mode = (byte & 0b1) && m_ram_banks.size() >= 0;
+        m_advanced_banking_mode = (byte & 0b1);
         return;
     }
 
     if (addr == 0xFF04) {
         // reset DIV
-        m_memory[0xFF04] = 0;
+        WriteByteDirect(0xFF04, 0);
         return;
     }
 
     if (addr >= 0x8000 && addr <= 0x9FFF) {
         // VRAM write
-        uint8_t current_mode = m_memory[0xFF41] & 0x3;
+        uint8_t current_mode = ReadByteDirect(0xFF41) & 0x3;
         if (current_mode > 2) return;
-        m_memory[addr] = byte;
+        if (ReadByteDirect(addr) == byte) return;
+        WriteByteDirect(addr, byte);
+        m_vram_dirty_blocks[(addr - 0x8000) >> 4] = true;
+        m_vram_dirty = true;
         return;
     }
 
@@ -150,7 +206,7 @@ void Memory::WriteByte(uint16_t addr, uint8_t byte) {
 
     if (addr == 0xFF46) {
         // oam dma transfer
-        uint8_t current_mode = m_memory[0xFF41] & 0x3;
+        uint8_t current_mode = ReadByteDirect(0xFF41) & 0x3;
         if (current_mode > 1) return;
         for (uint16_t i = 0; i < 0xA0; ++i) {
             WriteByte(0xFE00 + i, ReadByte((byte << 8) + i));
@@ -161,21 +217,38 @@ void Memory::WriteByte(uint16_t addr, uint8_t byte) {
 
     if (addr >= 0xFE00 && addr <= 0xFE9F) {
         // OAM read
-        uint8_t current_mode = m_memory[0xFF41] & 0x3;
+        uint8_t current_mode = ReadByteDirect(0xFF41) & 0x3;
         if (current_mode > 1) return;
-        m_memory[addr] = byte;
+        WriteByteDirect(addr, byte);
         return;
     }
 
-    m_memory[addr] = byte;
+    WriteByteDirect(addr, byte);
+}
+
+bool Memory::EnableStats() {
+#ifdef GB_MEMORY_STATS
+    if (!m_stats) m_stats = std::make_unique<MemoryStats>();
+    return true;
+#else
+    return false;
+#endif
+}
+
+const MemoryStats* Memory::GetStats() const {
+#ifdef GB_MEMORY_STATS
+    return m_stats.get();
+#else
+    return nullptr;
+#endif
 }
 
 uint8_t Memory::ReadByteDirect(uint16_t addr) const {
-    return m_memory[addr];
+    return m_page_data[addr / MEMORY_PAGE_SIZE][addr % MEMORY_PAGE_SIZE];
 }
 
 void Memory::WriteByteDirect(uint16_t addr, uint8_t byte) {
-    m_memory[addr] = byte;
+    *writableAddr(addr) = byte;
 }
 
 void Memory::LoadRom(uint8_t* buffer, size_t size) {
@@ -184,8 +257,8 @@ void Memory::LoadRom(uint8_t* buffer, size_t size) {
     size_t rom_size = (32768) * (1 << buffer[0x0148]);
     uint8_t number_of_rom_banks = (2 << buffer[0x0148]);
    
-    uint8_t number_of_ram_banks = 1 << (buffer[0x0149] - 1);
-    if (buffer[0x0149] < 2) number_of_ram_banks = 0;    
+    uint8_t number_of_ram_banks = 0;
+    if (buffer[0x0149] >= 2) number_of_ram_banks = 1 << (buffer[0x0149] - 1);
 
     m_multicart_rom = number_of_rom_banks > 32 && number_of_ram_banks > 1; 
 
@@ -193,24 +266,113 @@ void Memory::LoadRom(uint8_t* buffer, size_t size) {
         printf("UNSUPPORTED MBC TYPE: %02x\n", rom_type);
     }
 
-    std::memcpy(m_memory, buffer, 0x4000); 
+    for (uint16_t page = 0; page < 0x4000 / MEMORY_PAGE_SIZE; ++page) {
+        loadPage(page, buffer + page * MEMORY_PAGE_SIZE);
+    }
+
+    // banks past the end of a short dump read as zeros
+    auto rom = std::make_shared<std::vector<uint8_t>>(std::max<size_t>(size, number_of_rom_banks * 0x4000));
+    std::memcpy(rom->data(), buffer, size);
+    m_rom = rom;
 
+    m_rom_banks.clear();
     for (uint8_t i = 1;i < number_of_rom_banks; ++i) {
-        uint8_t* bank_mem = new uint8_t[0x4000];
-        std::memcpy(bank_mem, buffer + i * 0x4000, 0x4000); 
-        m_rom_banks.push_back(bank_mem);
+        m_rom_banks.push_back(m_rom->data() + i * 0x4000);
     }
 
-    for (uint8_t i = 0;i < number_of_ram_banks; ++i) {
-        m_ram_banks.push_back(new uint8_t[1 << 13]);
-    }
+    resizePages(number_of_ram_banks);
 
     printf("ROM type: %u ROM banks: %u RAM banks: %u\n", 
             rom_type, number_of_rom_banks, number_of_ram_banks);
 
 }
 
+void Memory::ShareRom(const Memory& other) {
+    ASSERT(m_memory_size == other.m_memory_size);
+    m_rom = other.m_rom;
+    m_rom_banks = other.m_rom_banks;
+    m_multicart_rom = other.m_multicart_rom;
+    resizePages(other.m_ram_bank_count);
+}
+
+void Memory::TakeSnapshot(memory_snapshot_t& snapshot) {
+    snapshot.pages = m_page_refs;
+    std::fill(m_page_owned.begin(), m_page_owned.end(), false);
+    snapshot.banks = {m_current_rom_bank, m_current_ram_bank, m_ram_enable, m_advanced_banking_mode};
+}
+
+void Memory::RestoreSnapshot(const memory_snapshot_t& snapshot) {
+    ASSERT(snapshot.pages.size() == m_page_refs.size());
+    for (size_t page = 0; page < m_page_refs.size(); ++page) {
+        if (m_page_refs[page] == snapshot.pages[page]) continue;
+        setPage(page, snapshot.pages[page]);
+        markVramPageDirty(page);
+    }
+
+    m_current_rom_bank = snapshot.banks.current_rom_bank;
+    m_current_ram_bank = snapshot.banks.current_ram_bank;
+    m_ram_enable = snapshot.banks.ram_enable;
+    m_advanced_banking_mode = snapshot.banks.advanced_banking_mode;
+}
+
+void Memory::SaveState(SaveStateWriter& writer) const {
+    uint8_t* image = writer.ReserveChunk(saveStateChunkId("MEM "), m_memory_size);
+    for (size_t page = 0; page < m_address_page_count; ++page) {
+        std::memcpy(image + page * MEMORY_PAGE_SIZE, m_page_data[page], MEMORY_PAGE_SIZE);
+    }
+
+    const memory_bank_state_t banks = {
+        m_current_rom_bank,
+        m_current_ram_bank,
+        m_ram_enable,
+        m_advanced_banking_mode
+    };
+    writer.AddChunk(saveStateChunkId("MBC "), banks);
+
+    uint8_t* external_ram = writer.ReserveChunk(saveStateChunkId("XRAM"), m_ram_bank_count * RAM_BANK_SIZE);
+    for (size_t page = m_address_page_count; page < m_page_data.size(); ++page) {
+        std::memcpy(external_ram + (page - m_address_page_count) * MEMORY_PAGE_SIZE, m_page_data[page], MEMORY_PAGE_SIZE);
+    }
+}
+
+bool Memory::LoadState(const SaveStateReader& reader) {
+    // everything is validated before anything changes
+    const uint8_t* image = reader.GetChunkData(saveStateChunkId("MEM "), m_memory_size);
+    const uint8_t* external_ram = reader.GetChunkData(saveStateChunkId("XRAM"), m_ram_bank_count * RAM_BANK_SIZE);
+    if (!image || !external_ram) return false;
+
+    memory_bank_state_t banks;
+    if (!reader.ReadChunk(saveStateChunkId("MBC "), banks)) return false;
+    if (banks.current_ram_bank >= std::max<size_t>(m_ram_bank_count, 1)) return false;
+    if (banks.current_rom_bank >= std::max<size_t>(m_rom_banks.size(), 1)) return false;
+
+    // unchanged pages stay shared, only the changed part of vram has to be redrawn
+    for (size_t page = 0; page < m_address_page_count; ++page) {
+        if (loadPage(page, image + page * MEMORY_PAGE_SIZE)) markVramPageDirty(page);
+    }
+    for (size_t page = m_address_page_count; page < m_page_data.size(); ++page) {
+        loadPage(page, external_ram + (page - m_address_page_count) * MEMORY_PAGE_SIZE);
+    }
+
+    m_current_rom_bank = banks.current_rom_bank;
+    m_current_ram_bank = banks.current_ram_bank;
+    m_ram_enable = banks.ram_enable;
+    m_advanced_banking_mode = banks.advanced_banking_mode;
+    return true;
+}
+
 void Memory::CleanMemory() {
-    std::memset(m_memory, 0x00, m_memory_size);
+    for (size_t page = 0; page < m_address_page_count; ++page) setPage(page, zeroPage());
+    MarkVramDirty();
+}
+
+void Memory::ClearVramDirty() {
+    std::memset(m_vram_dirty_blocks, 0x00, sizeof(m_vram_dirty_blocks));
+    m_vram_dirty = false;
+}
+
+void Memory::MarkVramDirty() {
+    std::memset(m_vram_dirty_blocks, 0x01, sizeof(m_vram_dirty_blocks));
+    m_vram_dirty = true;
 }
 
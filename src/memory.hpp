@@ -4,6 +4,10 @@
 #include <vector>
 #include <unordered_map>
 #include <functional>
+#include <array>
+#include <memory>
+#include "save_state.hpp"
+#include "memory_stats.hpp"
 
 /*
 Memory map:
@@ -18,15 +22,39 @@ Memory map:
 0xFF00 - 0xFF4B: I/O
 0xFF80 - 0xFFFE: High RAM
 0xFFFF - Interrupt Register
+
+The address space and the external ram banks are stored in 256 byte pages. Pages can be shared
+between machines (forks, snapshots) and are copied on the first write, so a page is only ever
+written by the one machine that owns it. Rom is shared read only.
 */
 
+struct memory_bank_state_t {
+    uint8_t current_rom_bank;
+    uint8_t current_ram_bank;
+    uint8_t ram_enable;
+    uint8_t advanced_banking_mode;
+};
+
+static constexpr size_t MEMORY_PAGE_SIZE = 0x100;
+
+struct memory_page_t {
+    uint8_t data[MEMORY_PAGE_SIZE];
+};
+
+// every page of a machine at one point in time, the pages stay shared until someone writes to them
+struct memory_snapshot_t {
+    std::vector<std::shared_ptr<memory_page_t>> pages;
+    memory_bank_state_t banks;
+};
+
 class Memory {
 public:
 
     Memory(size_t memory_size);
     ~Memory();
 
-    inline uint8_t* GetBufferLocation() const { return m_memory; }
+    // the bytes from addr to the end of its page, valid until the next write to memory
+    inline const uint8_t* GetPageData(uint16_t addr) const { return m_page_data[addr / MEMORY_PAGE_SIZE] + addr % MEMORY_PAGE_SIZE; }
 
     void ReadByte(uint16_t addr, void* dest) const;
     uint8_t ReadByte(uint16_t addr) const;
@@ -37,22 +65,102 @@ public:
 
     void LoadRom(uint8_t* buffer, size_t size);
 
+    // the cartridge bank mapped at 0x4000 - 0x7FFF, numbered as in the rom file and in symbol files
+    inline unsigned int GetRomBank() const { return m_current_rom_bank + 1u; }
+
     void CleanMemory();
 
+    // takes over the rom and the bank layout of another instance, pages are left alone
+    void ShareRom(const Memory& other);
+
+    // all pages become shared with the snapshot, the next write to each of them copies it
+    void TakeSnapshot(memory_snapshot_t& snapshot);
+
+    // only the pages that differ from the snapshot are touched, needs the same rom
+    void RestoreSnapshot(const memory_snapshot_t& snapshot);
+
+    // the full address space image, bank selection and external ram
+    void SaveState(SaveStateWriter& writer) const;
+    bool LoadState(const SaveStateReader& reader);
+
     void AddToWriteAddressMapper(uint16_t addr, std::function<void(uint8_t)> callback) {
         m_writes_address_mapper[addr] = callback;
     }
 
+    // lets a component produce an I/O register value on demand, only 0xFF00 - 0xFF7F
+    void AddToReadAddressMapper(uint16_t addr, std::function<uint8_t()> callback);
+
+    // counts every guest access from here on, false in builds without GB_MEMORY_STATS
+    bool EnableStats();
+    // null unless enabled
+    const MemoryStats* GetStats() const;
+
+    // the cpu marks the addresses instructions start at
+    inline void CountExecute([[maybe_unused]] uint16_t addr) { MEMORY_STATS(if (m_stats) m_stats->OnExecute(addr);) }
+
+    // VRAM write tracking, one flag per 16 byte block (a single tile or 16 tilemap entries)
+    static constexpr uint16_t VRAM_BLOCK_COUNT = 0x2000 / 16;
+
+    inline bool IsVramDirty() const { return m_vram_dirty; }
+    inline const bool* GetVramDirtyBlocks() const { return m_vram_dirty_blocks; }
+    void ClearVramDirty();
+    void MarkVramDirty();
+
+private:
+    inline uint8_t* writablePage(size_t page) {
+        if (!m_page_owned[page]) copyPage(page);
+        return m_page_data[page];
+    }
+    inline uint8_t* writableAddr(uint16_t addr) { return writablePage(addr / MEMORY_PAGE_SIZE) + addr % MEMORY_PAGE_SIZE; }
+    inline uint8_t& externalRam(uint8_t bank, uint16_t offset) {
+        return writablePage(m_address_page_count + bank * RAM_BANK_PAGES + offset / MEMORY_PAGE_SIZE)[offset % MEMORY_PAGE_SIZE];
+    }
+    inline uint8_t externalRam(uint8_t bank, uint16_t offset) const {
+        return m_page_data[m_address_page_count + bank * RAM_BANK_PAGES + offset / MEMORY_PAGE_SIZE][offset % MEMORY_PAGE_SIZE];
+    }
+
+    void copyPage(size_t page);
+    void setPage(size_t page, const std::shared_ptr<memory_page_t>& ref);
+    void resizePages(size_t ram_bank_count);
+
+    // overwrites a page with data, returns false if nothing changed
+    bool loadPage(size_t page, const uint8_t* data);
+    void markVramPageDirty(size_t page);
+
+    // all pages start out as this one, so untouched memory costs nothing
+    static const std::shared_ptr<memory_page_t>& zeroPage();
+
 private:
-    uint8_t* m_memory = nullptr;
     size_t m_memory_size = 0;
-    std::vector<uint8_t*> m_rom_banks;
-    std::vector<uint8_t*> m_ram_banks;
+    size_t m_address_page_count = 0;
+
+    // address space pages followed by the external ram banks
+    std::vector<std::shared_ptr<memory_page_t>> m_page_refs;
+    std::vector<uint8_t*> m_page_data;
+    std::vector<uint8_t> m_page_owned;
+    size_t m_ram_bank_count = 0;
+
+    std::shared_ptr<const std::vector<uint8_t>> m_rom;
+    std::vector<const uint8_t*> m_rom_banks;
     uint8_t m_current_rom_bank = 0;
     uint8_t m_current_ram_bank = 0;
     bool m_ram_enable = false;
     bool m_advanced_banking_mode = false;
     bool m_multicart_rom = false;
 
+    MEMORY_STATS(std::unique_ptr<MemoryStats> m_stats;)
+
+    bool m_vram_dirty = true;
+    bool m_vram_dirty_blocks[VRAM_BLOCK_COUNT];
+
     std::unordered_map<uint16_t, std::function<void(uint8_t)>> m_writes_address_mapper;
+
+    static constexpr size_t RAM_BANK_SIZE = 0x2000;
+    static constexpr size_t RAM_BANK_PAGES = RAM_BANK_SIZE / MEMORY_PAGE_SIZE;
+    static constexpr uint16_t VRAM_ADDR = 0x8000;
+    static constexpr uint16_t VRAM_SIZE = 0x2000;
+
+    static constexpr uint16_t IO_ADDR = 0xFF00;
+    static constexpr uint16_t IO_SIZE = 0x80;
+    std::array<std::function<uint8_t()>, IO_SIZE> m_io_reads_mapper;
 };
\ No newline at end of file
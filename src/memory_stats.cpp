@@ -0,0 +1,148 @@
+#include "memory_stats.hpp"
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+MemoryStats::MemoryStats() {
+    std::memset(m_reads, 0, sizeof(m_reads));
+    std::memset(m_writes, 0, sizeof(m_writes));
+    std::memset(m_executes, 0, sizeof(m_executes));
+    std::memset(m_bank_counters, 0, sizeof(m_bank_counters));
+}
+
+bool MemoryStats::isIoRegister(uint16_t addr) {
+    return (addr >= 0xFF00 && addr < 0xFF80) || addr == 0xFFFF;
+}
+
+const char* MemoryStats::getIoRegisterName(uint16_t addr) {
+    static const char* const SOUND_NAMES[] = {
+        "NR10", "NR11", "NR12", "NR13", "NR14", "", "NR21", "NR22", "NR23", "NR24",
+        "NR30", "NR31", "NR32", "NR33", "NR34", "", "NR41", "NR42", "NR43", "NR44",
+        "NR50", "NR51", "NR52",
+    };
+    static const char* const LCD_NAMES[] = {
+        "LCDC", "STAT", "SCY", "SCX", "LY", "LYC", "DMA", "BGP", "OBP0", "OBP1", "WY", "WX",
+    };
+
+    if (addr >= 0xFF10 && addr <= 0xFF26) return SOUND_NAMES[addr - 0xFF10];
+    if (addr >= 0xFF30 && addr <= 0xFF3F) return "WAVE";
+    if (addr >= 0xFF40 && addr <= 0xFF4B) return LCD_NAMES[addr - 0xFF40];
+
+    switch (addr) {
+        case 0xFF00: return "P1";
+        case 0xFF01: return "SB";
+        case 0xFF02: return "SC";
+        case 0xFF04: return "DIV";
+        case 0xFF05: return "TIMA";
+        case 0xFF06: return "TMA";
+        case 0xFF07: return "TAC";
+        case 0xFF0F: return "IF";
+        case 0xFF50: return "BOOT";
+        case 0xFFFF: return "IE";
+        default: return "";
+    }
+}
+
+const char* MemoryStats::getBankCounterName(memory_bank_counter_t counter) {
+    switch (counter) {
+        case memory_bank_counter_t::RomBankWrites: return "rom_bank_writes";
+        case memory_bank_counter_t::RomBankSwitches: return "rom_bank_switches";
+        case memory_bank_counter_t::RamBankSwitches: return "ram_bank_switches";
+        case memory_bank_counter_t::RamEnableChanges: return "ram_enable_changes";
+        default: return "";
+    }
+}
+
+bool MemoryStats::WriteToFile(const std::string& path) const {
+    const bool is_csv = path.size() >= 4 && path.compare(path.size() - 4, 4, ".csv") == 0;
+    return is_csv ? writeCsv(path) : writeBinary(path);
+}
+
+bool MemoryStats::writeCsv(const std::string& path) const {
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) {
+        printf("Failed to open %s\n", path.c_str());
+        return false;
+    }
+
+    for (uint8_t i = 0; i < BANK_COUNTER_COUNT; ++i) {
+        fprintf(file, "# %s: %llu\n", getBankCounterName(static_cast<memory_bank_counter_t>(i)),
+                static_cast<unsigned long long>(m_bank_counters[i]));
+    }
+
+    // every region, then the I/O registers and addresses that were touched at all
+    fprintf(file, "kind,address,name,reads,writes,executes\n");
+    for (size_t region = 0; region < ADDRESS_COUNT; region += REGION_SIZE) {
+        uint64_t reads = 0;
+        uint64_t writes = 0;
+        uint64_t executes = 0;
+        for (size_t addr = region; addr < region + REGION_SIZE; ++addr) {
+            reads += m_reads[addr];
+            writes += m_writes[addr];
+            executes += m_executes[addr];
+        }
+        fprintf(file, "region,%04zX,,%llu,%llu,%llu\n", region, static_cast<unsigned long long>(reads),
+                static_cast<unsigned long long>(writes), static_cast<unsigned long long>(executes));
+    }
+
+    for (size_t addr = 0; addr < ADDRESS_COUNT; ++addr) {
+        if (m_reads[addr] == 0 && m_writes[addr] == 0 && m_executes[addr] == 0) continue;
+        const uint16_t address = static_cast<uint16_t>(addr);
+        fprintf(file, "%s,%04zX,%s,%llu,%llu,%llu\n", isIoRegister(address) ? "io" : "address", addr,
+                isIoRegister(address) ? getIoRegisterName(address) : "",
+                static_cast<unsigned long long>(m_reads[addr]), static_cast<unsigned long long>(m_writes[addr]),
+                static_cast<unsigned long long>(m_executes[addr]));
+    }
+
+    const bool ok = ferror(file) == 0;
+    fclose(file);
+    return ok;
+}
+
+bool MemoryStats::writeBinary(const std::string& path) const {
+    FILE* file = fopen(path.c_str(), "wb");
+    if (!file) {
+        printf("Failed to open %s\n", path.c_str());
+        return false;
+    }
+
+    fwrite("GBMS", 1, 4, file);
+    fwrite(&FILE_VERSION, sizeof(FILE_VERSION), 1, file);
+    fwrite(m_bank_counters, sizeof(m_bank_counters), 1, file);
+    fwrite(m_reads, sizeof(m_reads), 1, file);
+    fwrite(m_writes, sizeof(m_writes), 1, file);
+    fwrite(m_executes, sizeof(m_executes), 1, file);
+
+    const bool ok = ferror(file) == 0;
+    fclose(file);
+    return ok;
+}
+
+void MemoryStats::PrintSummary(uint64_t frame_count) const {
+    static constexpr size_t IO_REGISTER_COUNT = 10;
+
+    std::vector<uint16_t> registers;
+    for (size_t addr = 0xFF00; addr < ADDRESS_COUNT; ++addr) {
+        if (isIoRegister(static_cast<uint16_t>(addr)) && m_reads[addr] + m_writes[addr] != 0) {
+            registers.push_back(static_cast<uint16_t>(addr));
+        }
+    }
+    std::sort(registers.begin(), registers.end(), [this] (uint16_t a, uint16_t b) {
+        return m_reads[a] + m_writes[a] > m_reads[b] + m_writes[b];
+    });
+
+    const double frames = std::max<double>(1.0, static_cast<double>(frame_count));
+    printf("Busiest I/O registers, accesses per frame:\n");
+    printf("  %-6s %-5s %12s %12s\n", "addr", "name", "reads", "writes");
+    for (size_t i = 0; i < std::min(IO_REGISTER_COUNT, registers.size()); ++i) {
+        const uint16_t addr = registers[i];
+        printf("  %04X   %-5s %12.1f %12.1f\n", addr, getIoRegisterName(addr), m_reads[addr] / frames, m_writes[addr] / frames);
+    }
+
+    printf("Bank switches per frame: rom %.2f (%.2f writes), ram %.2f, ram enable changes %.2f\n",
+           GetBankCounter(memory_bank_counter_t::RomBankSwitches) / frames,
+           GetBankCounter(memory_bank_counter_t::RomBankWrites) / frames,
+           GetBankCounter(memory_bank_counter_t::RamBankSwitches) / frames,
+           GetBankCounter(memory_bank_counter_t::RamEnableChanges) / frames);
+}
@@ -0,0 +1,73 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+
+/*
+Access counts of the guest's address space, to see which I/O registers are polled hardest and how
+often the banks get switched. Reads and writes are every access that goes through ReadByte and
+WriteByte: opcode and operand fetches, and the cpu's check of IF and IE before every instruction.
+Executes are the addresses instructions start at. Direct accesses (ppu, save states, ...) don't count.
+Only compiled in with GB_MEMORY_STATS (cmake -DGB_MEMORY_STATS=ON), the MEMORY_STATS macro drops the
+counting code otherwise.
+
+The binary dump is the "GBMS" tag, a uint32 version, the BANK_COUNTER_COUNT bank counters and then
+the reads, writes and executes of every address as arrays of 65536 uint64, all little endian.
+*/
+
+#ifdef GB_MEMORY_STATS
+#define MEMORY_STATS(x) x
+#else
+#define MEMORY_STATS(x)
+#endif
+
+enum class memory_bank_counter_t : uint8_t {
+    RomBankWrites = 0,
+    RomBankSwitches,
+    RamBankSwitches,
+    RamEnableChanges,
+    COUNT,
+};
+
+class MemoryStats {
+public:
+    MemoryStats();
+
+    inline void OnRead(uint16_t addr) { m_reads[addr]++; }
+    inline void OnWrite(uint16_t addr) { m_writes[addr]++; }
+    inline void OnExecute(uint16_t addr) { m_executes[addr]++; }
+    inline void OnBankEvent(memory_bank_counter_t counter) { m_bank_counters[static_cast<uint8_t>(counter)]++; }
+
+    inline uint64_t GetBankCounter(memory_bank_counter_t counter) const { return m_bank_counters[static_cast<uint8_t>(counter)]; }
+
+    // csv for a path ending in .csv, the binary layout above otherwise
+    bool WriteToFile(const std::string& path) const;
+
+    // the busiest I/O registers and the bank switches per frame
+    void PrintSummary(uint64_t frame_count) const;
+
+    static constexpr size_t ADDRESS_COUNT = 0x10000;
+    static constexpr size_t REGION_SIZE = 0x100;
+    static constexpr uint8_t BANK_COUNTER_COUNT = static_cast<uint8_t>(memory_bank_counter_t::COUNT);
+    static constexpr uint32_t FILE_VERSION = 1;
+
+#ifdef GB_MEMORY_STATS
+    static constexpr bool IS_ENABLED = true;
+#else
+    static constexpr bool IS_ENABLED = false;
+#endif
+
+private:
+    bool writeCsv(const std::string& path) const;
+    bool writeBinary(const std::string& path) const;
+
+    // 0xFF00 - 0xFF7F and IE, the rest is plain memory
+    static bool isIoRegister(uint16_t addr);
+    static const char* getIoRegisterName(uint16_t addr);
+    static const char* getBankCounterName(memory_bank_counter_t counter);
+
+    uint64_t m_reads[ADDRESS_COUNT];
+    uint64_t m_writes[ADDRESS_COUNT];
+    uint64_t m_executes[ADDRESS_COUNT];
+    uint64_t m_bank_counters[BANK_COUNTER_COUNT];
+};
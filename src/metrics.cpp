@@ -0,0 +1,113 @@
+#include "metrics.hpp"
+#include <algorithm>
+#include <bit>
+#include <cmath>
+
+Histogram::Histogram() {
+    Reset();
+}
+
+unsigned int Histogram::getBucketIndex(uint64_t value) {
+    if (value < SUB_BUCKET_COUNT) return static_cast<unsigned int>(value);
+
+    // the top SUB_BUCKET_BITS + 1 bits pick the bucket, the leading one picks the row
+    const unsigned int shift = std::bit_width(value) - 1 - SUB_BUCKET_BITS;
+    return (shift + 1) * SUB_BUCKET_COUNT + static_cast<unsigned int>(value >> shift) - SUB_BUCKET_COUNT;
+}
+
+uint64_t Histogram::getBucketStart(unsigned int index) {
+    if (index < SUB_BUCKET_COUNT) return index;
+
+    const unsigned int shift = index / SUB_BUCKET_COUNT - 1;
+    return static_cast<uint64_t>(SUB_BUCKET_COUNT + index % SUB_BUCKET_COUNT) << shift;
+}
+
+void Histogram::Record(uint64_t value) {
+    value = std::min(value, MAX_VALUE);
+    m_buckets[getBucketIndex(value)]++;
+
+    if (m_count == 0 || value < m_min) m_min = value;
+    if (value > m_max) m_max = value;
+    m_count++;
+    m_sum += value;
+}
+
+uint64_t Histogram::GetPercentile(double fraction) const {
+    if (m_count == 0) return 0;
+
+    const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(std::clamp(fraction, 0.0, 1.0) * m_count)));
+    uint64_t seen = 0;
+    for (unsigned int i = 0; i < BUCKET_COUNT; ++i) {
+        seen += m_buckets[i];
+        if (seen < rank) continue;
+
+        // the middle of the bucket, the exact value isn't kept
+        const uint64_t start = getBucketStart(i);
+        const uint64_t end = i + 1 < BUCKET_COUNT ? getBucketStart(i + 1) : MAX_VALUE + 1;
+        return std::clamp(start + (end - start - 1) / 2, m_min, m_max);
+    }
+    return m_max;
+}
+
+void Histogram::Reset() {
+    std::fill(std::begin(m_buckets), std::end(m_buckets), 0);
+    m_count = 0;
+    m_sum = 0;
+    m_min = 0;
+    m_max = 0;
+}
+
+template <typename T>
+T& MetricsRegistry::findOrAdd(std::deque<named_metric_t<T>>& metrics, const std::string& name) {
+    for (named_metric_t<T>& named : metrics) {
+        if (named.name == name) return named.metric;
+    }
+
+    // atomics can't be moved, so the entry is built in place
+    metrics.emplace_back();
+    metrics.back().name = name;
+    return metrics.back().metric;
+}
+
+Counter& MetricsRegistry::GetCounter(const std::string& name) {
+    return findOrAdd(m_counters, name);
+}
+
+Gauge& MetricsRegistry::GetGauge(const std::string& name) {
+    return findOrAdd(m_gauges, name);
+}
+
+Histogram& MetricsRegistry::GetHistogram(const std::string& name) {
+    return findOrAdd(m_histograms, name);
+}
+
+void MetricsRegistry::WriteJsonLine(FILE* file, double uptime_seconds) {
+    fprintf(file, "{\"uptime\": %.3f, \"counters\": {", uptime_seconds);
+    for (size_t i = 0; i < m_counters.size(); ++i) {
+        fprintf(file, "%s\"%s\": %llu", i == 0 ? "" : ", ", m_counters[i].name.c_str(),
+                static_cast<unsigned long long>(m_counters[i].metric.Get()));
+    }
+
+    fprintf(file, "}, \"gauges\": {");
+    for (size_t i = 0; i < m_gauges.size(); ++i) {
+        fprintf(file, "%s\"%s\": %.6g", i == 0 ? "" : ", ", m_gauges[i].name.c_str(), m_gauges[i].metric.Get());
+    }
+
+    fprintf(file, "}, \"histograms\": {");
+    for (size_t i = 0; i < m_histograms.size(); ++i) {
+        Histogram& histogram = m_histograms[i].metric;
+        fprintf(file, "%s\"%s\": {\"count\": %llu, \"min\": %llu, \"mean\": %.6g, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"max\": %llu}",
+                i == 0 ? "" : ", ", m_histograms[i].name.c_str(),
+                static_cast<unsigned long long>(histogram.GetCount()),
+                static_cast<unsigned long long>(histogram.GetMin()),
+                histogram.GetMean(),
+                static_cast<unsigned long long>(histogram.GetPercentile(0.5)),
+                static_cast<unsigned long long>(histogram.GetPercentile(0.9)),
+                static_cast<unsigned long long>(histogram.GetPercentile(0.99)),
+                static_cast<unsigned long long>(histogram.GetMax()));
+        histogram.Reset();
+    }
+
+    fprintf(file, "}}\n");
+    fflush(file);
+}
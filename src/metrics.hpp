@@ -0,0 +1,95 @@
+#pragma once
+#include <stdint.h>
+#include <stdio.h>
+#include <atomic>
+#include <deque>
+#include <string>
+
+/*
+Named counters, gauges and histograms that get written out together as one JSON object per line.
+Counters and gauges are atomic and can be updated from any thread. A histogram belongs to a single
+thread, the one that records into it has to be the one that writes the registry out.
+Histograms keep log-linear buckets in the style of HdrHistogram: every power of two is split into
+SUB_BUCKET_COUNT linear buckets, so any percentile is within about 3% of the recorded value while
+recording stays a couple of shifts and an increment.
+*/
+
+class Counter {
+public:
+    inline void Add(uint64_t value = 1) { m_value.fetch_add(value, std::memory_order_relaxed); }
+    inline uint64_t Get() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<uint64_t> m_value = 0;
+};
+
+class Gauge {
+public:
+    inline void Set(double value) { m_value.store(value, std::memory_order_relaxed); }
+    inline double Get() const { return m_value.load(std::memory_order_relaxed); }
+
+private:
+    std::atomic<double> m_value = 0.0;
+};
+
+class Histogram {
+public:
+    Histogram();
+
+    // values above MAX_VALUE are counted as MAX_VALUE
+    void Record(uint64_t value);
+
+    inline uint64_t GetCount() const { return m_count; }
+    inline uint64_t GetMin() const { return m_count != 0 ? m_min : 0; }
+    inline uint64_t GetMax() const { return m_max; }
+    inline double GetMean() const { return m_count != 0 ? static_cast<double>(m_sum) / m_count : 0.0; }
+
+    // the value below which the given fraction of the recorded values lie
+    uint64_t GetPercentile(double fraction) const;
+
+    void Reset();
+
+    static constexpr uint64_t MAX_VALUE = (uint64_t(1) << 40) - 1;
+
+private:
+    static unsigned int getBucketIndex(uint64_t value);
+    static uint64_t getBucketStart(unsigned int index);
+
+    static constexpr unsigned int SUB_BUCKET_BITS = 5;
+    static constexpr unsigned int SUB_BUCKET_COUNT = 1 << SUB_BUCKET_BITS;
+    // values below SUB_BUCKET_COUNT get a bucket each, then one row per power of two up to MAX_VALUE
+    static constexpr unsigned int BUCKET_COUNT = (40 - SUB_BUCKET_BITS + 1) * SUB_BUCKET_COUNT;
+
+    uint32_t m_buckets[BUCKET_COUNT];
+    uint64_t m_count = 0;
+    uint64_t m_sum = 0;
+    uint64_t m_min = 0;
+    uint64_t m_max = 0;
+};
+
+class MetricsRegistry {
+public:
+    // creates the metric on first use, the reference stays valid for the lifetime of the registry;
+    // look them up once, not on every update
+    Counter& GetCounter(const std::string& name);
+    Gauge& GetGauge(const std::string& name);
+    Histogram& GetHistogram(const std::string& name);
+
+    // one line of JSON with every metric, histograms start over afterwards so each line covers the
+    // time since the previous one
+    void WriteJsonLine(FILE* file, double uptime_seconds);
+
+private:
+    template <typename T>
+    struct named_metric_t {
+        std::string name;
+        T metric;
+    };
+
+    template <typename T>
+    static T& findOrAdd(std::deque<named_metric_t<T>>& metrics, const std::string& name);
+
+    std::deque<named_metric_t<Counter>> m_counters;
+    std::deque<named_metric_t<Gauge>> m_gauges;
+    std::deque<named_metric_t<Histogram>> m_histograms;
+};
@@ -0,0 +1,281 @@
+#include "movie.hpp"
+#include "trace.hpp"
+#include "lz_codec.hpp"
+#include "common.hpp"
+#include <fstream>
+#include <cstring>
+#include <cstdio>
+
+static constexpr uint32_t MOVIE_MAGIC = 0x564D4247; // "GBMV"
+
+static constexpr uint64_t FNV_OFFSET_BASIS = 0xcbf29ce484222325ULL;
+static constexpr uint64_t FNV_PRIME = 0x100000001b3ULL;
+
+static void writeVarint(std::vector<uint8_t>& out, uint32_t value) {
+    while (value >= 0x80) {
+        out.push_back(static_cast<uint8_t>(value) | 0x80);
+        value >>= 7;
+    }
+    out.push_back(static_cast<uint8_t>(value));
+}
+
+static bool readVarint(const uint8_t*& in, const uint8_t* end, uint32_t& value) {
+    value = 0;
+    for (unsigned int shift = 0; shift < 35; shift += 7) {
+        if (in == end) return false;
+        const uint8_t byte = *in++;
+        value |= static_cast<uint32_t>(byte & 0x7F) << shift;
+        if ((byte & 0x80) == 0) return true;
+    }
+    return false;
+}
+
+Movie::Movie(Emulator* emulator_ref): m_emulator{emulator_ref} {
+    ASSERT(m_emulator);
+    m_emulator->SetInputCallback([this] (const joypad_event_t& event) { onInput(event); });
+}
+
+Movie::~Movie() {
+    m_emulator->SetInputCallback(nullptr);
+}
+
+void Movie::StartRecording(bool from_power_on) {
+    m_events.clear();
+    m_checkpoints.clear();
+    m_start_state.clear();
+    m_rom_info = m_emulator->GetRomInfo();
+
+    if (!from_power_on || m_emulator->GetCurrentCycle() != 0) {
+        m_emulator->SaveState(m_start_state);
+    }
+
+    m_mode = movie_mode_t::Recording;
+    m_finished = false;
+    m_frame = 0;
+    m_frame_count = 0;
+    m_frame_start_cycle = m_emulator->GetCurrentCycle();
+    m_checkpoints.push_back({0, 0, currentStateHash()});
+}
+
+bool Movie::StartPlayback() {
+    const emulator_state_t rom_info = m_emulator->GetRomInfo();
+    if (std::memcmp(&rom_info, &m_rom_info, sizeof(rom_info)) != 0) {
+        printf("Movie was recorded with a different rom\n");
+        return false;
+    }
+
+    if (m_start_state.empty()) {
+        if (m_emulator->GetCurrentCycle() != 0) {
+            printf("Movie starts from power-on, the machine has already run\n");
+            return false;
+        }
+    } else if (!m_emulator->LoadState(m_start_state)) {
+        printf("Failed to load the movie start state\n");
+        return false;
+    }
+
+    m_emulator->ClearScheduledInput();
+    m_mode = movie_mode_t::Playing;
+    m_finished = false;
+    m_frame = 0;
+    m_frame_start_cycle = m_emulator->GetCurrentCycle();
+    m_next_event = 0;
+    m_next_checkpoint = 0;
+    m_checked_count = 0;
+    m_desync_count = 0;
+
+    // the start state has to match as well, which also catches a power-on that doesn't
+    if (!m_checkpoints.empty() && m_checkpoints.front().frame == 0) {
+        m_next_checkpoint = 1;
+        m_checked_count++;
+        if (currentStateHash() != m_checkpoints.front().state_hash) {
+            printf("Movie desync at the start\n");
+            m_desync_count++;
+        }
+    }
+
+    scheduleFrameInput();
+    return true;
+}
+
+void Movie::OnFrame() {
+    TRACE_SCOPE("Movie::OnFrame");
+    if (m_mode == movie_mode_t::Idle) return;
+
+    m_frame++;
+    m_frame_start_cycle = m_emulator->GetCurrentCycle();
+
+    if (m_mode == movie_mode_t::Recording) {
+        m_frame_count = m_frame;
+        if (m_frame % CHECKPOINT_INTERVAL == 0) m_checkpoints.push_back({m_frame, 0, currentStateHash()});
+        return;
+    }
+
+    if (m_next_checkpoint < m_checkpoints.size() && m_checkpoints[m_next_checkpoint].frame == m_frame) {
+        m_checked_count++;
+        if (currentStateHash() != m_checkpoints[m_next_checkpoint].state_hash) {
+            if (m_desync_count == 0) printf("Movie desync at frame %u\n", m_frame);
+            m_desync_count++;
+        }
+        m_next_checkpoint++;
+    }
+
+    if (m_frame >= m_frame_count) {
+        m_finished = true;
+        Stop();
+        return;
+    }
+
+    scheduleFrameInput();
+}
+
+void Movie::Stop() {
+    if (m_mode == movie_mode_t::Playing) m_emulator->ClearScheduledInput();
+    m_mode = movie_mode_t::Idle;
+}
+
+void Movie::onInput(const joypad_event_t& event) {
+    if (m_mode != movie_mode_t::Recording) return;
+    m_events.push_back({m_frame, static_cast<uint32_t>(event.cycle - m_frame_start_cycle), event.button, event.pressed});
+}
+
+void Movie::scheduleFrameInput() {
+    while (m_next_event < m_events.size() && m_events[m_next_event].frame <= m_frame) {
+        const movie_event_t& event = m_events[m_next_event++];
+        m_emulator->ScheduleInput({m_frame_start_cycle + event.cycle, event.button, event.pressed});
+    }
+}
+
+uint64_t Movie::currentStateHash() {
+    m_emulator->SaveState(m_state_buffer);
+    return HashState(m_state_buffer);
+}
+
+uint64_t Movie::HashState(const std::vector<uint8_t>& state) {
+    static constexpr uint32_t HASHED_CHUNKS[] = {
+        saveStateChunkId("MEM "), saveStateChunkId("MBC "), saveStateChunkId("XRAM"), saveStateChunkId("CPU "),
+        saveStateChunkId("PPU "), saveStateChunkId("TIMR"), saveStateChunkId("JOYP"),
+    };
+
+    // without audio NR52 and the sweep's period only reach memory when the game reads them,
+    // so the sound registers differ between the modes until then
+    static constexpr size_t SOUND_REGISTERS_BEGIN = 0xFF10;
+    static constexpr size_t SOUND_REGISTERS_END = 0xFF27;
+
+    SaveStateReader reader(state.data(), state.size());
+    uint64_t hash = FNV_OFFSET_BASIS;
+    for (uint32_t id : HASHED_CHUNKS) {
+        const size_t size = reader.GetChunkSize(id);
+        const uint8_t* data = reader.GetChunkData(id, size);
+        const bool is_memory = id == saveStateChunkId("MEM ");
+        for (size_t i = 0; data && i < size; ++i) {
+            if (is_memory && i >= SOUND_REGISTERS_BEGIN && i < SOUND_REGISTERS_END) continue;
+            hash ^= data[i];
+            hash *= FNV_PRIME;
+        }
+    }
+    return hash;
+}
+
+bool Movie::SaveToFile(const std::string& path) const {
+    std::vector<uint8_t> events;
+    uint32_t last_frame = 0;
+    for (const movie_event_t& event : m_events) {
+        writeVarint(events, event.frame - last_frame);
+        writeVarint(events, event.cycle);
+        events.push_back(event.button | (event.pressed ? 0x08 : 0x00));
+        last_frame = event.frame;
+    }
+
+    std::vector<uint8_t> compressed_state;
+    if (!m_start_state.empty()) LzCompress(m_start_state.data(), m_start_state.size(), compressed_state);
+
+    movie_header_t header = {};
+    header.magic = MOVIE_MAGIC;
+    header.version = MOVIE_VERSION;
+    header.rom = m_rom_info;
+    header.frame_count = m_frame_count;
+    header.event_count = static_cast<uint32_t>(m_events.size());
+    header.event_bytes = static_cast<uint32_t>(events.size());
+    header.checkpoint_count = static_cast<uint32_t>(m_checkpoints.size());
+    header.checkpoint_interval = CHECKPOINT_INTERVAL;
+    header.start_state_size = static_cast<uint32_t>(m_start_state.size());
+    header.compressed_state_size = static_cast<uint32_t>(compressed_state.size());
+
+    std::ofstream file(path, std::ios::binary);
+    file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    file.write(reinterpret_cast<const char*>(events.data()), events.size());
+    file.write(reinterpret_cast<const char*>(m_checkpoints.data()), m_checkpoints.size() * sizeof(movie_checkpoint_t));
+    file.write(reinterpret_cast<const char*>(compressed_state.data()), compressed_state.size());
+    if (!file) {
+        printf("Failed to write movie: %s\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool Movie::LoadFromFile(const std::string& path) {
+    std::ifstream file(path, std::ios::binary | std::ios::ate);
+    const std::streamsize size = file.tellg();
+    if (size <= 0) {
+        printf("Failed to open movie: %s\n", path.c_str());
+        return false;
+    }
+
+    std::vector<uint8_t> data(size);
+    file.seekg(0, std::ios::beg);
+    if (!file.read(reinterpret_cast<char*>(data.data()), size)) {
+        printf("Failed to read movie: %s\n", path.c_str());
+        return false;
+    }
+
+    movie_header_t header;
+    if (data.size() < sizeof(header)) return false;
+    std::memcpy(&header, data.data(), sizeof(header));
+
+    const size_t checkpoint_bytes = static_cast<size_t>(header.checkpoint_count) * sizeof(movie_checkpoint_t);
+    const size_t expected_size = sizeof(header) + header.event_bytes + checkpoint_bytes + header.compressed_state_size;
+    if (header.magic != MOVIE_MAGIC || header.version != MOVIE_VERSION || data.size() != expected_size ||
+        (header.start_state_size == 0) != (header.compressed_state_size == 0)) {
+        printf("Not a valid movie: %s\n", path.c_str());
+        return false;
+    }
+
+    const uint8_t* in = data.data() + sizeof(header);
+    const uint8_t* const events_end = in + header.event_bytes;
+
+    std::vector<movie_event_t> events;
+    uint32_t frame = 0;
+    for (uint32_t i = 0; i < header.event_count; ++i) {
+        uint32_t frame_delta, cycle;
+        if (!readVarint(in, events_end, frame_delta) || !readVarint(in, events_end, cycle) || in == events_end) {
+            printf("Corrupted movie events: %s\n", path.c_str());
+            return false;
+        }
+        const uint8_t button = *in++;
+        frame += frame_delta;
+        events.push_back({frame, cycle, static_cast<uint8_t>(button & 0x07), (button & 0x08) != 0});
+    }
+    if (in != events_end) {
+        printf("Corrupted movie events: %s\n", path.c_str());
+        return false;
+    }
+
+    std::vector<movie_checkpoint_t> checkpoints(header.checkpoint_count);
+    std::memcpy(checkpoints.data(), in, checkpoint_bytes);
+    in += checkpoint_bytes;
+
+    std::vector<uint8_t> start_state(header.start_state_size);
+    if (!start_state.empty() && !LzDecompress(in, header.compressed_state_size, start_state.data(), start_state.size())) {
+        printf("Corrupted movie start state: %s\n", path.c_str());
+        return false;
+    }
+
+    Stop();
+    m_rom_info = header.rom;
+    m_frame_count = header.frame_count;
+    m_events = std::move(events);
+    m_checkpoints = std::move(checkpoints);
+    m_start_state = std::move(start_state);
+    return true;
+}
@@ -0,0 +1,114 @@
+#pragma once
+#include "emulator.hpp"
+#include <stdint.h>
+#include <string>
+#include <vector>
+
+/*
+Input movies: every button change that reaches the joypad, keyed by the frame it happened in
+and the cycle since the start of that frame. Replaying feeds the changes back at exactly the same
+cycles, so a movie reproduces a session bit for bit from power-on or from an embedded save state.
+Hashes of the machine state are recorded at regular checkpoints and compared during replay to
+catch desyncs. All calls belong on the emulation thread, between frames.
+
+File layout, little endian: movie_header_t, the events as varints (frame delta, cycle, button
+with the pressed flag in bit 3), the checkpoints, then the LZ compressed start state if any.
+*/
+
+struct movie_header_t {
+    uint32_t magic;
+    uint32_t version;
+    emulator_state_t rom;
+    uint32_t frame_count;
+    uint32_t event_count;
+    uint32_t event_bytes;
+    uint32_t checkpoint_count;
+    uint32_t checkpoint_interval;
+    uint32_t start_state_size; // 0 when the movie starts from power-on
+    uint32_t compressed_state_size;
+    uint32_t padding;
+};
+
+struct movie_event_t {
+    uint32_t frame;
+    uint32_t cycle; // m-cycles since the start of the frame
+    uint8_t button;
+    bool pressed;
+};
+
+struct movie_checkpoint_t {
+    uint32_t frame;
+    uint32_t padding;
+    uint64_t state_hash;
+};
+
+enum class movie_mode_t {
+    Idle,
+    Recording,
+    Playing,
+};
+
+class Movie {
+public:
+    Movie(Emulator* emulator_ref);
+    ~Movie();
+
+    // from power-on expects a machine that hasn't run yet, otherwise the current state is embedded
+    void StartRecording(bool from_power_on);
+
+    // restores the start state and feeds the recorded input from there
+    bool StartPlayback();
+
+    // call once per emulated frame
+    void OnFrame();
+
+    // ends recording or playback, live input takes over again
+    void Stop();
+
+    bool SaveToFile(const std::string& path) const;
+    bool LoadFromFile(const std::string& path);
+
+    inline movie_mode_t GetMode() const { return m_mode; }
+    inline bool IsRecording() const { return m_mode == movie_mode_t::Recording; }
+    inline bool IsPlaying() const { return m_mode == movie_mode_t::Playing; }
+
+    // playback went through all recorded frames
+    inline bool IsFinished() const { return m_finished; }
+
+    inline uint32_t GetFrame() const { return m_frame; }
+    inline uint32_t GetFrameCount() const { return m_frame_count; }
+    inline size_t GetEventCount() const { return m_events.size(); }
+    inline unsigned int GetCheckedCount() const { return m_checked_count; }
+    inline unsigned int GetDesyncCount() const { return m_desync_count; }
+
+    // hash of everything the game can observe, audio mode specific state (apu, scheduler, sound
+    // registers) is left out
+    static uint64_t HashState(const std::vector<uint8_t>& state);
+
+    static constexpr uint32_t MOVIE_VERSION = 1;
+    static constexpr uint32_t CHECKPOINT_INTERVAL = 60;
+
+private:
+    void onInput(const joypad_event_t& event);
+    void scheduleFrameInput();
+    uint64_t currentStateHash();
+
+private:
+    Emulator* m_emulator = nullptr;
+    movie_mode_t m_mode = movie_mode_t::Idle;
+    bool m_finished = false;
+
+    emulator_state_t m_rom_info = {};
+    std::vector<movie_event_t> m_events;
+    std::vector<movie_checkpoint_t> m_checkpoints;
+    std::vector<uint8_t> m_start_state;
+    uint32_t m_frame_count = 0;
+
+    uint32_t m_frame = 0;
+    uint64_t m_frame_start_cycle = 0;
+    size_t m_next_event = 0;
+    size_t m_next_checkpoint = 0;
+    unsigned int m_checked_count = 0;
+    unsigned int m_desync_count = 0;
+    std::vector<uint8_t> m_state_buffer;
+};
@@ -0,0 +1,70 @@
+#include "pacer.hpp"
+#include "trace.hpp"
+#include <thread>
+#include <algorithm>
+
+Pacer::Pacer() {
+    m_run_start = clock_t::now();
+    m_window_start = m_run_start;
+}
+
+void Pacer::SetSpeed(float multiplier) {
+    m_speed.store(multiplier <= 0.0f ? 0.0f : std::max(multiplier, MIN_SPEED), std::memory_order_relaxed);
+}
+
+void Pacer::FrameDone(bool wait) {
+    TRACE_SCOPE("Pacer::FrameDone");
+    const clock_t::time_point now = clock_t::now();
+
+    m_total_frames++;
+    m_window_frames++;
+    if (now - m_window_start >= SPEED_WINDOW) {
+        const double elapsed = std::chrono::duration<double>(now - m_window_start).count();
+        m_achieved_speed.store(static_cast<float>(m_window_frames / elapsed / FRAME_RATE), std::memory_order_relaxed);
+        m_window_start = now;
+        m_window_frames = 0;
+    }
+
+    const float speed = GetEffectiveSpeed();
+    if (!wait || speed == 0.0f) {
+        m_pacing = false;
+        return;
+    }
+
+    const auto period = std::chrono::duration_cast<clock_t::duration>(
+        std::chrono::duration<double>(1.0 / (FRAME_RATE * speed)));
+
+    // start over after a speed change or a stretch without pacing
+    if (!m_pacing || speed != m_paced_speed) {
+        m_pacing = true;
+        m_paced_speed = speed;
+        m_next_frame_time = now;
+    }
+
+    m_next_frame_time += period;
+    if (now - m_next_frame_time > period * MAX_LAG_FRAMES) {
+        m_next_frame_time = now;
+        return;
+    }
+
+    waitUntil(m_next_frame_time);
+}
+
+void Pacer::waitUntil(clock_t::time_point deadline) const {
+    while (true) {
+        const clock_t::duration remaining = deadline - clock_t::now();
+        if (remaining <= clock_t::duration::zero()) return;
+
+        if (remaining > SPIN_THRESHOLD) {
+            std::this_thread::sleep_for(remaining - SPIN_THRESHOLD);
+        } else {
+            std::this_thread::yield();
+        }
+    }
+}
+
+float Pacer::GetAverageSpeed() const {
+    const double elapsed = std::chrono::duration<double>(clock_t::now() - m_run_start).count();
+    if (elapsed <= 0.0) return 0.0f;
+    return static_cast<float>(m_total_frames / elapsed / FRAME_RATE);
+}
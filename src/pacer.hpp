@@ -0,0 +1,65 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+#include <chrono>
+
+/*
+Wall-clock frame pacing against a monotonic clock.
+Most of the wait is slept away, the last stretch before the deadline is spun on so the
+scheduler's wakeup granularity doesn't turn into frame jitter. Deadlines advance by a fixed
+period, so an occasional late frame is caught up instead of drifting, while falling behind by
+more than a few frames starts over from the current time.
+*/
+
+class Pacer {
+public:
+    Pacer();
+
+    // multiple of the real hardware speed, 0 runs unlimited; safe to call from any thread
+    void SetSpeed(float multiplier);
+    inline float GetSpeed() const { return m_speed.load(std::memory_order_relaxed); }
+
+    // while held the speed is unlimited
+    inline void SetFastForward(bool val) { m_fast_forward.store(val, std::memory_order_relaxed); }
+    inline bool IsFastForward() const { return m_fast_forward.load(std::memory_order_relaxed); }
+
+    // the speed currently in effect, 0 when unlimited
+    inline float GetEffectiveSpeed() const { return IsFastForward() ? 0.0f : GetSpeed(); }
+
+    // call once per emulated frame, blocks until the next one is due when wait is set
+    void FrameDone(bool wait);
+
+    // emulated frames relative to the real hardware, measured over roughly the last second
+    inline float GetAchievedSpeed() const { return m_achieved_speed.load(std::memory_order_relaxed); }
+    // over the whole run
+    float GetAverageSpeed() const;
+
+    // 4194304Hz / 70224 dots per frame
+    static constexpr double FRAME_RATE = 59.7275;
+
+    static constexpr float MIN_SPEED = 0.25f;
+
+private:
+    using clock_t = std::chrono::steady_clock;
+
+    void waitUntil(clock_t::time_point deadline) const;
+
+private:
+    std::atomic<float> m_speed = 1.0f;
+    std::atomic<bool> m_fast_forward = false;
+    std::atomic<float> m_achieved_speed = 0.0f;
+
+    float m_paced_speed = 0.0f;
+    bool m_pacing = false;
+    clock_t::time_point m_next_frame_time;
+
+    clock_t::time_point m_run_start;
+    uint64_t m_total_frames = 0;
+    clock_t::time_point m_window_start;
+    unsigned int m_window_frames = 0;
+
+    // below this much time left the waiting thread spins instead of sleeping
+    static constexpr std::chrono::microseconds SPIN_THRESHOLD{1500};
+    static constexpr std::chrono::milliseconds SPEED_WINDOW{1000};
+    static constexpr unsigned int MAX_LAG_FRAMES = 4;
+};
@@ -1,13 +1,21 @@
 #include "ppu.hpp"
+#include "trace.hpp"
 #include "common.hpp"
 #include <memory>
 #include <stdexcept>
+#include <cstring>
+#include <algorithm>
 
 Ppu::Ppu(Memory *mem_ref, std::vector<uint8_t>& frame_buffer_ref, std::function<void()> frame_ready_callback)
 :m_memory{mem_ref}, m_framebuffer{frame_buffer_ref} {
     m_frame_ready_callback = frame_ready_callback;
 }
 
+void Ppu::SetRenderingEnabled(bool val) {
+    ASSERT(!val || m_framebuffer.size() == SCREEN_WIDTH * SCREEN_HEIGHT * 3);
+    m_rendering_enabled = val;
+}
+
 Ppu::~Ppu() {}
 
 void Ppu::oamScan(uint8_t scanline, OAM_t* oam_buffer, uint8_t& oam_buffer_index, uint16_t& oam_ptr) {
@@ -39,6 +47,7 @@ void Ppu::oamScan(uint8_t scanline, OAM_t* oam_buffer, uint8_t& oam_buffer_index
 }
 
 void Ppu::renderObjectLine(uint8_t scanline, OAM_t* oam_buffer, uint8_t buffer_size) {
+    TRACE_SCOPE("Ppu::renderObjectLine");
     ASSERT(scanline < SCREEN_HEIGHT);
 
     const uint8_t lcdc = m_memory->ReadByteDirect(LCDC_ADDR);
@@ -92,6 +101,114 @@ void Ppu::renderObjectLine(uint8_t scanline, OAM_t* oam_buffer, uint8_t buffer_s
 }
 
 void Ppu::renderBackgroundLine(uint8_t scanline) {
+    TRACE_SCOPE("Ppu::renderBackgroundLine");
+    if (m_background_cache_enabled) {
+        renderBackgroundLineCached(scanline);
+    } else {
+        renderBackgroundLinePerPixel(scanline);
+    }
+}
+
+void Ppu::renderTileToCache(uint8_t tilemap, uint16_t entry, uint16_t tile_offset) {
+    const uint8_t* tile = m_memory->GetPageData(VRAM_ADDR + tile_offset);
+    uint8_t* dest = m_background_layers.data() + tilemap * WINDOW_WIDTH * WINDOW_HEIGHT +
+                    (entry >> 5) * 8 * WINDOW_WIDTH + (entry & 0x1F) * 8;
+
+    for (uint8_t row = 0; row < 8; ++row) {
+        const uint8_t first_tile_byte = tile[2 * row];
+        const uint8_t second_tile_byte = tile[2 * row + 1];
+        for (uint8_t pixel_x = 0; pixel_x < 8; ++pixel_x) {
+            const uint8_t bit_number = 7 - pixel_x;
+            dest[pixel_x] = (static_cast<uint8_t>(bitGet(first_tile_byte, bit_number))) |
+                            (static_cast<uint8_t>(bitGet(second_tile_byte, bit_number)) << 1);
+        }
+        dest += WINDOW_WIDTH;
+    }
+}
+
+void Ppu::updateBackgroundCache(bool unsigned_addressing) {
+    const bool full_rebuild = !m_background_cache_valid ||
+                              m_background_cache_unsigned_addressing != unsigned_addressing;
+
+    if (!full_rebuild && !m_memory->IsVramDirty()) return;
+
+    // allocated on first use, machines that never render don't pay for it
+    if (m_background_layers.empty()) m_background_layers.resize(2 * WINDOW_WIDTH * WINDOW_HEIGHT);
+
+    const bool* dirty_blocks = m_memory->GetVramDirtyBlocks();
+
+    for (uint8_t tilemap = 0; tilemap < 2; ++tilemap) {
+        const uint16_t tilemap_offset = (tilemap ? TILEMAP_1_ADDR : TILEMAP_0_ADDR) - VRAM_ADDR;
+
+        for (uint16_t entry = 0; entry < TILEMAP_SIZE; ++entry) {
+            const uint8_t tile_index = m_memory->ReadByteDirect(VRAM_ADDR + tilemap_offset + entry);
+
+            uint16_t tile_offset = 0;
+            if (unsigned_addressing) {
+                tile_offset = 16 * tile_index;
+            } else {
+                tile_offset = 0x1000 + 16 * (int8_t)tile_index;
+            }
+
+            // a cached tile is stale when either its tilemap entry or its tile data was written
+            if (full_rebuild || dirty_blocks[(tilemap_offset + entry) >> 4] ||
+                dirty_blocks[tile_offset >> 4]) {
+                renderTileToCache(tilemap, entry, tile_offset);
+            }
+        }
+    }
+
+    m_memory->ClearVramDirty();
+    m_background_cache_valid = true;
+    m_background_cache_unsigned_addressing = unsigned_addressing;
+}
+
+void Ppu::renderBackgroundLineCached(uint8_t scanline) {
+
+    if (scanline >= SCREEN_HEIGHT) {
+        throw std::runtime_error("Out of range rendering!");
+    }
+
+    const uint8_t LCDC = m_memory->ReadByteDirect(LCDC_ADDR);
+    updateBackgroundCache(bitGet(LCDC, 4));
+
+    const uint8_t scx = m_memory->ReadByteDirect(SCX_ADDR);
+    const uint8_t scy = m_memory->ReadByteDirect(SCY_ADDR);
+    const uint8_t wx = m_memory->ReadByteDirect(WX_ADDR);
+    const uint8_t wy = m_memory->ReadByteDirect(WY_ADDR);
+
+    // background: a 160 pixel copy out of the layer, wrapping around its right edge
+    const uint8_t* background_layer = m_background_layers.data() +
+                                      bitGet(LCDC, 3) * WINDOW_WIDTH * WINDOW_HEIGHT;
+    const uint8_t* background_row = background_layer + ((scanline + scy) & 0xFF) * WINDOW_WIDTH;
+
+    const unsigned int first_part = std::min(SCREEN_WIDTH, WINDOW_WIDTH - scx);
+    std::memcpy(m_line_indices, background_row + scx, first_part);
+    std::memcpy(m_line_indices + first_part, background_row, SCREEN_WIDTH - first_part);
+
+    // window: drawn from the left edge at WX - 7 to the end of the line
+    if (bitGet(LCDC, 5) && scanline >= wy) {
+        const uint8_t* window_layer = m_background_layers.data() +
+                                      bitGet(LCDC, 6) * WINDOW_WIDTH * WINDOW_HEIGHT;
+        const uint8_t* window_row = window_layer + ((scanline - wy) & 0xFF) * WINDOW_WIDTH;
+
+        const unsigned int window_start = wx < 7 ? 0 : wx - 7;
+        if (window_start < SCREEN_WIDTH) {
+            std::memcpy(m_line_indices + window_start, window_row + window_start + 7 - wx,
+                        SCREEN_WIDTH - window_start);
+        }
+    }
+
+    uint8_t* line = m_framebuffer.data() + scanline * SCREEN_WIDTH * 3;
+    for (unsigned int x_offset = 0; x_offset < SCREEN_WIDTH; ++x_offset) {
+        const uint8_t pixel_val = m_line_indices[x_offset];
+        line[x_offset * 3] = PALETTE[pixel_val * 3];
+        line[x_offset * 3 + 1] = PALETTE[pixel_val * 3 + 1];
+        line[x_offset * 3 + 2] = PALETTE[pixel_val * 3 + 2];
+    }
+}
+
+void Ppu::renderBackgroundLinePerPixel(uint8_t scanline) {
         
     if (scanline >= SCREEN_HEIGHT) {
         throw std::runtime_error("Out of range rendering!");
@@ -172,6 +289,43 @@ void Ppu::newScanlineCallback(uint8_t current_scanline) {
 
 }
 
+void Ppu::SaveState(SaveStateWriter& writer) const {
+    ppu_state_t state = {};
+    state.dot_pool = m_dot_pool;
+    state.current_dots_need = m_current_dots_need;
+    state.hblank_checkpoint = m_hblank_checkpoint;
+    state.vblank_checkpoint = m_vblank_checkpoint;
+    state.oam_scan_checkpoint = m_oam_scan_checkpoint;
+    state.drawing_checkpoint = m_drawing_checkpoint;
+    state.oam_scan_dots = m_oam_scan_dots;
+    state.oam_scan_ptr = m_oam_scan_ptr;
+    state.current_mode = static_cast<uint8_t>(m_current_mode);
+    state.current_scanline = m_current_scanline;
+    std::memcpy(state.oam_buffer, m_oam_buffer, sizeof(m_oam_buffer));
+    state.oam_buffer_size = m_oam_buffer_size;
+    writer.AddChunk(saveStateChunkId("PPU "), state);
+}
+
+bool Ppu::LoadState(const SaveStateReader& reader) {
+    ppu_state_t state;
+    if (!reader.ReadChunk(saveStateChunkId("PPU "), state)) return false;
+    m_dot_pool = state.dot_pool;
+    m_current_dots_need = state.current_dots_need;
+    m_hblank_checkpoint = state.hblank_checkpoint;
+    m_vblank_checkpoint = state.vblank_checkpoint;
+    m_oam_scan_checkpoint = state.oam_scan_checkpoint;
+    m_drawing_checkpoint = state.drawing_checkpoint;
+    m_oam_scan_dots = state.oam_scan_dots;
+    m_oam_scan_ptr = state.oam_scan_ptr;
+    m_current_mode = static_cast<ppu_mode_t>(state.current_mode);
+    m_current_scanline = state.current_scanline;
+    std::memcpy(m_oam_buffer, state.oam_buffer, sizeof(m_oam_buffer));
+    m_oam_buffer_size = state.oam_buffer_size;
+
+    // the background cache stays, the memory load marks the vram pages it changed dirty
+    return true;
+}
+
 void Ppu::requestStatInterrupt() {
     uint8_t requests = m_memory->ReadByteDirect(0xFF0F);
     bitSet(requests, 1, 1);
@@ -180,13 +334,10 @@ void Ppu::requestStatInterrupt() {
 
 void Ppu::PpuStep(unsigned int last_m_cycle_count) {
 
-    static uint8_t current_scanline = 0;
-    static uint8_t buffer_size = 0;
-    
     if (!bitGet(m_memory->ReadByteDirect(LCDC_ADDR), 7)) {
         m_memory->WriteByteDirect(LY_ADDR, 0);
-        current_scanline = 0;
-        buffer_size = 0;
+        m_current_scanline = 0;
+        m_oam_buffer_size = 0;
         m_current_mode = ppu_mode_t::OAM_Scan;
         m_dot_pool = 0;
         return;
@@ -201,21 +352,19 @@ void Ppu::PpuStep(unsigned int last_m_cycle_count) {
 
     m_dot_pool += 4 * last_m_cycle_count;
 
-    static OAM_t oam_buffer[10];
-
     while (m_dot_pool >= m_current_dots_need) {
         switch (m_current_mode) {
             case ppu_mode_t::H_Blank:
-                hBlankStep(current_scanline);
+                hBlankStep(m_current_scanline);
                 break;
             case ppu_mode_t::V_Blank:
-                vBlankStep(current_scanline);
+                vBlankStep(m_current_scanline);
                 break;
             case ppu_mode_t::OAM_Scan:
-                oamScanStep(current_scanline, oam_buffer, buffer_size);
+                oamScanStep(m_current_scanline, m_oam_buffer, m_oam_buffer_size);
                 break;
             case ppu_mode_t::Drawing:
-                drawingStep(current_scanline, oam_buffer, buffer_size);
+                drawingStep(m_current_scanline, m_oam_buffer, m_oam_buffer_size);
                 break;
             default:
                 printf("Unreckognised current ppu mode: %d\n", m_current_mode);
@@ -225,14 +374,12 @@ void Ppu::PpuStep(unsigned int last_m_cycle_count) {
 }
 
 void Ppu::hBlankStep(uint8_t& current_scanline) {
-    static unsigned int checkpoint = 0;
-
-    switch (checkpoint) {
+    switch (m_hblank_checkpoint) {
         case 0: {
             if (bitGet(m_memory->ReadByteDirect(STAT_ADDR), 3)) {
                 requestStatInterrupt();
             }
-            checkpoint++;
+            m_hblank_checkpoint++;
             break;
         }
         case 1:
@@ -255,20 +402,17 @@ void Ppu::hBlankStep(uint8_t& current_scanline) {
                 m_current_mode = ppu_mode_t::OAM_Scan;
             }
 
-            checkpoint = 0;
+            m_hblank_checkpoint = 0;
 
             break;
         default:
-            printf("Wrong checkpoint in hBlankStep: %u\n", checkpoint);
+            printf("Wrong checkpoint in hBlankStep: %u\n", m_hblank_checkpoint);
             ASSERT(false);
     }
 }
 
 void Ppu::vBlankStep(uint8_t& current_scanline) {
-    
-    static unsigned int checkpoint = 0;
-
-    switch (checkpoint) {
+    switch (m_vblank_checkpoint) {
         case 0: {
             uint8_t requests = m_memory->ReadByteDirect(0xFF0F);
             bitSet(requests, 0, 1);
@@ -278,7 +422,7 @@ void Ppu::vBlankStep(uint8_t& current_scanline) {
                 requestStatInterrupt();
             }
 
-            checkpoint++;
+            m_vblank_checkpoint++;
             break;
         }
         case 1: {
@@ -289,7 +433,7 @@ void Ppu::vBlankStep(uint8_t& current_scanline) {
             }
             m_dot_pool -= 456;
 
-            checkpoint++;
+            m_vblank_checkpoint++;
 
             break;
         }
@@ -299,55 +443,50 @@ void Ppu::vBlankStep(uint8_t& current_scanline) {
                 m_current_mode = ppu_mode_t::OAM_Scan;
                 current_scanline = 0;
                 newScanlineCallback(current_scanline);
-                checkpoint = 0;
+                m_vblank_checkpoint = 0;
             } else {
                 current_scanline++;
                 newScanlineCallback(current_scanline);
-                checkpoint = 1;
+                m_vblank_checkpoint = 1;
             }
 
             break;
         }
         default:
-            printf("Wrong checkpoint in hBlankStep: %u\n", checkpoint);
+            printf("Wrong checkpoint in hBlankStep: %u\n", m_vblank_checkpoint);
             ASSERT(false);
     }
 
 }
 
 void Ppu::oamScanStep(uint8_t& current_scanline, OAM_t* oam_buffer, uint8_t& oam_buffer_size) {
-    static unsigned int checkpoint = 0;
-
-    switch (checkpoint) {
+    switch (m_oam_scan_checkpoint) {
         case 0: {
             if (bitGet(m_memory->ReadByteDirect(STAT_ADDR), 5)) {
                 requestStatInterrupt();
             }
         
             oam_buffer_size = 0;
-            checkpoint++;
+            m_oam_scan_checkpoint++;
             break;
         }
         case 1: {
-            static unsigned int total_dots = 0;
-            static uint16_t oam_ptr = OAM_ADDR;
-
             if (m_dot_pool < 8) {
                 m_current_dots_need = 8;
                 return;
             }
 
-            oamScan(current_scanline, oam_buffer, oam_buffer_size, oam_ptr);
+            oamScan(current_scanline, oam_buffer, oam_buffer_size, m_oam_scan_ptr);
 
             m_dot_pool -= 8;
-            total_dots += 8;
+            m_oam_scan_dots += 8;
 
-            if (total_dots == 80) {
+            if (m_oam_scan_dots == 80) {
                 m_current_mode = ppu_mode_t::Drawing;
                 m_current_dots_need = 0;
-                checkpoint = 0;
-                total_dots = 0;
-                oam_ptr = OAM_ADDR;
+                m_oam_scan_checkpoint = 0;
+                m_oam_scan_dots = 0;
+                m_oam_scan_ptr = OAM_ADDR;
             } else {
                 m_current_dots_need = 8;
             }
@@ -355,17 +494,15 @@ void Ppu::oamScanStep(uint8_t& current_scanline, OAM_t* oam_buffer, uint8_t& oam
             break;
         }
         default:
-            printf("Wrong checkpoint in oamScanStep: %u\n", checkpoint);
+            printf("Wrong checkpoint in oamScanStep: %u\n", m_oam_scan_checkpoint);
             ASSERT(false);
     }
 }
 
 void Ppu::drawingStep(uint8_t& current_scanline, OAM_t* oam_buffer, uint8_t buffer_size) {
-    static unsigned int checkpoint = 0;
-
-    switch (checkpoint) {
+    switch (m_drawing_checkpoint) {
         case 0: {
-            checkpoint++;
+            m_drawing_checkpoint++;
             break;
         }
         case 1: {
@@ -376,15 +513,17 @@ void Ppu::drawingStep(uint8_t& current_scanline, OAM_t* oam_buffer, uint8_t buff
             m_dot_pool -= 289;
             m_current_dots_need = 0;
 
-            renderBackgroundLine(current_scanline);
-            renderObjectLine(current_scanline, oam_buffer, buffer_size);
+            if (m_rendering_enabled) {
+                renderBackgroundLine(current_scanline);
+                renderObjectLine(current_scanline, oam_buffer, buffer_size);
+            }
 
             m_current_mode = ppu_mode_t::H_Blank;
-            checkpoint = 0;
+            m_drawing_checkpoint = 0;
             break;
         }
         default:
-            printf("Wrong checkpoint in drawingStep: %u\n", checkpoint);
+            printf("Wrong checkpoint in drawingStep: %u\n", m_drawing_checkpoint);
             ASSERT(false);
     }
 }
@@ -24,15 +24,47 @@ enum ppu_mode_t {
     Drawing = 3,
 };
 
+struct ppu_state_t {
+    uint32_t dot_pool;
+    uint32_t current_dots_need;
+    uint32_t hblank_checkpoint;
+    uint32_t vblank_checkpoint;
+    uint32_t oam_scan_checkpoint;
+    uint32_t drawing_checkpoint;
+    uint32_t oam_scan_dots;
+    uint16_t oam_scan_ptr;
+    uint8_t current_mode;
+    uint8_t current_scanline;
+    OAM_t oam_buffer[10];
+    uint8_t oam_buffer_size;
+    uint8_t padding[7];
+};
+
 class Ppu {
 public:
     Ppu(Memory* mem_ref, std::vector<uint8_t>& frame_buffer_ref, std::function<void()> frame_ready_callback);
     ~Ppu();
 
     void PpuStep(unsigned int vailable_cycles);
+
+    // switches between the cached background layers and the per pixel tile fetch path
+    inline void SetBackgroundCacheEnabled(bool val) { m_background_cache_enabled = val; }
+
+    // frames that are never shown can skip drawing into the framebuffer, the timing and registers stay exact
+    void SetRenderingEnabled(bool val);
+
+    void SaveState(SaveStateWriter& writer) const;
+    bool LoadState(const SaveStateReader& reader);
 private:
+    // the benchmark suite times single scanlines of each layer
+    friend class PpuBenchmark;
+
     void oamScan(uint8_t scasnline, OAM_t* oam_buffer, uint8_t& oam_buffer_index, uint16_t& oam_ptr);
     void renderBackgroundLine(uint8_t scanline);
+    void renderBackgroundLinePerPixel(uint8_t scanline);
+    void renderBackgroundLineCached(uint8_t scanline);
+    void updateBackgroundCache(bool unsigned_addressing);
+    void renderTileToCache(uint8_t tilemap, uint16_t entry, uint16_t tile_offset);
     void renderObjectLine(uint8_t scanline, OAM_t* oam_buffer, uint8_t buffer_size);
 
     void requestStatInterrupt();
@@ -59,6 +91,9 @@ private:
     static constexpr uint16_t WY_ADDR = 0xFF4A; // window y position
     static constexpr uint16_t WX_ADDR = 0xFF4B; // window x position + 7 
     static constexpr uint16_t OAM_ADDR = 0xFE00;
+    static constexpr uint16_t VRAM_ADDR = 0x8000;
+    static constexpr uint16_t TILEMAP_0_ADDR = 0x9800;
+    static constexpr uint16_t TILEMAP_1_ADDR = 0x9C00;
     static constexpr uint8_t OAM_SIZE = 160;
     static constexpr unsigned int SCREEN_WIDTH = 160;
     static constexpr unsigned int SCREEN_HEIGHT = 144;
@@ -68,8 +103,9 @@ private:
                                           0x34, 0x68, 0x56,
                                           0x08, 0x18, 0x20};
 
-    const unsigned int WINDOW_WIDTH = 256;    
-    const unsigned int WINDOW_HEIGHT = 256;    
+    static constexpr unsigned int WINDOW_WIDTH = 256;    
+    static constexpr unsigned int WINDOW_HEIGHT = 256;    
+    static constexpr unsigned int TILEMAP_SIZE = 32 * 32;
 
     std::vector<uint8_t>& m_framebuffer;
     Memory* m_memory;
@@ -79,4 +115,24 @@ private:
     unsigned int m_current_dots_need = 0;    
 
     std::function<void()> m_frame_ready_callback;
+    bool m_rendering_enabled = true;
+
+    uint8_t m_current_scanline = 0;
+    OAM_t m_oam_buffer[10] = {};
+    uint8_t m_oam_buffer_size = 0;
+
+    // progress through the current mode, so a step can resume once enough dots are pooled
+    unsigned int m_hblank_checkpoint = 0;
+    unsigned int m_vblank_checkpoint = 0;
+    unsigned int m_oam_scan_checkpoint = 0;
+    unsigned int m_drawing_checkpoint = 0;
+    unsigned int m_oam_scan_dots = 0;
+    uint16_t m_oam_scan_ptr = OAM_ADDR;
+
+    // full 256x256 color index image of each tilemap, used for both background and window
+    bool m_background_cache_enabled = true;
+    bool m_background_cache_valid = false;
+    bool m_background_cache_unsigned_addressing = false;
+    std::vector<uint8_t> m_background_layers;
+    uint8_t m_line_indices[SCREEN_WIDTH];
 };
\ No newline at end of file
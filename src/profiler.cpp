@@ -0,0 +1,202 @@
+#include "profiler.hpp"
+#include "memory.hpp"
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <unordered_map>
+#include <cstdio>
+
+// rom0, romx, then 8 KB regions, so a symbol doesn't name code in a region it isn't part of
+static uint8_t getRegion(uint16_t addr) {
+    return addr < 0x8000 ? addr >> 14 : addr >> 13;
+}
+
+GuestProfiler::GuestProfiler(const Memory* memory_ref, unsigned int sample_interval):
+    m_memory(memory_ref),
+    m_sample_interval(std::max(1u, sample_interval)) {
+    m_stack.reserve(MAX_DEPTH);
+}
+
+bool GuestProfiler::LoadSymbols(const std::string& path) {
+    std::ifstream file(path);
+    if (!file) {
+        printf("Failed to open %s\n", path.c_str());
+        return false;
+    }
+
+    m_symbols.clear();
+    std::string line;
+    while (std::getline(file, line)) {
+        const size_t comment = line.find(';');
+        if (comment != std::string::npos) line.resize(comment);
+
+        std::istringstream stream(line);
+        std::string location;
+        std::string name;
+        if (!(stream >> location >> name)) continue;
+
+        unsigned int bank = 0;
+        unsigned int addr = 0;
+        if (sscanf(location.c_str(), "%x:%x", &bank, &addr) != 2 || addr > 0xFFFF || bank > 0xFFFF) continue;
+
+        // local labels are part of the routine above them
+        if (name.find('.') != std::string::npos) continue;
+
+        m_symbols.push_back({(bank << 16) | addr, name});
+    }
+
+    std::stable_sort(m_symbols.begin(), m_symbols.end(),
+                     [] (const symbol_t& a, const symbol_t& b) { return a.location < b.location; });
+    m_symbols.erase(std::unique(m_symbols.begin(), m_symbols.end(),
+                                [] (const symbol_t& a, const symbol_t& b) { return a.location == b.location; }),
+                    m_symbols.end());
+    return true;
+}
+
+uint32_t GuestProfiler::getLocation(uint16_t addr) const {
+    const uint32_t bank = addr >= 0x4000 && addr < 0x8000 ? m_memory->GetRomBank() : 0;
+    return (bank << 16) | addr;
+}
+
+bool GuestProfiler::findRoutine(uint32_t location, uint32_t& routine) const {
+    auto itr = std::upper_bound(m_symbols.begin(), m_symbols.end(), location,
+                                [] (uint32_t value, const symbol_t& symbol) { return value < symbol.location; });
+    if (itr == m_symbols.begin()) return false;
+    --itr;
+
+    if ((itr->location >> 16) != (location >> 16)) return false;
+    if (getRegion(itr->location & 0xFFFF) != getRegion(location & 0xFFFF)) return false;
+
+    routine = itr->location;
+    return true;
+}
+
+std::string GuestProfiler::getName(uint32_t routine) const {
+    if (routine == HALT_ROUTINE) return "[halt]";
+    if (routine == TOP_LEVEL_ROUTINE) return "[top level]";
+
+    auto itr = std::lower_bound(m_symbols.begin(), m_symbols.end(), routine,
+                                [] (const symbol_t& symbol, uint32_t value) { return symbol.location < value; });
+    if (itr != m_symbols.end() && itr->location == routine) return itr->name;
+
+    char name[16];
+    snprintf(name, sizeof(name), "%02X:%04X", routine >> 16, routine & 0xFFFF);
+    return name;
+}
+
+void GuestProfiler::OnCall(uint16_t target, uint16_t sp) {
+    // frames at or below the new return address were left without a RET
+    while (!m_stack.empty() && m_stack.back().sp <= sp) m_stack.pop_back();
+    if (m_stack.size() == MAX_DEPTH) m_stack.erase(m_stack.begin());
+
+    const uint32_t location = getLocation(target);
+    uint32_t routine = location;
+    findRoutine(location, routine);
+    m_stack.push_back({routine, sp});
+}
+
+void GuestProfiler::OnReturn(uint16_t sp) {
+    while (!m_stack.empty() && m_stack.back().sp <= sp) m_stack.pop_back();
+}
+
+void GuestProfiler::sample(uint16_t pc, uint64_t cycle_count, bool halted) {
+    const auto now = std::chrono::steady_clock::now();
+    const uint64_t host_ns = m_has_sample ? std::chrono::duration_cast<std::chrono::nanoseconds>(now - m_last_sample_time).count() : 0;
+    m_last_sample_time = now;
+    m_has_sample = true;
+    m_next_sample_cycle = cycle_count - cycle_count % m_sample_interval + m_sample_interval;
+
+    m_key.clear();
+    for (const frame_t& frame : m_stack) m_key.push_back(frame.routine);
+
+    // without symbols the innermost call is as precise as it gets, single addresses would be noise
+    uint32_t routine = 0;
+    if (halted) {
+        m_key.push_back(HALT_ROUTINE);
+    } else if (findRoutine(getLocation(pc), routine) && (m_key.empty() || m_key.back() != routine)) {
+        m_key.push_back(routine);
+    }
+    if (m_key.empty()) m_key.push_back(TOP_LEVEL_ROUTINE);
+
+    stack_samples_t& stack = m_stacks[m_key];
+    stack.samples++;
+    stack.host_ns += host_ns;
+    m_sample_count++;
+}
+
+void GuestProfiler::Suspend() {
+    m_suspend_time = std::chrono::steady_clock::now();
+}
+
+void GuestProfiler::Resume() {
+    m_last_sample_time += std::chrono::steady_clock::now() - m_suspend_time;
+}
+
+bool GuestProfiler::WriteCollapsedStacks(const std::string& path) const {
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) {
+        printf("Failed to open %s\n", path.c_str());
+        return false;
+    }
+
+    for (const auto& [key, stack] : m_stacks) {
+        for (size_t i = 0; i < key.size(); ++i) {
+            fprintf(file, "%s%s", i == 0 ? "" : ";", getName(key[i]).c_str());
+        }
+        fprintf(file, " %llu\n", static_cast<unsigned long long>(stack.samples));
+    }
+
+    const bool ok = ferror(file) == 0;
+    fclose(file);
+    return ok;
+}
+
+void GuestProfiler::PrintRoutines(size_t count) const {
+    struct routine_samples_t {
+        uint32_t routine;
+        stack_samples_t self;
+        stack_samples_t total;
+    };
+
+    std::unordered_map<uint32_t, routine_samples_t> routines;
+    uint64_t total_ns = 0;
+    std::vector<uint32_t> seen;
+
+    for (const auto& [key, stack] : m_stacks) {
+        total_ns += stack.host_ns;
+
+        routine_samples_t& leaf = routines.try_emplace(key.back(), routine_samples_t{key.back(), {}, {}}).first->second;
+        leaf.self.samples += stack.samples;
+        leaf.self.host_ns += stack.host_ns;
+
+        // recursion counts once towards the total
+        seen.clear();
+        for (uint32_t routine : key) {
+            if (std::find(seen.begin(), seen.end(), routine) != seen.end()) continue;
+            seen.push_back(routine);
+
+            routine_samples_t& entry = routines.try_emplace(routine, routine_samples_t{routine, {}, {}}).first->second;
+            entry.total.samples += stack.samples;
+            entry.total.host_ns += stack.host_ns;
+        }
+    }
+
+    std::vector<routine_samples_t> sorted;
+    for (const auto& [routine, samples] : routines) sorted.push_back(samples);
+    std::sort(sorted.begin(), sorted.end(), [] (const routine_samples_t& a, const routine_samples_t& b) {
+        return a.self.host_ns != b.self.host_ns ? a.self.host_ns > b.self.host_ns : a.self.samples > b.self.samples;
+    });
+
+    const auto percent = [] (uint64_t part, uint64_t whole) { return whole != 0 ? 100.0 * part / whole : 0.0; };
+
+    printf("Guest profile: %llu samples every %u cycles, %zu routines, %.1f ms of host time\n",
+           static_cast<unsigned long long>(m_sample_count), m_sample_interval, routines.size(), total_ns / 1e6);
+    printf("%12s %7s %12s %7s %9s  %s\n", "self ms", "self", "total ms", "total", "samples", "routine");
+    for (size_t i = 0; i < std::min(count, sorted.size()); ++i) {
+        const routine_samples_t& entry = sorted[i];
+        printf("%12.2f %6.1f%% %12.2f %6.1f%% %9llu  %s\n",
+               entry.self.host_ns / 1e6, percent(entry.self.host_ns, total_ns),
+               entry.total.host_ns / 1e6, percent(entry.total.host_ns, total_ns),
+               static_cast<unsigned long long>(entry.self.samples), getName(entry.routine).c_str());
+    }
+}
@@ -0,0 +1,93 @@
+#pragma once
+#include <stdint.h>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+
+/*
+Sampling profiler for the guest code, to see which routines of a game the emulation time goes to.
+Every SAMPLE_INTERVAL stepped m-cycles the current routine and the call stack leading to it are
+counted, together with the host time since the previous sample. The call stack is a shadow of the
+guest's, pushed on CALL, RST and interrupt dispatch and popped by the stack pointer a RET reads its
+address from, so returns that skip frames or code that drops its return address don't derail it
+for long.
+Routines are named from an RGBDS .sym file when one is loaded, otherwise by the bank and address
+that was called. Hidden run-ahead frames are sampled too, they cost host time like any other.
+*/
+
+class Memory;
+
+class GuestProfiler {
+public:
+    GuestProfiler(const Memory* memory_ref, unsigned int sample_interval);
+
+    // RGBDS "bank:address name" lines; local labels fold into the routine they belong to
+    bool LoadSymbols(const std::string& path);
+    inline size_t GetSymbolCount() const { return m_symbols.size(); }
+
+    // called by the cpu, target is where execution continues and sp points at the pushed return address
+    void OnCall(uint16_t target, uint16_t sp);
+    // sp is where the return address was read from
+    void OnReturn(uint16_t sp);
+
+    inline void OnStep(uint16_t pc, uint64_t cycle_count, bool halted) {
+        if (cycle_count >= m_next_sample_cycle) sample(pc, cycle_count, halted);
+    }
+
+    // time spent outside the emulation, like frame callbacks waiting on the pacer, is not attributed
+    void Suspend();
+    void Resume();
+
+    // one "caller;callee;... samples" line per distinct stack, the input flame graph tools take
+    bool WriteCollapsedStacks(const std::string& path) const;
+
+    // the routines with the most host time spent in them, with their share of the samples
+    void PrintRoutines(size_t count) const;
+
+    inline uint64_t GetSampleCount() const { return m_sample_count; }
+
+private:
+    struct symbol_t {
+        uint32_t location;
+        std::string name;
+    };
+
+    struct frame_t {
+        uint32_t routine;
+        uint16_t sp;
+    };
+
+    struct stack_samples_t {
+        uint64_t samples = 0;
+        uint64_t host_ns = 0;
+    };
+
+    void sample(uint16_t pc, uint64_t cycle_count, bool halted);
+
+    // bank in the high half, address in the low half
+    uint32_t getLocation(uint16_t addr) const;
+    // the start of the symbol a location belongs to, false without one in the same bank and region
+    bool findRoutine(uint32_t location, uint32_t& routine) const;
+    std::string getName(uint32_t routine) const;
+
+    static constexpr size_t MAX_DEPTH = 256;
+    // where the samples go that were taken in HALT, and those outside any known routine
+    static constexpr uint32_t HALT_ROUTINE = 0xFFFFFFFF;
+    static constexpr uint32_t TOP_LEVEL_ROUTINE = 0xFFFFFFFE;
+
+    const Memory* m_memory;
+    unsigned int m_sample_interval;
+    uint64_t m_next_sample_cycle = 0;
+    uint64_t m_sample_count = 0;
+
+    std::vector<symbol_t> m_symbols;
+    std::vector<frame_t> m_stack;
+
+    std::map<std::vector<uint32_t>, stack_samples_t> m_stacks;
+    std::vector<uint32_t> m_key;
+
+    std::chrono::steady_clock::time_point m_last_sample_time;
+    std::chrono::steady_clock::time_point m_suspend_time;
+    bool m_has_sample = false;
+};
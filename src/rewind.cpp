@@ -0,0 +1,146 @@
+#include "rewind.hpp"
+#include "trace.hpp"
+#include "lz_codec.hpp"
+#include "common.hpp"
+#include <cstring>
+#include <cstdio>
+
+// dest = a ^ b, a word at a time; a byte loop through vectors doesn't get vectorized since uint8_t may alias anything
+static void xorBuffers(uint8_t* dest, const uint8_t* a, const uint8_t* b, size_t size) {
+    size_t i = 0;
+    for (; i + 8 <= size; i += 8) {
+        uint64_t word_a, word_b;
+        std::memcpy(&word_a, a + i, 8);
+        std::memcpy(&word_b, b + i, 8);
+        word_a ^= word_b;
+        std::memcpy(dest + i, &word_a, 8);
+    }
+    for (; i < size; ++i) dest[i] = a[i] ^ b[i];
+}
+
+RewindBuffer::RewindBuffer(Emulator* emulator_ref, size_t budget_bytes, unsigned int interval)
+    : m_emulator(emulator_ref), m_interval(interval == 0 ? 1 : interval), m_storage(budget_bytes) {
+    ASSERT(m_emulator);
+}
+
+void RewindBuffer::OnFrame() {
+    TRACE_SCOPE("RewindBuffer::OnFrame");
+    m_frame_count++;
+    if (++m_frames_since_snapshot < m_interval && !m_current.empty()) return;
+    m_frames_since_snapshot = 0;
+
+    const auto start = std::chrono::steady_clock::now();
+    capture();
+    m_capture_time += std::chrono::steady_clock::now() - start;
+}
+
+void RewindBuffer::capture() {
+    m_emulator->SaveState(m_next);
+
+    // the layout of a state never changes for a given rom, anything else starts over
+    if (m_current.size() != m_next.size()) {
+        m_entries.clear();
+        m_used_bytes = 0;
+        m_current.swap(m_next);
+        return;
+    }
+
+    m_delta.resize(m_next.size());
+    xorBuffers(m_delta.data(), m_current.data(), m_next.data(), m_next.size());
+    LzCompress(m_delta.data(), m_delta.size(), m_compressed);
+
+    size_t offset = 0;
+    if (allocate(m_compressed.size(), offset)) {
+        std::memcpy(m_storage.data() + offset, m_compressed.data(), m_compressed.size());
+        m_entries.push_back({offset, m_compressed.size()});
+        m_used_bytes += m_compressed.size();
+    } else {
+        // doesn't fit even in an empty ring, the past is lost
+        m_entries.clear();
+        m_used_bytes = 0;
+    }
+
+    m_current.swap(m_next);
+}
+
+bool RewindBuffer::allocate(size_t size, size_t& offset) {
+    const size_t capacity = m_storage.size();
+    if (size > capacity) return false;
+
+    while (!m_entries.empty()) {
+        const rewind_entry_t& oldest = m_entries.front();
+        const rewind_entry_t& newest = m_entries.back();
+        const size_t head = newest.offset + newest.size;
+        const size_t tail = oldest.offset;
+
+        if (newest.offset >= oldest.offset) {
+            // the free space is at the end and before the oldest entry
+            if (capacity - head >= size) {
+                offset = head;
+                return true;
+            }
+            if (tail >= size) {
+                offset = 0;
+                return true;
+            }
+        } else if (tail - head >= size) {
+            offset = head;
+            return true;
+        }
+
+        dropOldest();
+    }
+
+    offset = 0;
+    return true;
+}
+
+void RewindBuffer::dropOldest() {
+    m_used_bytes -= m_entries.front().size;
+    m_entries.pop_front();
+}
+
+bool RewindBuffer::StepBack() {
+    TRACE_SCOPE("RewindBuffer::StepBack");
+    if (m_current.empty()) return false;
+
+    // frames ran since the newest snapshot, going back to it is the first step
+    if (m_frames_since_snapshot != 0 || m_entries.empty()) {
+        m_frames_since_snapshot = 0;
+        if (!m_emulator->LoadState(m_current)) {
+            Clear();
+            return false;
+        }
+        return !m_entries.empty();
+    }
+
+    const rewind_entry_t entry = m_entries.back();
+    m_entries.pop_back();
+    m_used_bytes -= entry.size;
+
+    m_delta.resize(m_current.size());
+    if (!LzDecompress(m_storage.data() + entry.offset, entry.size, m_delta.data(), m_delta.size())) {
+        printf("Corrupted rewind snapshot\n");
+        Clear();
+        return false;
+    }
+    xorBuffers(m_current.data(), m_current.data(), m_delta.data(), m_current.size());
+
+    if (!m_emulator->LoadState(m_current)) {
+        Clear();
+        return false;
+    }
+    return true;
+}
+
+void RewindBuffer::Clear() {
+    m_entries.clear();
+    m_used_bytes = 0;
+    m_current.clear();
+    m_frames_since_snapshot = 0;
+}
+
+std::chrono::nanoseconds RewindBuffer::GetAverageFrameCost() const {
+    if (m_frame_count == 0) return std::chrono::nanoseconds(0);
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(m_capture_time) / m_frame_count;
+}
@@ -0,0 +1,66 @@
+#pragma once
+#include "emulator.hpp"
+#include <stdint.h>
+#include <vector>
+#include <deque>
+#include <chrono>
+
+/*
+Keeps the recent past of a machine so it can be played backwards.
+Only the newest snapshot is kept whole. Every older one is stored as the XOR of itself and its
+successor, which is mostly zeros between nearby frames, LZ compressed into a fixed-size byte
+ring. Stepping back decompresses one delta and XORs it into the newest snapshot. When the ring
+is full the oldest deltas are dropped. All calls belong on the emulation thread, between frames.
+*/
+
+class RewindBuffer {
+public:
+    // budget_bytes is the size of the ring holding the compressed deltas, a snapshot is taken every interval frames
+    RewindBuffer(Emulator* emulator_ref, size_t budget_bytes, unsigned int interval);
+
+    // call once per emulated frame while running forwards
+    void OnFrame();
+
+    // restores the previous snapshot, returns false once there is nothing older left
+    bool StepBack();
+
+    void Clear();
+
+    inline size_t GetSnapshotCount() const { return m_entries.size() + (m_current.empty() ? 0 : 1); }
+    inline size_t GetUsedBytes() const { return m_used_bytes; }
+    inline size_t GetBudgetBytes() const { return m_storage.size(); }
+    inline unsigned int GetInterval() const { return m_interval; }
+
+    // host time spent taking snapshots, averaged over all frames including the ones without one
+    std::chrono::nanoseconds GetAverageFrameCost() const;
+
+private:
+    struct rewind_entry_t {
+        size_t offset;
+        size_t size;
+    };
+
+    void capture();
+
+    // finds room for a delta in the ring, dropping the oldest ones until it fits
+    bool allocate(size_t size, size_t& offset);
+    void dropOldest();
+
+private:
+    Emulator* m_emulator = nullptr;
+    unsigned int m_interval = 1;
+    unsigned int m_frames_since_snapshot = 0;
+
+    std::vector<uint8_t> m_storage;
+    std::deque<rewind_entry_t> m_entries; // oldest first
+    size_t m_used_bytes = 0;
+
+    // the newest snapshot in full, the other buffers are kept around to avoid allocating per frame
+    std::vector<uint8_t> m_current;
+    std::vector<uint8_t> m_next;
+    std::vector<uint8_t> m_delta;
+    std::vector<uint8_t> m_compressed;
+
+    std::chrono::steady_clock::duration m_capture_time{0};
+    uint64_t m_frame_count = 0;
+};
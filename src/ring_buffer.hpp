@@ -0,0 +1,72 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <cstring>
+#include <type_traits>
+
+/*
+Single producer / single consumer ring buffer.
+The producer only writes m_write_index and the consumer only writes m_read_index,
+so neither side ever takes a lock. Capacity is rounded up to a power of two.
+*/
+
+template <typename T>
+class RingBuffer {
+    static_assert(std::is_trivially_copyable_v<T>, "RingBuffer copies items with memcpy");
+public:
+    RingBuffer(size_t capacity) {
+        size_t real_capacity = 1;
+        while (real_capacity < capacity) real_capacity <<= 1;
+        m_buffer.resize(real_capacity);
+        m_mask = real_capacity - 1;
+    }
+
+    // returns the number of items actually written, the rest is dropped
+    size_t Push(const T* items, size_t count) {
+        const size_t write_index = m_write_index.load(std::memory_order_relaxed);
+        const size_t read_index = m_read_index.load(std::memory_order_acquire);
+        const size_t free_space = m_buffer.size() - (write_index - read_index);
+        count = std::min(count, free_space);
+
+        const size_t start = write_index & m_mask;
+        const size_t first_part = std::min(count, m_buffer.size() - start);
+        std::memcpy(m_buffer.data() + start, items, first_part * sizeof(T));
+        std::memcpy(m_buffer.data(), items + first_part, (count - first_part) * sizeof(T));
+
+        m_write_index.store(write_index + count, std::memory_order_release);
+        return count;
+    }
+
+    // returns the number of items actually read
+    size_t Pop(T* items, size_t count) {
+        const size_t read_index = m_read_index.load(std::memory_order_relaxed);
+        const size_t write_index = m_write_index.load(std::memory_order_acquire);
+        count = std::min(count, write_index - read_index);
+
+        const size_t start = read_index & m_mask;
+        const size_t first_part = std::min(count, m_buffer.size() - start);
+        std::memcpy(items, m_buffer.data() + start, first_part * sizeof(T));
+        std::memcpy(items + first_part, m_buffer.data(), (count - first_part) * sizeof(T));
+
+        m_read_index.store(read_index + count, std::memory_order_release);
+        return count;
+    }
+
+    inline size_t Size() const {
+        return m_write_index.load(std::memory_order_acquire) -
+               m_read_index.load(std::memory_order_acquire);
+    }
+
+    inline size_t Capacity() const { return m_buffer.size(); }
+
+private:
+    std::vector<T> m_buffer;
+    size_t m_mask = 0;
+
+    // kept on separate cache lines so producer and consumer don't false share
+    alignas(64) std::atomic<size_t> m_write_index = 0;
+    alignas(64) std::atomic<size_t> m_read_index = 0;
+};
@@ -0,0 +1,133 @@
+#include "runtime_metrics.hpp"
+#include <algorithm>
+#include <cmath>
+
+// the cpu's counters without the hidden run-ahead frames, so only the shown timeline counts
+static cpu_work_t shownWork(Emulator& emulator) {
+    const Cpu& cpu = emulator.GetCpu();
+    const cpu_work_t& hidden = emulator.GetRunAheadWork();
+    return {cpu.GetInstructionCount() - hidden.instructions, cpu.GetCycleCount() - hidden.cycles,
+            cpu.GetHaltedCycleCount() - hidden.halted_cycles};
+}
+
+RuntimeMetrics::RuntimeMetrics(Emulator* emulator_ref, Pacer* pacer_ref, bool has_presenter):
+    m_emulator(emulator_ref),
+    m_pacer(pacer_ref),
+    m_has_presenter(has_presenter),
+    m_frames_emulated(m_registry.GetCounter("frames_emulated")),
+    m_frames_published(m_registry.GetCounter("frames_published")),
+    m_frames_presented(m_registry.GetCounter("frames_presented")),
+    m_frames_dropped(m_registry.GetCounter("frames_dropped")),
+    m_frames_duplicated(m_registry.GetCounter("frames_duplicated")),
+    m_audio_underruns(m_registry.GetCounter("audio_underruns")),
+    m_audio_overruns(m_registry.GetCounter("audio_overruns")),
+    m_speed_percent(m_registry.GetGauge("speed_percent")),
+    m_target_speed_percent(m_registry.GetGauge("target_speed_percent")),
+    m_halt_percent(m_registry.GetGauge("halt_percent")),
+    m_audio_queued_ms(m_registry.GetGauge("audio_queued_ms")),
+    m_audio_fill_percent(m_registry.GetGauge("audio_fill_percent")),
+    m_frame_time_us(m_registry.GetHistogram("frame_time_us")),
+    m_work_time_us(m_registry.GetHistogram("work_time_us")),
+    m_instructions_per_frame(m_registry.GetHistogram("instructions_per_frame")) {
+
+    m_start_time = clock_t::now();
+    m_last_report_time = m_start_time;
+
+    const cpu_work_t work = shownWork(*m_emulator);
+    m_last_instructions = work.instructions;
+    m_report_cycles = work.cycles;
+    m_report_halted_cycles = work.halted_cycles;
+    m_last_published = m_emulator->GetPublishedFrameCount();
+    m_last_overwritten = m_emulator->GetFrames().GetOverwrittenCount();
+}
+
+RuntimeMetrics::~RuntimeMetrics() {
+    if (m_file && m_file != stdout) fclose(m_file);
+}
+
+bool RuntimeMetrics::Open(const std::string& path, std::chrono::milliseconds interval) {
+    m_interval = interval;
+    if (path.empty()) {
+        m_file = stdout;
+        return true;
+    }
+
+    m_file = fopen(path.c_str(), "w");
+    if (!m_file) {
+        printf("Failed to open %s\n", path.c_str());
+        return false;
+    }
+    return true;
+}
+
+void RuntimeMetrics::OnFrame(clock_t::duration wait_time) {
+    const clock_t::time_point now = clock_t::now();
+
+    // the first frame has nothing to measure against
+    if (m_has_frame) {
+        const auto frame_time = now - m_last_frame_time;
+        m_frame_time_us.Record(std::chrono::duration_cast<std::chrono::microseconds>(frame_time).count());
+        m_work_time_us.Record(std::chrono::duration_cast<std::chrono::microseconds>(std::max(frame_time - wait_time, clock_t::duration::zero())).count());
+    }
+    m_has_frame = true;
+    m_last_frame_time = now;
+
+    const uint64_t instructions = shownWork(*m_emulator).instructions;
+    m_instructions_per_frame.Record(instructions - m_last_instructions);
+    m_last_instructions = instructions;
+
+    m_frames_emulated.Add();
+    const uint64_t published = m_emulator->GetPublishedFrameCount();
+    m_frames_published.Add(published - m_last_published);
+    m_last_published = published;
+
+    if (m_has_presenter) {
+        const uint64_t overwritten = m_emulator->GetFrames().GetOverwrittenCount();
+        m_frames_dropped.Add(overwritten - m_last_overwritten);
+        m_last_overwritten = overwritten;
+    }
+
+    if (now - m_last_report_time >= m_interval) Report();
+}
+
+void RuntimeMetrics::SetAudioState(float queued_seconds, float target_seconds, uint64_t underruns, uint64_t overruns) {
+    m_audio_queued_ms.Set(queued_seconds * 1000.0);
+    m_audio_fill_percent.Set(target_seconds > 0.0f ? 100.0 * queued_seconds / target_seconds : 0.0);
+
+    m_audio_underruns.Add(underruns - m_last_underruns);
+    m_audio_overruns.Add(overruns - m_last_overruns);
+    m_last_underruns = underruns;
+    m_last_overruns = overruns;
+}
+
+void RuntimeMetrics::OnPresent() {
+    const clock_t::time_point now = clock_t::now();
+    m_frames_presented.Add();
+
+    // a frame that stays up for more than one and a half periods of the game's frame rate was
+    // shown again by at least one refresh; at unlimited speed there is no period to miss
+    const float speed = m_pacer->GetEffectiveSpeed();
+    if (m_has_presented && speed != 0.0f) {
+        const double period = 1.0 / (Pacer::FRAME_RATE * std::min(speed, 1.0f));
+        const double gap = std::chrono::duration<double>(now - m_last_present_time).count();
+        if (gap > 1.5 * period) m_frames_duplicated.Add(static_cast<uint64_t>(std::lround(gap / period)) - 1);
+    }
+    m_has_presented = true;
+    m_last_present_time = now;
+}
+
+void RuntimeMetrics::Report() {
+    const clock_t::time_point now = clock_t::now();
+    m_speed_percent.Set(100.0 * m_pacer->GetAchievedSpeed());
+    m_target_speed_percent.Set(100.0 * m_pacer->GetEffectiveSpeed());
+
+    const cpu_work_t work = shownWork(*m_emulator);
+    const uint64_t cycles = work.cycles - m_report_cycles;
+    const uint64_t halted_cycles = work.halted_cycles - m_report_halted_cycles;
+    m_halt_percent.Set(cycles != 0 ? 100.0 * halted_cycles / cycles : 0.0);
+    m_report_cycles = work.cycles;
+    m_report_halted_cycles = work.halted_cycles;
+
+    if (m_file) m_registry.WriteJsonLine(m_file, std::chrono::duration<double>(now - m_start_time).count());
+    m_last_report_time = now;
+}
@@ -0,0 +1,89 @@
+#pragma once
+#include "metrics.hpp"
+#include "emulator.hpp"
+#include "pacer.hpp"
+#include <chrono>
+#include <string>
+
+/*
+Live health numbers of a running emulator: speed, host frame times, instructions per frame, how
+much of the time the cpu sits in HALT, how full the audio queue is and how many frames never made
+it to the screen or stayed on it for too long. Everything is collected into a MetricsRegistry and
+written out as one JSON line per interval.
+The per frame work is a few subtractions and histogram increments, the registry is only walked
+when a line is due.
+*/
+
+class RuntimeMetrics {
+public:
+    // without a presenter every published frame would count as dropped, so those aren't tracked
+    RuntimeMetrics(Emulator* emulator_ref, Pacer* pacer_ref, bool has_presenter);
+    ~RuntimeMetrics();
+
+    // without an open output the gauges are still updated every interval, for the overlay;
+    // lines go to stdout for an empty path
+    bool Open(const std::string& path, std::chrono::milliseconds interval);
+
+    // emulation thread, once per frame after pacing; wait_time is how long the frame was blocked on
+    // the pacer or the audio device, the rest of the frame time was spent working
+    void OnFrame(std::chrono::steady_clock::duration wait_time);
+
+    // emulation thread, with the audio device's queue and its cumulative under and overrun counts
+    void SetAudioState(float queued_seconds, float target_seconds, uint64_t underruns, uint64_t overruns);
+
+    // presentation thread, every time a new frame went to the screen
+    void OnPresent();
+
+    // emulation thread, writes the line for the time since the previous one
+    void Report();
+
+    // updated with every line, safe from any thread
+    inline float GetSpeedPercent() const { return static_cast<float>(m_speed_percent.Get()); }
+    inline float GetAudioFillPercent() const { return static_cast<float>(m_audio_fill_percent.Get()); }
+
+    inline MetricsRegistry& GetRegistry() { return m_registry; }
+
+private:
+    using clock_t = std::chrono::steady_clock;
+
+    Emulator* m_emulator;
+    Pacer* m_pacer;
+    bool m_has_presenter;
+
+    MetricsRegistry m_registry;
+    Counter& m_frames_emulated;
+    Counter& m_frames_published;
+    Counter& m_frames_presented;
+    Counter& m_frames_dropped;
+    Counter& m_frames_duplicated;
+    Counter& m_audio_underruns;
+    Counter& m_audio_overruns;
+    Gauge& m_speed_percent;
+    Gauge& m_target_speed_percent;
+    Gauge& m_halt_percent;
+    Gauge& m_audio_queued_ms;
+    Gauge& m_audio_fill_percent;
+    Histogram& m_frame_time_us;
+    Histogram& m_work_time_us;
+    Histogram& m_instructions_per_frame;
+
+    FILE* m_file = nullptr;
+    std::chrono::milliseconds m_interval{1000};
+    clock_t::time_point m_start_time;
+    clock_t::time_point m_last_report_time;
+
+    // emulation thread
+    clock_t::time_point m_last_frame_time;
+    bool m_has_frame = false;
+    uint64_t m_last_instructions = 0;
+    uint64_t m_last_published = 0;
+    uint64_t m_last_overwritten = 0;
+    uint64_t m_report_cycles = 0;
+    uint64_t m_report_halted_cycles = 0;
+    uint64_t m_last_underruns = 0;
+    uint64_t m_last_overruns = 0;
+
+    // presentation thread
+    clock_t::time_point m_last_present_time;
+    bool m_has_presented = false;
+};
@@ -0,0 +1,103 @@
+#include "save_state.hpp"
+#include <cstring>
+#include <cstdio>
+
+static constexpr uint32_t SAVE_STATE_MAGIC = saveStateChunkId("GBSS");
+static constexpr size_t CHUNK_ALIGNMENT = 8;
+
+SaveStateWriter::SaveStateWriter(std::vector<uint8_t>& buffer): m_buffer{buffer} {
+    m_buffer.clear();
+    m_buffer.resize(sizeof(save_state_header_t));
+}
+
+void SaveStateWriter::AddChunk(uint32_t id, const void* data, size_t size) {
+    std::memcpy(ReserveChunk(id, size), data, size);
+}
+
+uint8_t* SaveStateWriter::ReserveChunk(uint32_t id, size_t size) {
+    const save_state_chunk_header_t chunk_header = {id, static_cast<uint32_t>(size)};
+    const size_t padded_size = (size + CHUNK_ALIGNMENT - 1) & ~(CHUNK_ALIGNMENT - 1);
+
+    const size_t offset = m_buffer.size();
+    m_buffer.resize(offset + sizeof(chunk_header) + padded_size);
+    std::memcpy(m_buffer.data() + offset, &chunk_header, sizeof(chunk_header));
+    std::memset(m_buffer.data() + offset + sizeof(chunk_header) + size, 0, padded_size - size);
+
+    m_chunk_count++;
+    return m_buffer.data() + offset + sizeof(chunk_header);
+}
+
+void SaveStateWriter::Finish() {
+    const save_state_header_t header = {
+        SAVE_STATE_MAGIC,
+        SAVE_STATE_VERSION,
+        m_chunk_count,
+        static_cast<uint32_t>(m_buffer.size() - sizeof(save_state_header_t))
+    };
+    std::memcpy(m_buffer.data(), &header, sizeof(header));
+}
+
+SaveStateReader::SaveStateReader(const uint8_t* data, size_t size) {
+    save_state_header_t header;
+    if (size < sizeof(header)) return;
+    std::memcpy(&header, data, sizeof(header));
+
+    if (header.magic != SAVE_STATE_MAGIC) {
+        printf("Not a save state\n");
+        return;
+    }
+    if (header.version != SAVE_STATE_VERSION) {
+        printf("Unsupported save state version: %u\n", header.version);
+        return;
+    }
+    if (header.chunk_count > MAX_CHUNKS || header.payload_size != size - sizeof(header)) {
+        printf("Corrupted save state\n");
+        return;
+    }
+
+    size_t offset = sizeof(header);
+    for (uint32_t i = 0; i < header.chunk_count; ++i) {
+        save_state_chunk_header_t chunk_header;
+        if (size - offset < sizeof(chunk_header)) break;
+        std::memcpy(&chunk_header, data + offset, sizeof(chunk_header));
+        offset += sizeof(chunk_header);
+
+        const size_t padded_size = (chunk_header.size + CHUNK_ALIGNMENT - 1) & ~(CHUNK_ALIGNMENT - 1);
+        if (size - offset < padded_size) break;
+
+        m_chunks[m_chunk_count++] = {chunk_header.id, chunk_header.size, data + offset};
+        offset += padded_size;
+    }
+
+    if (m_chunk_count != header.chunk_count) {
+        printf("Truncated save state\n");
+        return;
+    }
+
+    m_valid = true;
+}
+
+const SaveStateReader::chunk_entry_t* SaveStateReader::findChunk(uint32_t id) const {
+    for (size_t i = 0; i < m_chunk_count; ++i) {
+        if (m_chunks[i].id == id) return &m_chunks[i];
+    }
+    return nullptr;
+}
+
+bool SaveStateReader::ReadChunk(uint32_t id, void* dest, size_t size) const {
+    const uint8_t* data = GetChunkData(id, size);
+    if (!data) return false;
+    std::memcpy(dest, data, size);
+    return true;
+}
+
+const uint8_t* SaveStateReader::GetChunkData(uint32_t id, size_t size) const {
+    const chunk_entry_t* chunk = findChunk(id);
+    if (!chunk || chunk->size != size) return nullptr;
+    return chunk->data;
+}
+
+size_t SaveStateReader::GetChunkSize(uint32_t id) const {
+    const chunk_entry_t* chunk = findChunk(id);
+    return chunk ? chunk->size : 0;
+}
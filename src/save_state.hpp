@@ -0,0 +1,99 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <vector>
+#include <array>
+#include <bit>
+#include <type_traits>
+
+/*
+Save state layout:
+    header: magic "GBSS", format version, chunk count, payload size
+    chunks: four character id, payload size, payload padded to 8 bytes
+Every payload is the raw image of a fixed size struct or array, so loading a chunk is a size
+check and a memcpy. All values are stored little endian, which is the host byte order.
+Chunks a component doesn't know are ignored; a chunk whose size doesn't match is an error.
+*/
+
+static_assert(std::endian::native == std::endian::little, "save states are stored in host byte order");
+
+static constexpr uint32_t SAVE_STATE_VERSION = 2;
+
+constexpr uint32_t saveStateChunkId(const char (&name)[5]) {
+    return static_cast<uint32_t>(name[0]) | (static_cast<uint32_t>(name[1]) << 8) |
+           (static_cast<uint32_t>(name[2]) << 16) | (static_cast<uint32_t>(name[3]) << 24);
+}
+
+struct save_state_header_t {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t chunk_count;
+    uint32_t payload_size;
+};
+
+struct save_state_chunk_header_t {
+    uint32_t id;
+    uint32_t size;
+};
+
+class SaveStateWriter {
+public:
+    // the buffer is cleared but keeps its capacity, repeated saves don't allocate
+    SaveStateWriter(std::vector<uint8_t>& buffer);
+
+    void AddChunk(uint32_t id, const void* data, size_t size);
+
+    // adds a chunk and returns its payload for the caller to fill, valid until the next chunk is added
+    uint8_t* ReserveChunk(uint32_t id, size_t size);
+
+    template <typename T>
+    inline void AddChunk(uint32_t id, const T& value) {
+        static_assert(std::is_trivially_copyable_v<T>, "chunks are copied with memcpy");
+        AddChunk(id, &value, sizeof(T));
+    }
+
+    // patches the header, the buffer holds a complete state afterwards
+    void Finish();
+
+private:
+    std::vector<uint8_t>& m_buffer;
+    uint32_t m_chunk_count = 0;
+};
+
+class SaveStateReader {
+public:
+    SaveStateReader(const uint8_t* data, size_t size);
+
+    // magic, version and chunk bounds are all correct
+    inline bool IsValid() const { return m_valid; }
+
+    // copies the payload into dest, false if the chunk is missing or has a different size
+    bool ReadChunk(uint32_t id, void* dest, size_t size) const;
+
+    template <typename T>
+    inline bool ReadChunk(uint32_t id, T& value) const {
+        static_assert(std::is_trivially_copyable_v<T>, "chunks are copied with memcpy");
+        return ReadChunk(id, &value, sizeof(T));
+    }
+
+    // payload size of a chunk, 0 if it's missing
+    size_t GetChunkSize(uint32_t id) const;
+
+    // payload of a chunk, null if it's missing or has a different size
+    const uint8_t* GetChunkData(uint32_t id, size_t size) const;
+
+    static constexpr size_t MAX_CHUNKS = 32;
+
+private:
+    struct chunk_entry_t {
+        uint32_t id;
+        uint32_t size;
+        const uint8_t* data;
+    };
+
+    const chunk_entry_t* findChunk(uint32_t id) const;
+
+    std::array<chunk_entry_t, MAX_CHUNKS> m_chunks;
+    size_t m_chunk_count = 0;
+    bool m_valid = false;
+};
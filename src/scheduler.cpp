@@ -0,0 +1,65 @@
+#include "scheduler.hpp"
+#include "common.hpp"
+#include <cstring>
+
+Scheduler::Scheduler() {
+    for (uint8_t i = 0; i < EVENT_COUNT; ++i) {
+        m_event_cycles[i] = NO_EVENT;
+    }
+}
+
+void Scheduler::SetEventHandler(scheduler_event_t event, std::function<void(uint64_t)> handler) {
+    m_handlers[static_cast<uint8_t>(event)] = handler;
+}
+
+void Scheduler::Schedule(scheduler_event_t event, uint64_t cycle) {
+    ASSERT(m_handlers[static_cast<uint8_t>(event)]);
+    m_event_cycles[static_cast<uint8_t>(event)] = cycle;
+    updateNextEvent();
+}
+
+void Scheduler::Cancel(scheduler_event_t event) {
+    m_event_cycles[static_cast<uint8_t>(event)] = NO_EVENT;
+    updateNextEvent();
+}
+
+void Scheduler::SaveState(SaveStateWriter& writer) const {
+    scheduler_state_t state;
+    state.current_cycle = m_current_cycle;
+    std::memcpy(state.event_cycles, m_event_cycles, sizeof(m_event_cycles));
+    writer.AddChunk(saveStateChunkId("SCHD"), state);
+}
+
+bool Scheduler::LoadState(const SaveStateReader& reader) {
+    scheduler_state_t state;
+    if (!reader.ReadChunk(saveStateChunkId("SCHD"), state)) return false;
+    m_current_cycle = state.current_cycle;
+    std::memcpy(m_event_cycles, state.event_cycles, sizeof(m_event_cycles));
+    updateNextEvent();
+    return true;
+}
+
+void Scheduler::fireEvents() {
+    while (true) {
+        uint8_t earliest = 0;
+        for (uint8_t i = 1; i < EVENT_COUNT; ++i) {
+            if (m_event_cycles[i] < m_event_cycles[earliest]) earliest = i;
+        }
+
+        const uint64_t cycle = m_event_cycles[earliest];
+        if (cycle > m_current_cycle) break;
+
+        // cleared before the call so the handler can reschedule itself
+        m_event_cycles[earliest] = NO_EVENT;
+        m_handlers[earliest](cycle);
+    }
+
+    updateNextEvent();
+}
+
+void Scheduler::updateNextEvent() {
+    m_next_event_cycle = NO_EVENT;
+    for (uint8_t i = 0; i < EVENT_COUNT; ++i) {
+        if (m_event_cycles[i] < m_next_event_cycle) m_next_event_cycle = m_event_cycles[i];
+    }
+}
@@ -0,0 +1,70 @@
+#pragma once
+#include <stdint.h>
+#include <functional>
+#include "save_state.hpp"
+
+/*
+Cycle based event scheduler.
+Components that only need to act at known points in time (frame sequencer ticks, timer
+overflows, ...) register a handler once and schedule their next deadline. Advancing the
+clock is a single compare until the earliest deadline is reached.
+Every event type has exactly one slot, scheduling it again moves the deadline.
+*/
+
+enum class scheduler_event_t : uint8_t {
+    ApuFrameSequencer = 0,
+    ApuEndFrame,
+    TimerOverflow,
+    SerialTransfer,
+    JoypadInput,
+    EVENT_COUNT,
+};
+
+struct scheduler_state_t {
+    uint64_t current_cycle;
+    uint64_t event_cycles[static_cast<uint8_t>(scheduler_event_t::EVENT_COUNT)];
+};
+
+class Scheduler {
+public:
+    Scheduler();
+
+    inline uint64_t GetCurrentCycle() const { return m_current_cycle; }
+
+    inline void Advance(unsigned int m_cycle_count) {
+        m_current_cycle += m_cycle_count;
+        if (m_current_cycle >= m_next_event_cycle) {
+            fireEvents();
+        }
+    }
+
+    // the handler receives the cycle the event was scheduled for, which can be slightly in the past
+    void SetEventHandler(scheduler_event_t event, std::function<void(uint64_t)> handler);
+
+    void Schedule(scheduler_event_t event, uint64_t cycle);
+    void Cancel(scheduler_event_t event);
+
+    inline bool IsScheduled(scheduler_event_t event) const {
+        return m_event_cycles[static_cast<uint8_t>(event)] != NO_EVENT;
+    }
+
+    inline uint64_t GetEventCycle(scheduler_event_t event) const {
+        return m_event_cycles[static_cast<uint8_t>(event)];
+    }
+
+    // the clock and all pending deadlines, handlers stay as registered
+    void SaveState(SaveStateWriter& writer) const;
+    bool LoadState(const SaveStateReader& reader);
+
+private:
+    void fireEvents();
+    void updateNextEvent();
+
+    static constexpr uint8_t EVENT_COUNT = static_cast<uint8_t>(scheduler_event_t::EVENT_COUNT);
+    static constexpr uint64_t NO_EVENT = UINT64_MAX;
+
+    uint64_t m_current_cycle = 0;
+    uint64_t m_next_event_cycle = NO_EVENT;
+    uint64_t m_event_cycles[EVENT_COUNT];
+    std::function<void(uint64_t)> m_handlers[EVENT_COUNT];
+};
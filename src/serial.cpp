@@ -0,0 +1,41 @@
+#include "serial.hpp"
+
+Serial::Serial(Memory* memory_ref, Scheduler* scheduler_ref): m_memory{memory_ref}, m_scheduler{scheduler_ref} {
+
+    m_scheduler->SetEventHandler(scheduler_event_t::SerialTransfer, [&] (uint64_t) {
+        // nobody on the other end, the line stays high
+        CompleteTransfer(0xFF);
+    });
+
+    m_memory->AddToWriteAddressMapper(SC_ADDR, [&] (uint8_t byte) { writeControl(byte); });
+}
+
+void Serial::writeControl(uint8_t byte) {
+    // unused bits read back as 1
+    m_memory->WriteByteDirect(SC_ADDR, byte | 0x7E);
+
+    if (!bitGet(byte, 7)) {
+        m_scheduler->Cancel(scheduler_event_t::SerialTransfer);
+        return;
+    }
+
+    const uint64_t now = m_scheduler->GetCurrentCycle();
+
+    if (m_transfer_request_callback) {
+        m_transfer_request_callback(now);
+    } else if (bitGet(byte, 0)) {
+        m_scheduler->Schedule(scheduler_event_t::SerialTransfer, now + CYCLES_PER_TRANSFER);
+    }
+}
+
+void Serial::CompleteTransfer(uint8_t received) {
+    m_memory->WriteByteDirect(SB_ADDR, received);
+
+    uint8_t control = m_memory->ReadByteDirect(SC_ADDR);
+    bitSet(control, 7, false);
+    m_memory->WriteByteDirect(SC_ADDR, control);
+
+    uint8_t interrupts = m_memory->ReadByteDirect(0xFF0F);
+    bitSet(interrupts, 3, true);
+    m_memory->WriteByteDirect(0xFF0F, interrupts);
+}
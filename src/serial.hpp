@@ -0,0 +1,44 @@
+#pragma once
+#include "memory.hpp"
+#include "scheduler.hpp"
+#include "common.hpp"
+#include <functional>
+
+/*
+Serial port (SB/SC). Transfers are handled a whole byte at a time.
+Without anything plugged in, an internally clocked transfer finishes after 8 bit periods and
+shifts in 0xFF. Once a transfer request callback is set the other end of the cable is
+responsible for finishing transfers through CompleteTransfer.
+*/
+
+class Serial {
+public:
+    Serial(Memory* memory_ref, Scheduler* scheduler_ref);
+
+    // called whenever the game arms a transfer (SC bit 7), with the cycle it happened at
+    inline void SetTransferRequestCallback(std::function<void(uint64_t)> callback) {
+        m_transfer_request_callback = callback;
+    }
+
+    inline uint8_t GetOutgoingByte() const { return m_memory->ReadByteDirect(SB_ADDR); }
+    inline bool IsTransferRequested() const { return bitGet(m_memory->ReadByteDirect(SC_ADDR), 7); }
+    inline bool IsInternalClock() const { return bitGet(m_memory->ReadByteDirect(SC_ADDR), 0); }
+
+    // shifts in the byte received from the other end and raises the serial interrupt
+    void CompleteTransfer(uint8_t received);
+
+    // 8 bits at 8192Hz
+    static constexpr unsigned int CYCLES_PER_TRANSFER = 1024;
+
+private:
+    void writeControl(uint8_t byte);
+
+private:
+    Memory* m_memory;
+    Scheduler* m_scheduler;
+
+    std::function<void(uint64_t)> m_transfer_request_callback;
+
+    static constexpr uint16_t SB_ADDR = 0xFF01;
+    static constexpr uint16_t SC_ADDR = 0xFF02;
+};
@@ -0,0 +1,56 @@
+#include "thread_pool.hpp"
+#include "trace.hpp"
+#include <algorithm>
+
+ThreadPool::ThreadPool(unsigned int thread_count) {
+    if (thread_count == 0) thread_count = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned int i = 0; i < thread_count; ++i) {
+        m_threads.emplace_back([this] () { workerLoop(); });
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    Wait();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_shutdown = true;
+    }
+    m_task_available.notify_all();
+    for (std::thread& thread : m_threads) thread.join();
+}
+
+void ThreadPool::Submit(std::function<void()> task) {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_tasks.push_back(std::move(task));
+    }
+    m_task_available.notify_one();
+}
+
+void ThreadPool::Wait() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_all_done.wait(lock, [this] () { return m_tasks.empty() && m_running_tasks == 0; });
+}
+
+void ThreadPool::workerLoop() {
+    TRACE_THREAD_NAME("pool worker");
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (true) {
+        m_task_available.wait(lock, [this] () { return m_shutdown || !m_tasks.empty(); });
+        if (m_tasks.empty()) return;
+
+        std::function<void()> task = std::move(m_tasks.front());
+        m_tasks.pop_front();
+        m_running_tasks++;
+
+        lock.unlock();
+        {
+            TRACE_SCOPE("ThreadPool task");
+            task();
+        }
+        lock.lock();
+
+        m_running_tasks--;
+        if (m_tasks.empty() && m_running_tasks == 0) m_all_done.notify_all();
+    }
+}
@@ -0,0 +1,43 @@
+#pragma once
+#include <stddef.h>
+#include <vector>
+#include <deque>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+/*
+Fixed set of worker threads pulling tasks from one shared queue, meant for running many forked
+machines side by side. A task owns whatever it touches, the pool itself shares nothing else.
+*/
+
+class ThreadPool {
+public:
+    // 0 uses one thread per hardware thread
+    ThreadPool(unsigned int thread_count = 0);
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // waits for the queued tasks to finish
+    ~ThreadPool();
+
+    void Submit(std::function<void()> task);
+
+    // blocks until every submitted task has finished
+    void Wait();
+
+    inline size_t GetThreadCount() const { return m_threads.size(); }
+
+private:
+    void workerLoop();
+
+private:
+    std::vector<std::thread> m_threads;
+    std::deque<std::function<void()>> m_tasks;
+    std::mutex m_mutex;
+    std::condition_variable m_task_available;
+    std::condition_variable m_all_done;
+    size_t m_running_tasks = 0;
+    bool m_shutdown = false;
+};
@@ -1,48 +1,139 @@
 #include "timer.hpp"
 #include "common.hpp"
 
-#define max(a,b) a > b ? a : b
+Timer::Timer(Memory* mem_ref, Scheduler* scheduler_ref): m_memory{mem_ref}, m_scheduler{scheduler_ref} {
 
-Timer::Timer(Memory* mem_ref): m_memory{mem_ref} {}
+    m_div_base_cycle = m_scheduler->GetCurrentCycle();
+    m_tima_sync_cycle = m_div_base_cycle;
 
-void Timer::TimerStep(unsigned int m_cycles_count) {
-    // DIV
-    m_cycle_pool_div += m_cycles_count;
+    m_scheduler->SetEventHandler(scheduler_event_t::TimerOverflow, [&] (uint64_t cycle) {
+        syncTima(cycle);
+        scheduleOverflow();
+    });
 
-    uint8_t current_val = m_memory->ReadByteDirect(DIV_ADDR);
+    m_memory->AddToReadAddressMapper(DIV_ADDR, [&] () {
+        return static_cast<uint8_t>(GetDivCounter() >> 6);
+    });
+    m_memory->AddToReadAddressMapper(TIMA_ADDR, [&] () { return readTima(); });
 
-    if (m_cycle_pool_div >= 64) {
-        m_cycle_pool_div -= 64;
-        // cannot go through Write cause it resets
-        m_memory->WriteByteDirect(DIV_ADDR, current_val + 1);
-    }
+    m_memory->AddToWriteAddressMapper(DIV_ADDR, [&] (uint8_t) { writeDiv(); });
+    m_memory->AddToWriteAddressMapper(TIMA_ADDR, [&] (uint8_t byte) { writeTima(byte); });
+    m_memory->AddToWriteAddressMapper(TMA_ADDR, [&] (uint8_t byte) { writeTma(byte); });
+    m_memory->AddToWriteAddressMapper(TAC_ADDR, [&] (uint8_t byte) { writeTac(byte); });
+
+}
+
+void Timer::SaveState(SaveStateWriter& writer) const {
+    timer_state_t state = {};
+    state.div_base_cycle = m_div_base_cycle;
+    state.tima_sync_cycle = m_tima_sync_cycle;
+    state.tima = m_tima;
+    state.tma = m_tma;
+    state.tac = m_tac;
+    writer.AddChunk(saveStateChunkId("TIMR"), state);
+}
+
+bool Timer::LoadState(const SaveStateReader& reader) {
+    timer_state_t state;
+    if (!reader.ReadChunk(saveStateChunkId("TIMR"), state)) return false;
+    m_div_base_cycle = state.div_base_cycle;
+    m_tima_sync_cycle = state.tima_sync_cycle;
+    m_tima = state.tima;
+    m_tma = state.tma;
+    m_tac = state.tac;
+    return true;
+}
 
-    uint8_t tac = m_memory->ReadByteDirect(TAC_ADDR);
+bool Timer::timerSignal(uint64_t cycle) const {
+    // the selected bit is high during the second half of every period
+    const unsigned int period = timaPeriod();
+    return timaEnabled() && (divCounterAt(cycle) & (period / 2));
+}
 
-    // TIMA
-    if (!bitGet(tac, 2)) return;
+void Timer::incrementTima(unsigned int count) {
+    const unsigned int value = m_tima + count;
+    if (value <= 0xFF) {
+        m_tima = static_cast<uint8_t>(value);
+        return;
+    }
 
-    uint8_t timer_counter = m_memory->ReadByteDirect(TIMA_ADDR);
-    uint8_t timer_modulo = m_memory->ReadByteDirect(TMA_ADDR);
-    m_cycle_pool_tima += m_cycles_count;
+    // overflow reloads TMA, any further increments count up from there
+    const unsigned int past_overflow = value - 0x100;
+    const unsigned int reload_range = 0x100 - m_tma;
+    m_tima = static_cast<uint8_t>(m_tma + past_overflow % reload_range);
 
-    const unsigned int clock_speed_m_cycles[] = {256, 4, 128, 64};
-    const uint8_t setting_index = tac & 0x03;
-    const uint8_t setting = clock_speed_m_cycles[setting_index];
+    uint8_t interrupts = m_memory->ReadByteDirect(0xFF0F);
+    bitSet(interrupts, 2, true);
+    m_memory->WriteByteDirect(0xFF0F, interrupts);
+}
 
-    while (m_cycle_pool_tima >= setting) {
-        timer_counter++;
+void Timer::syncTima(uint64_t cycle) {
+    if (cycle <= m_tima_sync_cycle) return;
 
-        if (timer_counter == 0x00) {
-            timer_counter = timer_modulo;
-            uint8_t interrupts = m_memory->ReadByteDirect(0xFF0F);
-            bitSet(interrupts, 2, true);
-            m_memory->WriteByteDirect(0xFF0F, interrupts);
-        }
+    if (timaEnabled()) {
+        const unsigned int period = timaPeriod();
+        const uint64_t ticks = divCounterAt(cycle) / period - divCounterAt(m_tima_sync_cycle) / period;
+        if (ticks != 0) incrementTima(static_cast<unsigned int>(ticks));
+    }
 
-        m_cycle_pool_tima -= setting;
+    m_tima_sync_cycle = cycle;
+}
+
+void Timer::scheduleOverflow() {
+    if (!timaEnabled()) {
+        m_scheduler->Cancel(scheduler_event_t::TimerOverflow);
+        return;
     }
 
-    m_memory->WriteByteDirect(TIMA_ADDR, timer_counter);
+    // counter value of the increment that wraps TIMA, the first one lands on the next period boundary
+    const unsigned int period = timaPeriod();
+    const uint64_t ticks_left = 0x100 - m_tima;
+    const uint64_t first_tick = (divCounterAt(m_tima_sync_cycle) / period + 1) * period;
+    const uint64_t overflow_counter = first_tick + (ticks_left - 1) * period;
+
+    m_scheduler->Schedule(scheduler_event_t::TimerOverflow, m_div_base_cycle + overflow_counter);
 }
 
+uint8_t Timer::readTima() {
+    syncTima(m_scheduler->GetCurrentCycle());
+    return m_tima;
+}
+
+void Timer::writeDiv() {
+    const uint64_t now = m_scheduler->GetCurrentCycle();
+    syncTima(now);
+
+    // resetting the divider while the selected bit is high is a falling edge
+    if (timerSignal(now)) incrementTima(1);
+
+    const uint16_t old_counter = GetDivCounter();
+    m_div_base_cycle = now;
+    scheduleOverflow();
+
+    if (m_div_reset_callback) m_div_reset_callback(old_counter);
+}
+
+void Timer::writeTima(uint8_t byte) {
+    syncTima(m_scheduler->GetCurrentCycle());
+    m_tima = byte;
+    scheduleOverflow();
+}
+
+void Timer::writeTma(uint8_t byte) {
+    syncTima(m_scheduler->GetCurrentCycle());
+    m_tma = byte;
+    m_memory->WriteByteDirect(TMA_ADDR, byte);
+}
+
+void Timer::writeTac(uint8_t byte) {
+    const uint64_t now = m_scheduler->GetCurrentCycle();
+    syncTima(now);
+
+    // disabling the timer or switching to a clock whose bit is low is also seen as a falling edge
+    const bool old_signal = timerSignal(now);
+    m_tac = byte & 0x7;
+    if (old_signal && !timerSignal(now)) incrementTima(1);
+
+    m_memory->WriteByteDirect(TAC_ADDR, byte);
+    scheduleOverflow();
+}
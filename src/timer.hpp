@@ -1,19 +1,78 @@
 #pragma once 
 #include "memory.hpp"
+#include "scheduler.hpp"
+#include <functional>
+
+/*
+DIV and TIMA are not stepped, they are derived from the cycle the divider was last reset at.
+TIMA is only brought up to date when it's read or one of the timer registers is written,
+its overflow is a scheduled event.
+*/
+
+struct timer_state_t {
+    uint64_t div_base_cycle;
+    uint64_t tima_sync_cycle;
+    uint8_t tima;
+    uint8_t tma;
+    uint8_t tac;
+    uint8_t padding[5];
+};
 
 class Timer {
 public:
-    Timer(Memory* mem_ref);
+    Timer(Memory* mem_ref, Scheduler* scheduler_ref);
+
+    // internal divider in m-cycles, DIV is its upper byte
+    inline uint16_t GetDivCounter() const {
+        return static_cast<uint16_t>((m_scheduler->GetCurrentCycle() - m_div_base_cycle) & DIV_COUNTER_MASK);
+    }
+
+    // called after a write to DIV reset the divider, with the counter value it had before
+    inline void SetDivResetCallback(std::function<void(uint16_t)> callback) {
+        m_div_reset_callback = callback;
+    }
 
-    void TimerStep(unsigned int m_cycles_count);
+    void SaveState(SaveStateWriter& writer) const;
+    bool LoadState(const SaveStateReader& reader);
+
+private:
+    uint8_t readTima();
+    void writeDiv();
+    void writeTima(uint8_t byte);
+    void writeTma(uint8_t byte);
+    void writeTac(uint8_t byte);
+
+    // applies all TIMA increments up to the given cycle
+    void syncTima(uint64_t cycle);
+    void incrementTima(unsigned int count);
+    void scheduleOverflow();
+
+    // the divider bit whose falling edge clocks TIMA is high
+    bool timerSignal(uint64_t cycle) const;
+
+    inline uint64_t divCounterAt(uint64_t cycle) const { return cycle - m_div_base_cycle; }
+    inline unsigned int timaPeriod() const { return TIMA_PERIODS[m_tac & 0x3]; }
+    inline bool timaEnabled() const { return m_tac & 0x4; }
 
 private:
     Memory* m_memory;
-    unsigned int m_cycle_pool_tima = 0;
-    unsigned int m_cycle_pool_div = 0;
+    Scheduler* m_scheduler;
+
+    uint64_t m_div_base_cycle = 0;
+    uint64_t m_tima_sync_cycle = 0;
+    uint8_t m_tima = 0;
+    uint8_t m_tma = 0;
+    uint8_t m_tac = 0;
+
+    std::function<void(uint16_t)> m_div_reset_callback;
+
+    static constexpr uint16_t DIV_COUNTER_MASK = 0x3FFF;
+
+    // m-cycles per TIMA increment for each TAC clock select
+    static constexpr unsigned int TIMA_PERIODS[] = {256, 4, 16, 64};
 
     static constexpr uint16_t DIV_ADDR = 0xFF04;
     static constexpr uint16_t TIMA_ADDR = 0xFF05;
     static constexpr uint16_t TMA_ADDR = 0xFF06;
     static constexpr uint16_t TAC_ADDR = 0xFF07;
-};
\ No newline at end of file
+};
@@ -0,0 +1,102 @@
+#include "trace.hpp"
+#include <mutex>
+#include <vector>
+#include <cstdio>
+
+struct trace_registry_t {
+    std::mutex mutex;
+    std::vector<std::unique_ptr<TraceBuffer>> buffers;
+
+    // taken when the first thread registers, ticks are converted against the clock on export
+    uint64_t start_ticks = 0;
+    std::chrono::steady_clock::time_point start_time;
+};
+
+// never destroyed, threads may still record while the process exits
+static trace_registry_t& registry() {
+    static trace_registry_t* instance = new trace_registry_t();
+    return *instance;
+}
+
+TraceBuffer::TraceBuffer(uint32_t thread_id, uint64_t now):
+    m_events(new trace_event_t[CAPACITY]),
+    m_thread_id(thread_id),
+    m_last_split(now) {}
+
+TraceBuffer* Tracer::registerThread() {
+    trace_registry_t& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+
+    const uint64_t now = Now();
+    if (reg.buffers.empty()) {
+        reg.start_ticks = now;
+        reg.start_time = std::chrono::steady_clock::now();
+    }
+
+    // buffers outlive their threads so events of finished threads still get exported
+    reg.buffers.push_back(std::make_unique<TraceBuffer>(static_cast<uint32_t>(reg.buffers.size() + 1), now));
+    s_thread_buffer = reg.buffers.back().get();
+    return s_thread_buffer;
+}
+
+void Tracer::Split(const char* name) {
+    TraceBuffer* buffer = s_thread_buffer ? s_thread_buffer : registerThread();
+    const uint64_t now = Now();
+    buffer->Push({name, buffer->m_last_split, now});
+    buffer->m_last_split = now;
+}
+
+void Tracer::SetThreadName(const char* name) {
+    TraceBuffer* buffer = s_thread_buffer ? s_thread_buffer : registerThread();
+    std::lock_guard<std::mutex> lock(registry().mutex);
+    buffer->m_thread_name = name;
+}
+
+bool Tracer::WriteChromeTrace(const std::string& path) {
+    trace_registry_t& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+
+    FILE* file = fopen(path.c_str(), "w");
+    if (!file) {
+        printf("Failed to open %s\n", path.c_str());
+        return false;
+    }
+
+    // tsc ticks per microsecond, measured over the whole recording
+    const double elapsed_us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - reg.start_time).count();
+    const uint64_t elapsed_ticks = Now() - reg.start_ticks;
+    const double ticks_per_us = elapsed_us > 0.0 && elapsed_ticks > 0 ? elapsed_ticks / elapsed_us : 1000.0;
+
+    fprintf(file, "{\"displayTimeUnit\": \"ns\", \"traceEvents\": [\n");
+    bool first = true;
+    uint64_t dropped = 0;
+
+    for (const auto& buffer : reg.buffers) {
+        const uint32_t tid = buffer->GetThreadId();
+        if (!buffer->m_thread_name.empty()) {
+            fprintf(file, "%s{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %u, \"args\": {\"name\": \"%s\"}}",
+                    first ? "" : ",\n", tid, buffer->m_thread_name.c_str());
+            first = false;
+        }
+
+        const uint64_t written = buffer->GetWrittenCount();
+        const uint64_t begin = written > TraceBuffer::CAPACITY ? written - TraceBuffer::CAPACITY : 0;
+        dropped += begin;
+
+        for (uint64_t i = begin; i < written; ++i) {
+            const trace_event_t& event = buffer->GetEvent(i);
+            const double start_us = static_cast<int64_t>(event.start - reg.start_ticks) / ticks_per_us;
+            const double duration_us = (event.end - event.start) / ticks_per_us;
+            fprintf(file, "%s{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 1, \"tid\": %u, \"ts\": %.3f, \"dur\": %.3f}",
+                    first ? "" : ",\n", event.name, tid, start_us, duration_us);
+            first = false;
+        }
+    }
+
+    fprintf(file, "\n]}\n");
+    const bool ok = ferror(file) == 0;
+    fclose(file);
+
+    if (dropped != 0) printf("Trace: the %llu oldest events didn't fit\n", static_cast<unsigned long long>(dropped));
+    return ok;
+}
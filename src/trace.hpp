@@ -0,0 +1,119 @@
+#pragma once
+#include <stdint.h>
+#include <stddef.h>
+#include <string>
+#include <atomic>
+#include <memory>
+#include <chrono>
+
+#if defined(__x86_64__) || defined(_M_X64)
+#define TRACE_USE_TSC 1
+#ifdef _MSC_VER
+#include <intrin.h>
+#else
+#include <x86intrin.h>
+#endif
+#endif
+
+/*
+Scoped host timers for seeing where the time of a frame goes, exported as a Chrome trace that
+chrome://tracing and ui.perfetto.dev open. They are compiled in with GB_TRACE (cmake -DGB_TRACE=ON),
+otherwise the macros expand to nothing.
+Every thread records into its own ring that keeps the newest events, without locking; only the first
+event of a thread takes a lock to register its ring. Names have to be string literals, only the
+pointer is kept. Export after the recording threads are done.
+*/
+
+struct trace_event_t {
+    const char* name;
+    uint64_t start;
+    uint64_t end;
+};
+
+class TraceBuffer {
+public:
+    TraceBuffer(uint32_t thread_id, uint64_t now);
+
+    // single writer, the owning thread
+    inline void Push(const trace_event_t& event) {
+        const uint64_t index = m_written.load(std::memory_order_relaxed);
+        m_events[index & (CAPACITY - 1)] = event;
+        m_written.store(index + 1, std::memory_order_release);
+    }
+
+    inline uint64_t GetWrittenCount() const { return m_written.load(std::memory_order_acquire); }
+    inline const trace_event_t& GetEvent(uint64_t index) const { return m_events[index & (CAPACITY - 1)]; }
+    inline uint32_t GetThreadId() const { return m_thread_id; }
+
+    // 6 MB per thread, a few minutes of frames at full speed
+    static constexpr size_t CAPACITY = 1 << 18;
+
+private:
+    friend class Tracer;
+
+    std::unique_ptr<trace_event_t[]> m_events;
+    std::atomic<uint64_t> m_written = 0;
+    uint32_t m_thread_id;
+    std::string m_thread_name;
+    uint64_t m_last_split;
+};
+
+class Tracer {
+public:
+    // tsc ticks where available, steady clock nanoseconds elsewhere; converted on export
+    static inline uint64_t Now() {
+#ifdef TRACE_USE_TSC
+        return __rdtsc();
+#else
+        return static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+    }
+
+    static inline void Record(const char* name, uint64_t start, uint64_t end) {
+        TraceBuffer* buffer = s_thread_buffer ? s_thread_buffer : registerThread();
+        buffer->Push({name, start, end});
+    }
+
+    // records the time since the previous split of this thread, for spans no scope fits around
+    static void Split(const char* name);
+    static void SetThreadName(const char* name);
+
+    static bool WriteChromeTrace(const std::string& path);
+
+#ifdef GB_TRACE
+    static constexpr bool IS_ENABLED = true;
+#else
+    static constexpr bool IS_ENABLED = false;
+#endif
+
+private:
+    static TraceBuffer* registerThread();
+
+    static inline thread_local TraceBuffer* s_thread_buffer = nullptr;
+};
+
+class TraceScope {
+public:
+    inline TraceScope(const char* name): m_name(name), m_start(Tracer::Now()) {}
+    inline ~TraceScope() { Tracer::Record(m_name, m_start, Tracer::Now()); }
+
+    TraceScope(const TraceScope&) = delete;
+    TraceScope& operator=(const TraceScope&) = delete;
+
+private:
+    const char* m_name;
+    uint64_t m_start;
+};
+
+#define TRACE_CONCAT_INNER(a, b) a##b
+#define TRACE_CONCAT(a, b) TRACE_CONCAT_INNER(a, b)
+
+#ifdef GB_TRACE
+#define TRACE_SCOPE(name) TraceScope TRACE_CONCAT(trace_scope_, __LINE__)(name)
+#define TRACE_SPLIT(name) Tracer::Split(name)
+#define TRACE_THREAD_NAME(name) Tracer::SetThreadName(name)
+#else
+#define TRACE_SCOPE(name)
+#define TRACE_SPLIT(name)
+#define TRACE_THREAD_NAME(name)
+#endif
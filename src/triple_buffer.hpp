@@ -0,0 +1,54 @@
+#pragma once
+#include <stdint.h>
+#include <atomic>
+
+/*
+Lock-free triple buffer for handing whole frames from one producer to one consumer.
+The producer always has a buffer to write into and the consumer always reads the most
+recently published one, neither side ever waits for the other.
+*/
+
+template <typename T>
+class TripleBuffer {
+public:
+    TripleBuffer(const T& initial_value): m_buffers{initial_value, initial_value, initial_value} {}
+
+    // producer side
+    inline T& GetWriteBuffer() { return m_buffers[m_write_index]; }
+
+    void Publish() {
+        const uint8_t previous = m_middle.exchange(m_write_index | FRESH_BIT, std::memory_order_acq_rel);
+        m_write_index = previous & INDEX_MASK;
+        if (previous & FRESH_BIT) m_overwritten_count++;
+    }
+
+    // published buffers the consumer never got to see, producer side
+    inline uint64_t GetOverwrittenCount() const { return m_overwritten_count; }
+
+    // the last published buffer hasn't been picked up by the consumer yet
+    inline bool HasUnreadData() const { return m_middle.load(std::memory_order_acquire) & FRESH_BIT; }
+
+    // consumer side, swaps in the most recently published buffer, returns false if there is none
+    bool Update() {
+        if (!HasUnreadData()) return false;
+        const uint8_t previous = m_middle.exchange(m_read_index, std::memory_order_acq_rel);
+        m_read_index = previous & INDEX_MASK;
+        return true;
+    }
+
+    inline const T& GetReadBuffer() const { return m_buffers[m_read_index]; }
+
+private:
+    static constexpr uint8_t FRESH_BIT = 0x4;
+    static constexpr uint8_t INDEX_MASK = 0x3;
+
+    T m_buffers[3];
+
+    // index of the buffer between producer and consumer, plus whether it holds unread data
+    alignas(64) std::atomic<uint8_t> m_middle = 1;
+
+    // each only touched by its own side
+    alignas(64) uint8_t m_write_index = 0;
+    uint64_t m_overwritten_count = 0;
+    alignas(64) uint8_t m_read_index = 2;
+};
@@ -0,0 +1,68 @@
+#include "emulator.hpp"
+#include "audio_sink.hpp"
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+/*
+Regression tests for bugs that were found on small hand assembled roms. Every test builds its rom,
+runs it and returns false on a failure; a test that hangs is killed by the ctest timeout.
+*/
+
+static constexpr size_t ROM_SIZE = 0x8000;
+static constexpr uint16_t ENTRY_ADDR = 0x0150;
+
+// a 32 KB rom without a mapper that jumps straight to the given code
+static std::string writeRom(const std::string& name, const std::vector<uint8_t>& code) {
+    std::vector<uint8_t> rom(ROM_SIZE, 0);
+    const uint8_t entry[] = {0x00, 0xC3, ENTRY_ADDR & 0xFF, ENTRY_ADDR >> 8};
+    std::copy(std::begin(entry), std::end(entry), rom.begin() + 0x0100);
+    std::copy(code.begin(), code.end(), rom.begin() + ENTRY_ADDR);
+
+    const std::string path = (std::filesystem::temp_directory_path() / (name + ".gb")).string();
+    std::ofstream file(path, std::ios::binary | std::ios::trunc);
+    file.write(reinterpret_cast<const char*>(rom.data()), rom.size());
+    return path;
+}
+
+// power cycling the apu used to leave the noise period at 0, so triggering the noise channel
+// before writing NR43 spun forever in the synthesis loop
+static bool noiseAfterPowerCycle() {
+    const std::string path = writeRom("noise_after_power_cycle", {
+        0xAF, 0xE0, 0x26,       // NR52 = 0
+        0x3E, 0x80, 0xE0, 0x26, // NR52 = 0x80
+        0x3E, 0xF0, 0xE0, 0x21, // NR42 = 0xF0, dac on
+        0x3E, 0x80, 0xE0, 0x23, // NR44 = 0x80, trigger
+        0x18, 0xFE,             // jr -2
+    });
+
+    HashAudioSink sink;
+    Emulator emulator(path, &sink);
+    emulator.GetCpu().SetLogVerbose(false);
+    emulator.RunUntil(60 * Emulator::CYCLES_PER_FRAME);
+    std::filesystem::remove(path);
+
+    return sink.GetSampleCount() != 0;
+}
+
+struct test_t {
+    const char* name;
+    std::function<bool()> run;
+};
+
+int main() {
+    const test_t tests[] = {
+        {"apu.noise_after_power_cycle", noiseAfterPowerCycle},
+    };
+
+    unsigned int failed = 0;
+    for (const test_t& test : tests) {
+        const bool passed = test.run();
+        printf("%s %s\n", passed ? "PASS" : "FAIL", test.name);
+        if (!passed) failed++;
+    }
+    return failed == 0 ? 0 : 1;
+}